@@ -0,0 +1,71 @@
+#include "Arena.h"
+#include <algorithm>
+#include <cstdint>
+
+Arena::Scope::Scope(Arena& arena) :
+    arena(arena),
+    block(arena.current),
+    offset(arena.offset)
+{
+}
+
+Arena::Scope::~Scope()
+{
+    arena.current = block;
+    arena.offset = offset;
+}
+
+Arena::Arena() :
+    current(0),
+    offset(0),
+    reserved(0)
+{
+}
+
+void Arena::reset()
+{
+    if (blocks.size() > 1) {
+        size_t size = reserved;
+        blocks.clear();
+        reserved = 0;
+        addBlock(size);
+    }
+    current = 0;
+    offset = 0;
+}
+
+Arena& Arena::Scratch()
+{
+    static thread_local Arena scratch;
+    return scratch;
+}
+
+void Arena::addBlock(size_t size)
+{
+    blocks.push_back({ std::unique_ptr<std::byte[]>(new std::byte[size]), size });
+    reserved += size;
+}
+
+void* Arena::do_allocate(size_t bytes, size_t alignment)
+{
+    // Later blocks kept from an earlier use are tried before a new one is added
+    for (;;) {
+        if (current < blocks.size()) {
+            uintptr_t start = reinterpret_cast<uintptr_t>(blocks[current].memory.get());
+            uintptr_t aligned = (start + offset + alignment - 1) & ~uintptr_t(alignment - 1);
+            if (aligned + bytes <= start + blocks[current].size) {
+                offset = aligned + bytes - start;
+                return reinterpret_cast<void*>(aligned);
+            }
+            if (current + 1 < blocks.size()) {
+                current++;
+                offset = 0;
+                continue;
+            }
+        }
+        size_t size = blocks.empty() ? size_t(ARENA_BLOCK_SIZE) : blocks.back().size * 2;
+        addBlock(std::max(size, bytes + alignment));
+        current = blocks.size() - 1;
+        offset = 0;
+    }
+}
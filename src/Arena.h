@@ -0,0 +1,73 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+// Bytes in an arena's first block, each block added after it is twice the size of the last
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+// Memory for data that lives no longer than a render or a part of one: ray
+// queues, hit records, tile and build scratch. Allocating moves an offset
+// through a block, freeing does nothing, and reset() or the end of a Scope makes
+// the memory free again in O(1). Blocks are kept between uses, so once an arena
+// has grown to fit a render the next one takes nothing from the heap.
+// It is a std::pmr::memory_resource, so std::pmr containers can be kept in it.
+// An arena may only be allocated from by one thread at a time.
+class Arena : public std::pmr::memory_resource
+{
+public:
+    // Gives back everything the arena handed out after the scope was opened when
+    // it closes. Scopes on one arena have to close in the reverse order they opened.
+    class Scope
+    {
+    public:
+        explicit Scope(Arena& arena);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Arena& arena;
+        size_t block, offset;
+    };
+
+    Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Frees everything allocated. An arena that needed more than one block
+    // swaps them for one block as big as all of them together.
+    void reset();
+
+    // Uninitialised room for count objects of a trivially destructible type
+    template <typename T> T* allocateArray(size_t count) {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    // Bytes in the arena's blocks
+    size_t capacity() const { return reserved; }
+
+    // The calling thread's scratch arena, for data that does not outlive a Scope
+    static Arena& Scratch();
+
+private:
+    struct Block {
+        std::unique_ptr<std::byte[]> memory;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    // Block being allocated from and the bytes of it in use
+    size_t current, offset;
+    size_t reserved;
+
+    void addBlock(size_t size);
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void*, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+#endif // ARENA_H
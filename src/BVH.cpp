@@ -0,0 +1,411 @@
+#include "BVH.h"
+#include "Arena.h"
+#include <bit>
+#include <omp.h>
+
+// Number of SAH buckets per axis
+#define BVH_BINS 16
+// Leaves are never split below this many triangles
+#define BVH_MAX_LEAF_SIZE 4
+// Guard against degenerate splits blowing the traversal stack
+#define BVH_MAX_DEPTH 60
+// Subtrees smaller than this are built by a single task
+#define BVH_TASK_THRESHOLD 1024
+// Nodes at least this big do their bounds reduction and binning in parallel
+#define BVH_PARALLEL_THRESHOLD 65536
+// Relative cost of visiting a node compared to testing a triangle
+#define BVH_TRAVERSAL_COST 1.0f
+// Refit spawns tasks for the subtrees of nodes above this depth
+#define BVH_REFIT_TASK_DEPTH 8
+// Rebuild once a refitted tree costs this much more than it did when built
+#define BVH_REFIT_MAX_DEGRADATION 1.5f
+
+BVH::AABB::AABB():
+    min(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()),
+    max(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max())
+{
+}
+
+void BVH::AABB::grow(const Cartesian3& p) {
+    min = Cartesian3(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+    max = Cartesian3(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+}
+
+void BVH::AABB::grow(const AABB& other) {
+    min = Cartesian3(std::min(min.x, other.min.x), std::min(min.y, other.min.y), std::min(min.z, other.min.z));
+    max = Cartesian3(std::max(max.x, other.max.x), std::max(max.y, other.max.y), std::max(max.z, other.max.z));
+}
+
+float BVH::AABB::surfaceArea() const {
+    Cartesian3 e = max - min;
+    if (e.x < 0.0f) return 0.0f;
+    return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+void BVH::clear() {
+    nodes.clear();
+    triIndices.clear();
+}
+
+int BVH::allocateNodePair() {
+    int index;
+    #pragma omp atomic capture
+    { index = nodeCount; nodeCount += 2; }
+    return index;
+}
+
+void BVH::makeLeaf(int nodeIndex, int first, int count) {
+    nodes[nodeIndex].leftFirst = first;
+    nodes[nodeIndex].triCount = count;
+}
+
+// Spreads a range of primitives' bounds into world and centroid bounds,
+// splitting the reduction into tasks when the range is big
+void BVH::rangeBounds(int first, int count, AABB& bounds, AABB& centroidBounds) {
+    if (count < BVH_PARALLEL_THRESHOLD) {
+        for (int i = first; i < first + count; i++) {
+            bounds.grow(primitives[triIndices[i]].bounds);
+            centroidBounds.grow(primitives[triIndices[i]].centroid);
+        }
+        return;
+    }
+
+    int chunks = omp_get_max_threads() * 4;
+    Arena& scratch = Arena::Scratch();
+    Arena::Scope scope(scratch);
+    std::pmr::vector<AABB> partialBounds(chunks, &scratch), partialCentroids(chunks, &scratch);
+    #pragma omp taskloop shared(partialBounds, partialCentroids)
+    for (int c = 0; c < chunks; c++) {
+        int begin = first + int((long long)count * c / chunks);
+        int end = first + int((long long)count * (c + 1) / chunks);
+        for (int i = begin; i < end; i++) {
+            partialBounds[c].grow(primitives[triIndices[i]].bounds);
+            partialCentroids[c].grow(primitives[triIndices[i]].centroid);
+        }
+    }
+    for (int c = 0; c < chunks; c++) {
+        bounds.grow(partialBounds[c]);
+        centroidBounds.grow(partialCentroids[c]);
+    }
+}
+
+void BVH::build(const std::vector<Triangle>& triangles, BuildType type) {
+    clear();
+    int n = int(triangles.size());
+    if (n == 0) return;
+
+    // Gather per triangle bounds and centroids
+    primitives.resize(n);
+    triIndices.resize(n);
+    #pragma omp parallel for
+    for (int i = 0; i < n; i++) {
+        BuildPrimitive& p = primitives[i];
+        p.bounds = AABB();
+        for (int v = 0; v < 3; v++)
+            p.bounds.grow(triangles[i].verts[v].Point());
+        p.centroid = (p.bounds.min + p.bounds.max) * 0.5f;
+        triIndices[i] = i;
+    }
+
+    // A binary tree over n leaves never needs more than 2n - 1 nodes
+    nodes.resize(2 * n);
+    nodeCount = 1;
+
+    if (type == BuildType::sah) {
+        #pragma omp parallel
+        #pragma omp single
+        subdivideSAH(0, 0, n, 0);
+    }
+    else {
+        AABB bounds, centroidBounds;
+        #pragma omp parallel
+        #pragma omp single
+        rangeBounds(0, n, bounds, centroidBounds);
+        Cartesian3 extent = centroidBounds.max - centroidBounds.min;
+        Cartesian3 scale(extent.x > 0.0f ? 1023.0f / extent.x : 0.0f,
+                         extent.y > 0.0f ? 1023.0f / extent.y : 0.0f,
+                         extent.z > 0.0f ? 1023.0f / extent.z : 0.0f);
+
+        // Morton code in the high bits, triangle index in the low bits, so one sort orders both
+        mortonKeys.resize(n);
+        #pragma omp parallel for
+        for (int i = 0; i < n; i++) {
+            Cartesian3 c = primitives[i].centroid - centroidBounds.min;
+            unsigned int x = unsigned(c.x * scale.x), y = unsigned(c.y * scale.y), z = unsigned(c.z * scale.z);
+            unsigned long long code = 0;
+            for (int b = 0; b < 10; b++) {
+                code |= (unsigned long long)((x >> b) & 1) << (3 * b + 2);
+                code |= (unsigned long long)((y >> b) & 1) << (3 * b + 1);
+                code |= (unsigned long long)((z >> b) & 1) << (3 * b);
+            }
+            mortonKeys[i] = (code << 32) | unsigned(i);
+        }
+
+        #pragma omp parallel
+        #pragma omp single
+        {
+            parallelSort(mortonKeys.data(), mortonKeys.data() + n);
+            for (int i = 0; i < n; i++)
+                triIndices[i] = int(mortonKeys[i] & 0xffffffffu);
+            subdivideLBVH(0, 0, n, 0);
+        }
+        mortonKeys.clear();
+    }
+
+    nodes.resize(nodeCount);
+    primitives.clear();
+
+    buildType = type;
+    builtCost = currentCost = sahCost();
+}
+
+float BVH::sahCost() const {
+    if (nodes.empty()) return 0.0f;
+
+    float cost = 0.0f;
+    #pragma omp parallel for reduction(+:cost)
+    for (int i = 0; i < int(nodes.size()); i++) {
+        const Node& node = nodes[i];
+        if (node.isLeaf())
+            cost += node.bounds.surfaceArea() * node.triCount;
+        else
+            cost += node.bounds.surfaceArea() * BVH_TRAVERSAL_COST;
+    }
+    return cost / nodes[0].bounds.surfaceArea();
+}
+
+bool BVH::refit(const std::vector<Triangle>& triangles) {
+    if (nodes.empty()) return false;
+
+    #pragma omp parallel
+    #pragma omp single
+    refitNode(triangles, 0, 0);
+
+    currentCost = sahCost();
+    return currentCost <= builtCost * BVH_REFIT_MAX_DEGRADATION;
+}
+
+// Children always live after their parent, so both subtrees are
+// refitted (as tasks near the root) before the parent takes their union
+BVH::AABB BVH::refitNode(const std::vector<Triangle>& triangles, int nodeIndex, int depth) {
+    Node& node = nodes[nodeIndex];
+    node.bounds = AABB();
+
+    if (node.isLeaf()) {
+        for (int i = node.leftFirst; i < node.leftFirst + node.triCount; i++)
+            for (int v = 0; v < 3; v++)
+                node.bounds.grow(triangles[triIndices[i]].verts[v].Point());
+        return node.bounds;
+    }
+
+    AABB leftBounds, rightBounds;
+    if (depth < BVH_REFIT_TASK_DEPTH) {
+        #pragma omp task shared(leftBounds, triangles)
+        leftBounds = refitNode(triangles, node.leftFirst, depth + 1);
+        #pragma omp task shared(rightBounds, triangles)
+        rightBounds = refitNode(triangles, node.leftFirst + 1, depth + 1);
+        #pragma omp taskwait
+    }
+    else {
+        leftBounds = refitNode(triangles, node.leftFirst, depth + 1);
+        rightBounds = refitNode(triangles, node.leftFirst + 1, depth + 1);
+    }
+
+    node.bounds = leftBounds;
+    node.bounds.grow(rightBounds);
+    return node.bounds;
+}
+
+// Merge sort with both halves sorted as separate tasks
+void BVH::parallelSort(unsigned long long* begin, unsigned long long* end) {
+    if (end - begin < BVH_TASK_THRESHOLD * 16) {
+        std::sort(begin, end);
+        return;
+    }
+    unsigned long long* mid = begin + (end - begin) / 2;
+    #pragma omp task
+    parallelSort(begin, mid);
+    #pragma omp task
+    parallelSort(mid, end);
+    #pragma omp taskwait
+    std::inplace_merge(begin, mid, end);
+}
+
+void BVH::subdivideSAH(int nodeIndex, int first, int count, int depth) {
+    Node& node = nodes[nodeIndex];
+    AABB centroidBounds;
+    node.bounds = AABB();
+    rangeBounds(first, count, node.bounds, centroidBounds);
+
+    if (count <= BVH_MAX_LEAF_SIZE || depth >= BVH_MAX_DEPTH) {
+        makeLeaf(nodeIndex, first, count);
+        return;
+    }
+
+    // Bin the centroids along each axis
+    struct Bin {
+        AABB bounds;
+        int count = 0;
+    };
+    Bin bins[3][BVH_BINS];
+    Cartesian3 extent = centroidBounds.max - centroidBounds.min;
+    float axisMin[3] = { centroidBounds.min.x, centroidBounds.min.y, centroidBounds.min.z };
+    float axisExtent[3] = { extent.x, extent.y, extent.z };
+
+    auto binIndex = [&](int axis, const Cartesian3& c) {
+        float v = axis == 0 ? c.x : (axis == 1 ? c.y : c.z);
+        int b = int(BVH_BINS * (v - axisMin[axis]) / axisExtent[axis]);
+        return std::clamp(b, 0, BVH_BINS - 1);
+    };
+
+    if (count < BVH_PARALLEL_THRESHOLD) {
+        for (int i = first; i < first + count; i++) {
+            const BuildPrimitive& p = primitives[triIndices[i]];
+            for (int axis = 0; axis < 3; axis++) {
+                if (axisExtent[axis] <= 0.0f) continue;
+                Bin& bin = bins[axis][binIndex(axis, p.centroid)];
+                bin.bounds.grow(p.bounds);
+                bin.count++;
+            }
+        }
+    }
+    else {
+        // Each chunk fills its own set of bins which are then merged
+        int chunks = omp_get_max_threads() * 4;
+        Arena& scratch = Arena::Scratch();
+        Arena::Scope scope(scratch);
+        std::pmr::vector<Bin> partial(size_t(chunks) * 3 * BVH_BINS, &scratch);
+        #pragma omp taskloop shared(partial)
+        for (int c = 0; c < chunks; c++) {
+            int begin = first + int((long long)count * c / chunks);
+            int end = first + int((long long)count * (c + 1) / chunks);
+            Bin* chunkBins = &partial[size_t(c) * 3 * BVH_BINS];
+            for (int i = begin; i < end; i++) {
+                const BuildPrimitive& p = primitives[triIndices[i]];
+                for (int axis = 0; axis < 3; axis++) {
+                    if (axisExtent[axis] <= 0.0f) continue;
+                    Bin& bin = chunkBins[axis * BVH_BINS + binIndex(axis, p.centroid)];
+                    bin.bounds.grow(p.bounds);
+                    bin.count++;
+                }
+            }
+        }
+        for (int c = 0; c < chunks; c++)
+            for (int axis = 0; axis < 3; axis++)
+                for (int b = 0; b < BVH_BINS; b++) {
+                    const Bin& bin = partial[(size_t(c) * 3 + axis) * BVH_BINS + b];
+                    bins[axis][b].bounds.grow(bin.bounds);
+                    bins[axis][b].count += bin.count;
+                }
+    }
+
+    // Sweep the bins from both sides to evaluate every split plane
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1, bestSplit = -1;
+    for (int axis = 0; axis < 3; axis++) {
+        if (axisExtent[axis] <= 0.0f) continue;
+        float leftArea[BVH_BINS - 1];
+        int leftCount[BVH_BINS - 1];
+        AABB leftBox;
+        int leftSum = 0;
+        for (int b = 0; b < BVH_BINS - 1; b++) {
+            leftBox.grow(bins[axis][b].bounds);
+            leftSum += bins[axis][b].count;
+            leftArea[b] = leftBox.surfaceArea();
+            leftCount[b] = leftSum;
+        }
+        AABB rightBox;
+        int rightSum = 0;
+        for (int b = BVH_BINS - 1; b > 0; b--) {
+            rightBox.grow(bins[axis][b].bounds);
+            rightSum += bins[axis][b].count;
+            float cost = leftCount[b - 1] * leftArea[b - 1] + rightSum * rightBox.surfaceArea();
+            if (leftCount[b - 1] > 0 && rightSum > 0 && cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b;
+            }
+        }
+    }
+
+    // Keep it as a leaf when splitting does not pay off
+    float leafCost = count * node.bounds.surfaceArea();
+    float splitCost = BVH_TRAVERSAL_COST * node.bounds.surfaceArea() + bestCost;
+    if (bestAxis == -1 || (splitCost >= leafCost && count <= BVH_MAX_LEAF_SIZE * 4)) {
+        makeLeaf(nodeIndex, first, count);
+        return;
+    }
+
+    int* mid = std::partition(triIndices.data() + first, triIndices.data() + first + count, [&](int index) {
+        return binIndex(bestAxis, primitives[index].centroid) < bestSplit;
+    });
+    int leftCount = int(mid - (triIndices.data() + first));
+
+    int left = allocateNodePair();
+    node.leftFirst = left;
+    node.triCount = 0;
+
+    if (count >= BVH_TASK_THRESHOLD) {
+        #pragma omp task
+        subdivideSAH(left, first, leftCount, depth + 1);
+        #pragma omp task
+        subdivideSAH(left + 1, first + leftCount, count - leftCount, depth + 1);
+    }
+    else {
+        subdivideSAH(left, first, leftCount, depth + 1);
+        subdivideSAH(left + 1, first + leftCount, count - leftCount, depth + 1);
+    }
+}
+
+// Splits the sorted range at the highest Morton bit that differs,
+// bounds are only known once both children are done so they are built bottom up
+BVH::AABB BVH::subdivideLBVH(int nodeIndex, int first, int count, int depth) {
+    Node& node = nodes[nodeIndex];
+
+    if (count <= BVH_MAX_LEAF_SIZE || depth >= BVH_MAX_DEPTH) {
+        AABB centroidBounds;
+        node.bounds = AABB();
+        rangeBounds(first, count, node.bounds, centroidBounds);
+        makeLeaf(nodeIndex, first, count);
+        return node.bounds;
+    }
+
+    unsigned long long firstCode = mortonKeys[first] >> 32;
+    unsigned long long lastCode = mortonKeys[first + count - 1] >> 32;
+    int split = first + count / 2;
+    if (firstCode != lastCode) {
+        // Binary search for the last key sharing the common prefix with the first one
+        int prefix = std::countl_zero(firstCode ^ lastCode);
+        int lo = first, hi = first + count - 1;
+        while (hi - lo > 1) {
+            int m = (lo + hi) / 2;
+            if (std::countl_zero(firstCode ^ (mortonKeys[m] >> 32)) > prefix)
+                lo = m;
+            else
+                hi = m;
+        }
+        split = hi;
+    }
+    int leftCount = split - first;
+
+    int left = allocateNodePair();
+    node.leftFirst = left;
+    node.triCount = 0;
+
+    AABB leftBounds, rightBounds;
+    if (count >= BVH_TASK_THRESHOLD) {
+        #pragma omp task shared(leftBounds)
+        leftBounds = subdivideLBVH(left, first, leftCount, depth + 1);
+        #pragma omp task shared(rightBounds)
+        rightBounds = subdivideLBVH(left + 1, split, count - leftCount, depth + 1);
+        #pragma omp taskwait
+    }
+    else {
+        leftBounds = subdivideLBVH(left, first, leftCount, depth + 1);
+        rightBounds = subdivideLBVH(left + 1, split, count - leftCount, depth + 1);
+    }
+
+    node.bounds = leftBounds;
+    node.bounds.grow(rightBounds);
+    return node.bounds;
+}
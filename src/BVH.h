@@ -0,0 +1,153 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+#include "Cartesian3.h"
+#include "Ray.h"
+#include "Triangle.h"
+
+// Bounding volume hierarchy over the scene's triangle soup.
+// Built either with a binned SAH (final quality) or as an LBVH
+// from sorted Morton codes (fast build for previews).
+class BVH
+{
+public:
+    enum BuildType{fast, sah};
+
+    // Sentinel distance for rays that miss a box. Kept finite on purpose,
+    // -ffast-math lets the compiler assume infinities never show up.
+    static constexpr float miss = std::numeric_limits<float>::max();
+
+    struct AABB {
+        Cartesian3 min;
+        Cartesian3 max;
+
+        AABB();
+        void grow(const Cartesian3& p);
+        void grow(const AABB& other);
+        float surfaceArea() const;
+        // Slab test, returns the entry distance or BVH::miss when the box is not hit
+        inline float intersect(const Cartesian3& origin, const Cartesian3& invDir, float tMax) const {
+            float tx1 = (min.x - origin.x) * invDir.x, tx2 = (max.x - origin.x) * invDir.x;
+            float tNear = std::min(tx1, tx2), tFar = std::max(tx1, tx2);
+            float ty1 = (min.y - origin.y) * invDir.y, ty2 = (max.y - origin.y) * invDir.y;
+            tNear = std::max(tNear, std::min(ty1, ty2)); tFar = std::min(tFar, std::max(ty1, ty2));
+            float tz1 = (min.z - origin.z) * invDir.z, tz2 = (max.z - origin.z) * invDir.z;
+            tNear = std::max(tNear, std::min(tz1, tz2)); tFar = std::min(tFar, std::max(tz1, tz2));
+            if (tFar >= tNear && tNear <= tMax && tFar > 0.0f)
+                return tNear;
+            return miss;
+        }
+    };
+
+    struct Node {
+        AABB bounds;
+        // Interior nodes: index of the left child, the right child is always leftFirst + 1
+        // Leaves: index of the first entry in triIndices
+        int leftFirst;
+        // Number of triangles in a leaf, 0 for interior nodes
+        int triCount;
+
+        inline bool isLeaf() const { return triCount > 0; }
+    };
+
+    std::vector<Node> nodes;
+    // Triangle indices referenced by the leaves
+    std::vector<int> triIndices;
+    // How the current tree was built and its SAH cost right after that build
+    BuildType buildType;
+    float builtCost;
+    // SAH cost of the tree as it is now, as of the last build or refit
+    float currentCost;
+
+    void build(const std::vector<Triangle>& triangles, BuildType type);
+    void clear();
+    // Recomputes every node's bounds bottom up after the triangles moved, keeping
+    // the topology. Returns false once the tree has degraded enough to need a rebuild.
+    bool refit(const std::vector<Triangle>& triangles);
+    // Expected cost of tracing a ray through the tree, relative to the root's area
+    float sahCost() const;
+
+    // Walks the hierarchy (or the subtree under root) front to back, calling
+    // leaf(triangleIndex) for every triangle in a leaf the ray reaches. The leaf
+    // function is expected to shrink tMax when it finds a closer hit so that farther
+    // nodes get culled. A leaf function returning bool can stop the walk by returning true.
+    template <typename LeafFunction>
+    void traverse(const Ray& ray, float& tMax, LeafFunction&& leaf, int root = 0) const {
+        if (nodes.empty()) return;
+
+        Cartesian3 invDir(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+        int stack[64];
+        int stackPtr = 0;
+        int current = root;
+
+        if (nodes[root].bounds.intersect(ray.origin, invDir, tMax) == miss)
+            return;
+
+        while (true) {
+            const Node& node = nodes[current];
+            if (node.isLeaf()) {
+                for (int i = 0; i < node.triCount; i++) {
+                    if constexpr (std::is_same_v<decltype(leaf(0)), bool>) {
+                        if (leaf(triIndices[node.leftFirst + i]))
+                            return;
+                    }
+                    else {
+                        leaf(triIndices[node.leftFirst + i]);
+                    }
+                }
+            }
+            else {
+                // Visit the nearer child first and push the farther one
+                int near = node.leftFirst;
+                int far = node.leftFirst + 1;
+                float tNear = nodes[near].bounds.intersect(ray.origin, invDir, tMax);
+                float tFar = nodes[far].bounds.intersect(ray.origin, invDir, tMax);
+                if (tFar < tNear) {
+                    std::swap(near, far);
+                    std::swap(tNear, tFar);
+                }
+                if (tNear != miss) {
+                    if (tFar != miss)
+                        stack[stackPtr++] = far;
+                    current = near;
+                    continue;
+                }
+            }
+
+            // Pop the next node that is still in front of the closest hit
+            bool found = false;
+            while (stackPtr > 0) {
+                current = stack[--stackPtr];
+                if (nodes[current].bounds.intersect(ray.origin, invDir, tMax) != miss) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) return;
+        }
+    }
+
+private:
+    struct BuildPrimitive {
+        AABB bounds;
+        Cartesian3 centroid;
+    };
+
+    std::vector<BuildPrimitive> primitives;
+    std::vector<unsigned long long> mortonKeys;
+    int nodeCount;
+
+    int allocateNodePair();
+    void makeLeaf(int nodeIndex, int first, int count);
+    void parallelSort(unsigned long long* begin, unsigned long long* end);
+    void rangeBounds(int first, int count, AABB& bounds, AABB& centroidBounds);
+    void subdivideSAH(int nodeIndex, int first, int count, int depth);
+    AABB subdivideLBVH(int nodeIndex, int first, int count, int depth);
+    AABB refitNode(const std::vector<Triangle>& triangles, int nodeIndex, int depth);
+};
+
+#endif // BVH_H
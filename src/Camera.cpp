@@ -0,0 +1,94 @@
+#include "Camera.h"
+
+Camera::Camera():
+    orthographic(false),
+    scaleX(0.0f), offsetX(0.0f),
+    scaleY(0.0f), offsetY(0.0f)
+{
+}
+
+Camera::Camera(int width, int height, float tanHalfFov, bool orthographic):
+    orthographic(orthographic)
+{
+    // A pixel's NDC coordinate is ((pixel + jitter) / size - 0.5) * 2,
+    // which then gets scaled by the extent of the view along that axis
+    float aspect = (float)width / (float)height;
+    float extentX, extentY;
+    if (!orthographic) {
+        extentX = tanHalfFov * aspect;
+        extentY = tanHalfFov;
+    }
+    else {
+        extentX = aspect > 1.0f ? aspect : 1.0f;
+        extentY = aspect > 1.0f ? 1.0f : 1.0f / aspect;
+    }
+    scaleX = 2.0f * extentX / (float)width;
+    offsetX = -extentX;
+    scaleY = 2.0f * extentY / (float)height;
+    offsetY = -extentY;
+}
+
+void Camera::generate(int pixelX, int pixelY, int count, const float* jitterX, const float* jitterY, RayPacket& packet, int stride) const {
+    alignas(64) float lanePixelX[PACKET_SIZE];
+    alignas(64) float lanePixelY[PACKET_SIZE];
+    for (int lane = 0; lane < PACKET_SIZE; lane++) {
+        lanePixelX[lane] = float(pixelX + lane * stride) + (jitterX != nullptr && lane < count ? jitterX[lane] : 0.5f);
+        lanePixelY[lane] = float(pixelY) + (jitterY != nullptr && lane < count ? jitterY[lane] : 0.5f);
+    }
+
+    PacketFloat zero(0.0f), one(1.0f);
+    for (int base = 0; base < PACKET_SIZE; base += PacketFloat::width) {
+        PacketFloat x = PacketFloat::load(lanePixelX + base) * PacketFloat(scaleX) + PacketFloat(offsetX);
+        PacketFloat y = PacketFloat::load(lanePixelY + base) * PacketFloat(scaleY) + PacketFloat(offsetY);
+
+        if (!orthographic) {
+            PacketFloat invLength = one / sqrt(x * x + y * y + one);
+            PacketFloat dx = x * invLength, dy = y * invLength;
+            zero.store(packet.originX + base);
+            zero.store(packet.originY + base);
+            zero.store(packet.originZ + base);
+            dx.store(packet.directionX + base);
+            dy.store(packet.directionY + base);
+            invLength.store(packet.directionZ + base);
+            (one / dx).store(packet.invDirectionX + base);
+            (one / dy).store(packet.invDirectionY + base);
+            (one / invLength).store(packet.invDirectionZ + base);
+        }
+        else {
+            x.store(packet.originX + base);
+            y.store(packet.originY + base);
+            zero.store(packet.originZ + base);
+            zero.store(packet.directionX + base);
+            zero.store(packet.directionY + base);
+            one.store(packet.directionZ + base);
+            (one / zero).store(packet.invDirectionX + base);
+            (one / zero).store(packet.invDirectionY + base);
+            one.store(packet.invDirectionZ + base);
+        }
+    }
+
+    for (int lane = 0; lane < PACKET_SIZE; lane++) {
+        packet.tMax[lane] = 0.0f;
+        packet.triangle[lane] = -1;
+        packet.active[lane] = lane < count ? 1 : 0;
+    }
+}
+
+void Camera::applyCone(Ray& ray) const {
+    // scaleY is the height of a pixel on the z = 1 (or z = 0) plane
+    ray.coneWidth = orthographic ? scaleY : 0.0f;
+    ray.coneSpread = orthographic ? 0.0f : scaleY;
+}
+
+bool Camera::project(const Cartesian3& point, float& pixelX, float& pixelY) const {
+    float x = point.x, y = point.y;
+    if (!orthographic) {
+        if (point.z <= 0.0f)
+            return false;
+        x /= point.z;
+        y /= point.z;
+    }
+    pixelX = (x - offsetX) / scaleX;
+    pixelY = (y - offsetY) / scaleY;
+    return true;
+}
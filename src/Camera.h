@@ -0,0 +1,36 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include "RayPacket.h"
+
+// Pinhole (or orthographic) camera in view space, looking down +z from the origin.
+// Built once per render, it folds the image size, aspect ratio and field of view
+// into one affine map from pixel coordinates to the ray's direction (perspective)
+// or origin (orthographic), so generating a ray is a multiply-add per axis.
+class Camera
+{
+public:
+    Camera();
+    Camera(int width, int height, float tanHalfFov, bool orthographic);
+
+    // Fills lanes 0 to count - 1 of packet with the rays through pixels
+    // (pixelX, pixelY) to (pixelX + (count - 1) * stride, pixelY). The ray of lane i goes through
+    // (pixelX + i * stride + jitterX[i], pixelY + jitterY[i]), or the pixel centres when the jitter is null.
+    void generate(int pixelX, int pixelY, int count, const float* jitterX, const float* jitterY, RayPacket& packet, int stride = 1) const;
+
+    // Gives a camera ray the cone of one pixel: a spreading cone for
+    // perspective, a cylinder a pixel wide for orthographic
+    void applyCone(Ray& ray) const;
+
+    // The reverse of generate(): the pixel coordinates a view space point is seen at,
+    // whole numbers falling on pixel corners. false for points behind a perspective camera.
+    bool project(const Cartesian3& point, float& pixelX, float& pixelY) const;
+
+private:
+    bool orthographic;
+    // Pixel coordinates to view space x and y on the z = 1 plane (perspective) or z = 0 plane (orthographic)
+    float scaleX, offsetX;
+    float scaleY, offsetY;
+};
+
+#endif // CAMERA_H
@@ -20,12 +20,9 @@ class Cartesian3
     inline Cartesian3(float X, float Y, float Z):x(X), y(Y), z(Z)
     {}
 
-    inline Cartesian3(const Cartesian3 &other) : x(other.x), y(other.y), z(other.z)
-    {}
-    
     // equality operator
     inline bool operator ==(const Cartesian3& other) const { 
-        return (abs(x - other.x) < std::numeric_limits<float>::epsilon() && abs(y - other.y) < std::numeric_limits<float>::epsilon() && abs(z - other.z) < std::numeric_limits<float>::epsilon());
+        return (std::abs(x - other.x) < std::numeric_limits<float>::epsilon() && std::abs(y - other.y) < std::numeric_limits<float>::epsilon() && std::abs(z - other.z) < std::numeric_limits<float>::epsilon());
     }
 
     // addition operator
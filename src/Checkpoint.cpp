@@ -0,0 +1,62 @@
+#include "Checkpoint.h"
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+// Planes are stored one after another in this order, each width * height floats.
+// Alpha is not stored, as in PFM files.
+static const int PLANES = 5;
+
+bool Checkpoint::Save(const std::string& path, const Header& header, const RGBAFloatImage& sums, const SampleStatistics& statistics)
+{
+    std::string temporary = path + ".partial";
+    {
+        std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.good())
+            return false;
+        uint32_t words[4] = { CHECKPOINT_MAGIC, CHECKPOINT_VERSION, header.passes, header.seed };
+        int64_t size[2] = { header.width, header.height };
+        file.write(reinterpret_cast<const char*>(words), sizeof(words));
+        file.write(reinterpret_cast<const char*>(&header.fingerprint), sizeof(header.fingerprint));
+        file.write(reinterpret_cast<const char*>(size), sizeof(size));
+
+        std::streamsize planeBytes = std::streamsize(sums.width * sums.height) * std::streamsize(sizeof(float));
+        const float* planes[PLANES] = { sums.red, sums.green, sums.blue, statistics.counts.data(), statistics.squares.data() };
+        for (const float* plane : planes)
+            file.write(reinterpret_cast<const char*>(plane), planeBytes);
+        file.flush();
+        if (!file.good())
+            return false;
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+bool Checkpoint::Load(const std::string& path, Header& header, RGBAFloatImage& sums, SampleStatistics& statistics, bool merge)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    uint32_t words[4];
+    int64_t size[2];
+    file.read(reinterpret_cast<char*>(words), sizeof(words));
+    file.read(reinterpret_cast<char*>(&header.fingerprint), sizeof(header.fingerprint));
+    file.read(reinterpret_cast<char*>(size), sizeof(size));
+    if (!file.good() || words[0] != CHECKPOINT_MAGIC || words[1] != CHECKPOINT_VERSION)
+        return false;
+    header.passes = words[2];
+    header.seed = words[3];
+    header.width = long(size[0]);
+    header.height = long(size[1]);
+    if (header.width != sums.width || header.height != sums.height || header.width != statistics.width || header.height != statistics.height)
+        return false;
+
+    long pixels = header.width * header.height;
+    std::vector<float> plane(static_cast<size_t>(pixels));
+    float* targets[PLANES] = { sums.red, sums.green, sums.blue, statistics.counts.data(), statistics.squares.data() };
+    for (float* target : targets) {
+        file.read(reinterpret_cast<char*>(plane.data()), std::streamsize(pixels) * std::streamsize(sizeof(float)));
+        if (!file.good())
+            return false;
+        for (long i = 0; i < pixels; i++)
+            target[i] = merge ? target[i] + plane[size_t(i)] : plane[size_t(i)];
+    }
+    return true;
+}
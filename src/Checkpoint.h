@@ -0,0 +1,41 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <string>
+#include "RGBAFloatImage.h"
+#include "SampleStatistics.h"
+
+// "RTCK" read as a little endian word, a file from a machine of the other byte order does not match
+#define CHECKPOINT_MAGIC 0x4b435452u
+#define CHECKPOINT_VERSION 1
+// Seconds between the checkpoints a long batch render writes
+#define CHECKPOINT_INTERVAL_SECONDS 300
+
+// The accumulation state of a progressive render on disk: the HDR sums, the
+// per pixel sample counts and squared luminances, and which frame they belong to.
+// A render can be resumed from one, and checkpoints of the same frame rendered
+// with different seeds can be added together into a render of all their samples.
+class Checkpoint
+{
+public:
+    struct Header {
+        // RenderJob::fingerprint of the frame
+        uint64_t fingerprint;
+        // Passes in the sums, added up when checkpoints are merged
+        uint32_t passes;
+        // Seed of the run, or of the first run merged into it
+        uint32_t seed;
+        long width, height;
+    };
+
+    // Writes the file next to path and renames it over path, so a render stopped
+    // while saving still has its previous checkpoint
+    static bool Save(const std::string& path, const Header& header, const RGBAFloatImage& sums, const SampleStatistics& statistics);
+
+    // Reads a checkpoint into buffers already sized for it, or adds it to what they hold
+    // when merge is set. The header is read even when the buffers do not match.
+    static bool Load(const std::string& path, Header& header, RGBAFloatImage& sums, SampleStatistics& statistics, bool merge);
+};
+
+#endif // CHECKPOINT_H
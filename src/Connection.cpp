@@ -0,0 +1,272 @@
+#include "Connection.h"
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define UNIX_PREFIX "unix:"
+
+// Splits "host:port" at its last colon, an empty host means every interface
+static bool SplitAddress(const std::string& address, std::string& host, std::string& port)
+{
+    std::string::size_type colon = address.rfind(':');
+    if (colon == std::string::npos || colon + 1 == address.size())
+        return false;
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    return true;
+}
+
+static bool UnixAddress(const std::string& address, sockaddr_un& socketAddress)
+{
+    std::string path = address.substr(strlen(UNIX_PREFIX));
+    if (path.empty() || path.size() >= sizeof(socketAddress.sun_path))
+        return false;
+    memset(&socketAddress, 0, sizeof(socketAddress));
+    socketAddress.sun_family = AF_UNIX;
+    memcpy(socketAddress.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+// Writes exactly size bytes, false on an error or a peer that has gone
+static bool SendAll(int fd, const char* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t done = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return false;
+        data += done;
+        size -= size_t(done);
+    }
+    return true;
+}
+
+// Waits until fd has something to read, for at most milliseconds (or for ever if negative).
+// false once the time is up or on an error.
+static bool WaitReadable(int fd, int milliseconds)
+{
+    pollfd waiting = { fd, POLLIN, 0 };
+    for (;;) {
+        int ready = poll(&waiting, 1, milliseconds);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        return ready > 0;
+    }
+}
+
+// Reads exactly size bytes before deadline, false on an error, end of stream or the deadline passing
+static bool ReceiveAll(int fd, char* data, size_t size, std::chrono::steady_clock::time_point deadline)
+{
+    while (size > 0) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0 || !WaitReadable(fd, int(left)))
+            return false;
+        ssize_t done = ::recv(fd, data, size, 0);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return false;
+        data += done;
+        size -= size_t(done);
+    }
+    return true;
+}
+
+Connection::Connection(int fd) :
+    fd(fd)
+{
+    // A peer that stops taking what is sent is treated as gone. Receiving times
+    // out in receive(), only once a message has started.
+    timeval timeout = { CONNECTION_TIMEOUT_SECONDS, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+Connection::~Connection()
+{
+    close(fd);
+    if (!unlinkPath.empty())
+        unlink(unlinkPath.c_str());
+}
+
+std::unique_ptr<Connection> Connection::Listen(const std::string& address)
+{
+    int fd = -1;
+    std::string path;
+    if (address.rfind(UNIX_PREFIX, 0) == 0) {
+        sockaddr_un socketAddress;
+        if (!UnixAddress(address, socketAddress))
+            return nullptr;
+        // A socket file left behind by an earlier run would make bind fail
+        path = socketAddress.sun_path;
+        unlink(path.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && bind(fd, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else {
+        std::string host, port;
+        if (!SplitAddress(address, host, port))
+            return nullptr;
+        addrinfo hints = {}, *found = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found) != 0)
+            return nullptr;
+        for (addrinfo* candidate = found; candidate && fd < 0; candidate = candidate->ai_next) {
+            fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+            if (fd < 0)
+                continue;
+            int reuse = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            if (bind(fd, candidate->ai_addr, candidate->ai_addrlen) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(found);
+    }
+    if (fd < 0)
+        return nullptr;
+    if (listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return nullptr;
+    }
+    std::unique_ptr<Connection> listener(new Connection(fd));
+    listener->unlinkPath = path;
+    return listener;
+}
+
+std::unique_ptr<Connection> Connection::Connect(const std::string& address, int retrySeconds)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(retrySeconds);
+    do {
+        int fd = -1;
+        if (address.rfind(UNIX_PREFIX, 0) == 0) {
+            sockaddr_un socketAddress;
+            if (!UnixAddress(address, socketAddress))
+                return nullptr;
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        else {
+            std::string host, port;
+            if (!SplitAddress(address, host, port))
+                return nullptr;
+            addrinfo hints = {}, *found = nullptr;
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            if (getaddrinfo(host.empty() ? "localhost" : host.c_str(), port.c_str(), &hints, &found) == 0) {
+                for (addrinfo* candidate = found; candidate && fd < 0; candidate = candidate->ai_next) {
+                    fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+                    if (fd >= 0 && connect(fd, candidate->ai_addr, candidate->ai_addrlen) != 0) {
+                        close(fd);
+                        fd = -1;
+                    }
+                }
+                freeaddrinfo(found);
+            }
+            // Lets the coordinator notice a machine that vanished without closing the socket
+            if (fd >= 0) {
+                int keepAlive = 1;
+                setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(keepAlive));
+            }
+        }
+        if (fd >= 0)
+            return std::unique_ptr<Connection>(new Connection(fd));
+        // Workers may well be started before the coordinator is listening
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    } while (std::chrono::steady_clock::now() < deadline);
+    return nullptr;
+}
+
+std::unique_ptr<Connection> Connection::accept()
+{
+    int peer = ::accept(fd, nullptr, nullptr);
+    if (peer < 0)
+        return nullptr;
+    int keepAlive = 1;
+    setsockopt(peer, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(keepAlive));
+    return std::unique_ptr<Connection>(new Connection(peer));
+}
+
+bool Connection::send(uint32_t type, const std::vector<char>& payload)
+{
+    uint32_t header[2] = { type, uint32_t(payload.size()) };
+    return SendAll(fd, reinterpret_cast<const char*>(header), sizeof(header)) &&
+           SendAll(fd, payload.data(), payload.size());
+}
+
+bool Connection::receive(uint32_t& type, std::vector<char>& payload)
+{
+    // Waiting for a message to start has no limit, a worker out of tiles
+    // waits here for as long as the slower workers take with theirs
+    if (!WaitReadable(fd, -1))
+        return false;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(CONNECTION_TIMEOUT_SECONDS);
+    uint32_t header[2];
+    if (!ReceiveAll(fd, reinterpret_cast<char*>(header), sizeof(header), deadline) || header[1] > CONNECTION_MAX_PAYLOAD)
+        return false;
+    type = header[0];
+    payload.resize(header[1]);
+    return ReceiveAll(fd, payload.data(), payload.size(), deadline);
+}
+
+#else
+
+Connection::Connection(int fd) :
+    fd(fd)
+{
+}
+
+Connection::~Connection()
+{
+}
+
+std::unique_ptr<Connection> Connection::Listen(const std::string&)
+{
+    std::cout << "Distributed rendering needs POSIX sockets" << std::endl;
+    return nullptr;
+}
+
+std::unique_ptr<Connection> Connection::Connect(const std::string&, int)
+{
+    std::cout << "Distributed rendering needs POSIX sockets" << std::endl;
+    return nullptr;
+}
+
+std::unique_ptr<Connection> Connection::accept()
+{
+    return nullptr;
+}
+
+bool Connection::send(uint32_t, const std::vector<char>&)
+{
+    return false;
+}
+
+bool Connection::receive(uint32_t&, std::vector<char>&)
+{
+    return false;
+}
+
+#endif
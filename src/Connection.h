@@ -0,0 +1,100 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Seconds a peer may take to finish a message it has started before it counts as lost
+#define CONNECTION_TIMEOUT_SECONDS 60
+// Largest payload a message may carry, anything longer is taken as a broken stream
+#define CONNECTION_MAX_PAYLOAD (1u << 30)
+
+// A stream of framed messages over a TCP or Unix domain socket. Addresses are
+// "host:port" for TCP and "unix:/path" for a socket on the local machine.
+// Each message is a 32 bit type and a 32 bit length followed by that many bytes,
+// in the byte order of the machines, which are expected to share it.
+// Sockets are only available on POSIX systems, elsewhere every call fails.
+class Connection
+{
+public:
+    ~Connection();
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    // A socket accepting connections on address, nullptr if it cannot be bound
+    static std::unique_ptr<Connection> Listen(const std::string& address);
+    // Connects to address, trying again for up to retrySeconds while nobody listens there
+    static std::unique_ptr<Connection> Connect(const std::string& address, int retrySeconds);
+    // The next connection waiting on a listening socket, nullptr if there is none
+    std::unique_ptr<Connection> accept();
+
+    // false once the peer has gone
+    bool send(uint32_t type, const std::vector<char>& payload);
+    // Blocks until a whole message has arrived, false if the peer has gone or broke the framing.
+    // The next message may take any time to start, but must then arrive within CONNECTION_TIMEOUT_SECONDS.
+    bool receive(uint32_t& type, std::vector<char>& payload);
+
+    // For poll()
+    int descriptor() const { return fd; }
+
+private:
+    explicit Connection(int fd);
+
+    int fd;
+    // Socket file a listening Unix domain socket removes again
+    std::string unlinkPath;
+};
+
+// Appends plain values and strings to a message payload
+struct MessageWriter
+{
+    std::vector<char> bytes;
+
+    template <typename T> void put(const T& value) {
+        const char* data = reinterpret_cast<const char*>(&value);
+        bytes.insert(bytes.end(), data, data + sizeof(T));
+    }
+    void put(const std::string& value) {
+        put(uint32_t(value.size()));
+        bytes.insert(bytes.end(), value.begin(), value.end());
+    }
+};
+
+// Reads back what a MessageWriter wrote. Reading past the end gives zeros and clears ok.
+struct MessageReader
+{
+    const std::vector<char>& bytes;
+    size_t offset;
+    bool ok;
+
+    MessageReader(const std::vector<char>& bytes) : bytes(bytes), offset(0), ok(true) {}
+
+    template <typename T> T get() {
+        T value{};
+        if (offset + sizeof(T) > bytes.size()) {
+            ok = false;
+            return value;
+        }
+        std::memcpy(&value, bytes.data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return value;
+    }
+    std::string getString() {
+        uint32_t length = get<uint32_t>();
+        if (!ok || offset + length > bytes.size()) {
+            ok = false;
+            return std::string();
+        }
+        std::string value(bytes.data() + offset, length);
+        offset += length;
+        return value;
+    }
+    // The unread rest of the payload
+    const char* rest() const { return bytes.data() + offset; }
+    size_t remaining() const { return bytes.size() - offset; }
+};
+
+#endif // CONNECTION_H
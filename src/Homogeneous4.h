@@ -19,8 +19,6 @@ class Homogeneous4
         : x(X), y(Y), z(Z), w(W){}
     inline Homogeneous4(const Cartesian3& other) :
         x(other.x), y(other.y), z(other.z), w(1) {}
-    inline Homogeneous4(const Homogeneous4& other) :
-        x(other.x), y(other.y), z(other.z), w(other.w) {}
     
     // routine to get a point by perspective division
     inline Cartesian3 Point() const { 
@@ -108,6 +106,9 @@ class Homogeneous4
 
     }; // Homogeneous4
 
+// Matrix4 loads the four coordinates straight into SSE registers
+static_assert(sizeof(Homogeneous4) == 4 * sizeof(float), "Homogeneous4 must be four packed floats");
+
 // multiplication operator
 inline Homogeneous4 operator *(float factor, const Homogeneous4 &right) {
     // scalar multiplication is commutative, so flip & return
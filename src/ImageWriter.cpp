@@ -0,0 +1,53 @@
+#include "ImageWriter.h"
+
+ImageWriter::Format ImageWriter::FormatFor(const std::string& filename)
+{
+    std::string::size_type dot = filename.rfind('.');
+    if (dot != std::string::npos && filename.substr(dot) == ".pfm")
+        return pfm;
+    return ppm;
+}
+
+bool ImageWriter::open(const std::string& filename, long width, long height)
+{
+    format = FormatFor(filename);
+    this->width = width;
+    this->height = height;
+    file.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.good())
+        return false;
+
+    if (format == pfm) {
+        RGBAFloatImage::WritePFMHeader(file, width, height);
+        packed.resize(size_t(width) * 3 * sizeof(float));
+    }
+    else {
+        file << "P6\n" << width << " " << height << "\n255\n";
+        packed.resize(size_t(width) * 3);
+    }
+    headerBytes = file.tellp();
+    return file.good();
+}
+
+void ImageWriter::writeRows(long firstRow, long rows, const RGBAImage& image, const RGBAFloatImage& hdr, float scale)
+{
+    std::streamoff rowBytes = std::streamoff(packed.size());
+    for (long row = firstRow; row < firstRow + rows; row++) {
+        // PFM stores rows bottom to top like the framebuffer, PPM top to bottom
+        long fileRow = format == pfm ? row : height - 1 - row;
+        if (format == pfm)
+            hdr.PackRGB(row * width, width, scale, reinterpret_cast<float*>(packed.data()));
+        else
+            RGBAImage::PackRGB(image[int(row)], width, packed.data());
+        file.seekp(headerBytes + fileRow * rowBytes);
+        file.write(reinterpret_cast<const char*>(packed.data()), rowBytes);
+    }
+}
+
+bool ImageWriter::close()
+{
+    file.flush();
+    bool good = file.good();
+    file.close();
+    return good;
+}
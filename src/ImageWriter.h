@@ -0,0 +1,43 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include "RGBAImage.h"
+#include "RGBAFloatImage.h"
+
+// Writes a render to a binary P6 or PFM file while it is still being traced.
+// The header goes out on open() and every finished run of rows is written
+// straight to its place in the file, so the image never needs a second
+// full size copy and rows may arrive in any order.
+// Rows are numbered like the framebuffer, row 0 at the bottom of the picture.
+class ImageWriter
+{
+public:
+    enum Format{ppm, pfm};
+
+    // Picks the format from the extension, .pfm for floats and P6 for anything else
+    static Format FormatFor(const std::string& filename);
+
+    // Creates the file and writes its header, false if it could not be opened
+    bool open(const std::string& filename, long width, long height);
+
+    // Writes rows firstRow to firstRow + rows - 1 of a framebuffer that matches the file.
+    // A PPM file takes the 8 bit image, a PFM file the HDR one multiplied by scale.
+    void writeRows(long firstRow, long rows, const RGBAImage& image, const RGBAFloatImage& hdr, float scale);
+
+    // Flushes and closes the file, false if anything failed to write
+    bool close();
+
+    Format format;
+
+private:
+    std::ofstream file;
+    std::streamoff headerBytes;
+    long width, height;
+    // Reused for packing one row
+    std::vector<unsigned char> packed;
+};
+
+#endif // IMAGE_WRITER_H
@@ -0,0 +1,221 @@
+#include "IrradianceCache.h"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+#define PI 3.14159265359f
+
+IrradianceCache::IrradianceCache() :
+    cellSize(1.0f)
+{
+}
+
+void IrradianceCache::reset(const Cartesian3& low, const Cartesian3& high, const MaterialTable& materials)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    records.clear();
+    cells.clear();
+    origin = low;
+    float extent = std::max({ high.x - low.x, high.y - low.y, high.z - low.z });
+    cellSize = extent > 0.0f ? extent / IRRADIANCE_GRID_CELLS : 1.0f;
+
+    // Integrates Triangle::phong's normalised Blinn lobe against the cosine over a grid of
+    // cosine weighted directions, whose mean then only lacks the factor of pi
+    const int grid = 32;
+    glossy.assign(materials.size() * IRRADIANCE_VIEW_BINS, 0.0f);
+    for (size_t m = 0; m < materials.size(); m++) {
+        float shininess = materials[uint16_t(m)].shininess;
+        for (int bin = 0; bin < IRRADIANCE_VIEW_BINS; bin++) {
+            float cosView = float(bin) / (IRRADIANCE_VIEW_BINS - 1);
+            Cartesian3 view(std::sqrt(1.0f - cosView * cosView), 0.0f, cosView);
+            float sum = 0.0f;
+            for (int j = 0; j < grid; j++)
+                for (int k = 0; k < grid; k++) {
+                    float sinTheta = std::sqrt((j + 0.5f) / grid), phi = 2.0f * PI * (k + 0.5f) / grid;
+                    Cartesian3 light(sinTheta * std::cos(phi), sinTheta * std::sin(phi), std::sqrt(1.0f - sinTheta * sinTheta));
+                    Cartesian3 half = light + view;
+                    float length = half.length();
+                    if (length > 0.0f)
+                        sum += std::pow(std::max(half.z / length, 0.0f), shininess);
+                }
+            glossy[m * IRRADIANCE_VIEW_BINS + bin] = sum / (grid * grid) * (shininess + 2.0f) / 2.0f;
+        }
+    }
+}
+
+float IrradianceCache::glossyReflectance(uint16_t material, float cosView) const
+{
+    float position = std::clamp(cosView, 0.0f, 1.0f) * (IRRADIANCE_VIEW_BINS - 1);
+    int bin = std::min(int(position), IRRADIANCE_VIEW_BINS - 2);
+    float t = position - bin;
+    const float* row = &glossy[size_t(material) * IRRADIANCE_VIEW_BINS];
+    return row[bin] + (row[bin + 1] - row[bin]) * t;
+}
+
+int IrradianceCache::cellOf(float coordinate, float base) const
+{
+    return int(std::floor((coordinate - base) / cellSize));
+}
+
+uint64_t IrradianceCache::Key(int x, int y, int z)
+{
+    // 21 bits per axis, offset so cells a little outside the scene's box stay apart
+    const uint64_t mask = (1u << 21) - 1;
+    return ((uint64_t(x + (1 << 20)) & mask) << 42) | ((uint64_t(y + (1 << 20)) & mask) << 21) | (uint64_t(z + (1 << 20)) & mask);
+}
+
+bool IrradianceCache::lookup(const Cartesian3& point, const Cartesian3& normal, Cartesian3& irradiance) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto cell = cells.find(Key(cellOf(point.x, origin.x), cellOf(point.y, origin.y), cellOf(point.z, origin.z)));
+    if (cell == cells.end())
+        return false;
+
+    Cartesian3 sum;
+    float totalWeight = 0.0f;
+    for (uint32_t index : cell->second) {
+        const Record& record = records[index];
+        float cosine = normal.dot(record.normal);
+        if (cosine < IRRADIANCE_NORMAL_COSINE)
+            continue;
+        Cartesian3 offset = point - record.position;
+        float distance = offset.length();
+        if (distance >= record.radius)
+            continue;
+        // A record in front of the point sees a hemisphere the point does not
+        if (offset.dot(normal + record.normal) < -0.1f * record.radius)
+            continue;
+        // Falls to zero at the edge of the record's sphere or normal cone, so records blend in smoothly
+        float error = distance / record.radius + std::sqrt(std::max(1.0f - cosine, 0.0f) / (1.0f - IRRADIANCE_NORMAL_COSINE));
+        if (error >= 1.0f)
+            continue;
+        float weight = 1.0f - error;
+
+        Cartesian3 axis = record.normal.cross(normal);
+        Cartesian3 estimate(record.irradiance.x + axis.dot(record.rotation[0]) + offset.dot(record.translation[0]),
+                            record.irradiance.y + axis.dot(record.rotation[1]) + offset.dot(record.translation[1]),
+                            record.irradiance.z + axis.dot(record.rotation[2]) + offset.dot(record.translation[2]));
+        sum = sum + weight * Cartesian3(std::max(estimate.x, 0.0f), std::max(estimate.y, 0.0f), std::max(estimate.z, 0.0f));
+        totalWeight += weight;
+    }
+    if (totalWeight <= 0.0f)
+        return false;
+    irradiance = sum / totalWeight;
+    return true;
+}
+
+void IrradianceCache::insert(const Record& record)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    uint32_t index = uint32_t(records.size());
+    records.push_back(record);
+    // Every cell the record's sphere reaches into lists it
+    float r = record.radius;
+    int x0 = cellOf(record.position.x - r, origin.x), x1 = cellOf(record.position.x + r, origin.x);
+    int y0 = cellOf(record.position.y - r, origin.y), y1 = cellOf(record.position.y + r, origin.y);
+    int z0 = cellOf(record.position.z - r, origin.z), z1 = cellOf(record.position.z + r, origin.z);
+    for (int x = x0; x <= x1; x++)
+        for (int y = y0; y <= y1; y++)
+            for (int z = z0; z <= z1; z++)
+                cells[Key(x, y, z)].push_back(index);
+}
+
+void IrradianceCache::Basis(const Cartesian3& normal, Cartesian3& tangent, Cartesian3& bitangent)
+{
+    // Cross with whichever axis is furthest from the normal
+    Cartesian3 axis = std::abs(normal.x) < 0.5f ? Cartesian3(1.0f, 0.0f, 0.0f) : Cartesian3(0.0f, 1.0f, 0.0f);
+    tangent = normal.cross(axis).unit();
+    bitangent = normal.cross(tangent);
+}
+
+Cartesian3 IrradianceCache::StratumDirection(int j, int k, float u, float v, const Cartesian3& tangent, const Cartesian3& bitangent, const Cartesian3& normal)
+{
+    float sinTheta = std::sqrt((j + u) / IRRADIANCE_THETA_STRATA);
+    float cosTheta = std::sqrt(std::max(1.0f - sinTheta * sinTheta, 0.0f));
+    float phi = 2.0f * PI * (k + v) / IRRADIANCE_PHI_STRATA;
+    return (sinTheta * std::cos(phi)) * tangent + (sinTheta * std::sin(phi)) * bitangent + cosTheta * normal;
+}
+
+IrradianceCache::Record IrradianceCache::Gather(const Cartesian3& position, const Cartesian3& normal, const Cartesian3& tangent, const Cartesian3& bitangent,
+                                                const Cartesian3* radiance, const float* distance, float minRadius, float maxRadius)
+{
+    const int M = IRRADIANCE_THETA_STRATA, N = IRRADIANCE_PHI_STRATA;
+    Record record;
+    record.position = position;
+    record.normal = normal;
+
+    // Cosine weighted strata, so the irradiance is the mean radiance times pi
+    float inverseDistances = 0.0f;
+    for (int s = 0; s < M * N; s++) {
+        record.irradiance = record.irradiance + radiance[s];
+        inverseDistances += 1.0f / distance[s];
+    }
+    record.irradiance = record.irradiance * (PI / (M * N));
+
+    // Ward and Heckbert's gradients, found from the differences between neighbouring strata
+    // and how far away the surfaces they saw are, so they cost no rays of their own
+    float rotation[3][3] = {}, translation[3][3] = {};
+    for (int k = 0; k < N; k++) {
+        float phi = 2.0f * PI * (k + 0.5f) / N, phiEdge = 2.0f * PI * k / N;
+        Cartesian3 across = std::cos(phi) * tangent + std::sin(phi) * bitangent;
+        Cartesian3 around = -std::sin(phi) * tangent + std::cos(phi) * bitangent;
+        Cartesian3 aroundEdge = -std::sin(phiEdge) * tangent + std::cos(phiEdge) * bitangent;
+        int previousK = (k + N - 1) % N;
+
+        // Turning the normal towards a stratum brings in more of its light, in proportion to tan(theta)
+        Cartesian3 turned, outwards, sideways;
+        for (int j = 0; j < M; j++) {
+            float sin2 = (j + 0.5f) / M;
+            turned = turned + std::sqrt(sin2 / (1.0f - sin2)) * radiance[j * N + k];
+        }
+        // Moving the point shifts the edges between strata by an amount that depends on
+        // how close the nearer of the two surfaces they saw is
+        for (int j = 1; j < M; j++) {
+            float sin2 = float(j) / M;
+            float nearest = std::min(distance[j * N + k], distance[(j - 1) * N + k]);
+            outwards = outwards + (std::sqrt(sin2) * (1.0f - sin2) / nearest) * (radiance[j * N + k] - radiance[(j - 1) * N + k]);
+        }
+        // The last stratum reaches the horizon, whose cosine is set rather than taken as
+        // sqrt(0), which fast math may turn into a NaN
+        for (int j = 0; j < M; j++) {
+            float cosLow = std::sqrt(1.0f - float(j) / M), cosHigh = j + 1 < M ? std::sqrt(1.0f - float(j + 1) / M) : 0.0f;
+            float sinMiddle = std::sqrt((j + 0.5f) / M);
+            float nearest = std::min(distance[j * N + k], distance[j * N + previousK]);
+            sideways = sideways + ((cosLow - cosHigh) / (sinMiddle * nearest)) * (radiance[j * N + k] - radiance[j * N + previousK]);
+        }
+        outwards = outwards * (2.0f * PI / N);
+
+        float turnedChannels[3] = { turned.x, turned.y, turned.z };
+        float outwardsChannels[3] = { outwards.x, outwards.y, outwards.z };
+        float sidewaysChannels[3] = { sideways.x, sideways.y, sideways.z };
+        for (int c = 0; c < 3; c++) {
+            Cartesian3 r = around * turnedChannels[c];
+            Cartesian3 t = across * outwardsChannels[c] + aroundEdge * sidewaysChannels[c];
+            rotation[c][0] += r.x; rotation[c][1] += r.y; rotation[c][2] += r.z;
+            translation[c][0] += t.x; translation[c][1] += t.y; translation[c][2] += t.z;
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        record.rotation[c] = Cartesian3(rotation[c][0], rotation[c][1], rotation[c][2]) * (PI / (M * N));
+        record.translation[c] = Cartesian3(translation[c][0], translation[c][1], translation[c][2]);
+    }
+
+    // Valid over a share of the harmonic mean distance, and no further than the
+    // translation gradient takes a channel to zero
+    float harmonic = inverseDistances > 0.0f ? (M * N) / inverseDistances : IRRADIANCE_FAR;
+    float channels[3] = { record.irradiance.x, record.irradiance.y, record.irradiance.z };
+    for (int c = 0; c < 3; c++) {
+        float slope = record.translation[c].length();
+        if (channels[c] > 0.0f && slope * harmonic > channels[c])
+            harmonic = channels[c] / slope;
+    }
+    record.radius = std::clamp(IRRADIANCE_ACCURACY * harmonic, minRadius, std::max(minRadius, maxRadius));
+    // A radius held up by the minimum would let a steep gradient run on past zero, and a
+    // lone stratum that caught a light makes steep ones, so it is flattened to fit
+    for (int c = 0; c < 3; c++) {
+        float slope = record.translation[c].length();
+        if (slope * record.radius > channels[c])
+            record.translation[c] = record.translation[c] * (channels[c] / (slope * record.radius));
+    }
+    return record;
+}
@@ -0,0 +1,98 @@
+#ifndef IRRADIANCE_CACHE_H
+#define IRRADIANCE_CACHE_H
+
+#include <cstdint>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+#include "Cartesian3.h"
+#include "MaterialTable.h"
+
+// Strata of the hemisphere a record gathers, in cos^2 of the angle from the normal and around it
+#define IRRADIANCE_THETA_STRATA 6
+#define IRRADIANCE_PHI_STRATA 20
+#define IRRADIANCE_SAMPLES (IRRADIANCE_THETA_STRATA * IRRADIANCE_PHI_STRATA)
+// A record is valid over this fraction of the harmonic mean distance to what its hemisphere saw
+#define IRRADIANCE_ACCURACY 0.3f
+// Bounds on that radius, in pixel footprints at the record
+#define IRRADIANCE_MIN_PIXELS 3.0f
+#define IRRADIANCE_MAX_PIXELS 48.0f
+// Least cosine between the normal of a record and that of a point it is used for
+#define IRRADIANCE_NORMAL_COSINE 0.9f
+// Distance to give a stratum whose ray hit nothing
+#define IRRADIANCE_FAR 1e30f
+// Angles between the view and the normal the glossy reflectance of each material is tabulated at
+#define IRRADIANCE_VIEW_BINS 16
+// Cells along the longest side of the scene's box in the grid records are found through
+#define IRRADIANCE_GRID_CELLS 16
+
+// Diffuse indirect light cached at sparse points of the surfaces (Ward's irradiance
+// caching). Light reflected by other surfaces changes slowly over a flat area, so
+// a record gathering it from a full hemisphere of rays can stand in for every point
+// near it, and most shading points trace no bounce rays at all. How near depends on
+// how close the surfaces around the record are: a record in a corner covers a small
+// area, one in the middle of a wall a large one. Each record also keeps how its
+// irradiance changes as the point moves and the normal turns (Ward and Heckbert's
+// gradients), so points between records are extrapolated rather than averaged flat.
+//
+// Only irradiance is kept, so the glossy part of a material's response to it is
+// taken as if the light arrived evenly from every direction, for which the
+// specular lobe's reflectance depends on the view angle and shininess alone.
+//
+// Records are in view space, so a cache lasts one frame. Lookups from the render
+// threads share a lock, a thread that found no record gathers one without holding
+// it and then adds it, so two threads may sometimes both gather near one point.
+class IrradianceCache
+{
+public:
+    struct Record {
+        Cartesian3 position;
+        Cartesian3 normal;
+        Cartesian3 irradiance;
+        // Gradients of the red, green and blue irradiance for turning the normal
+        // (along the axis it turns about) and for moving the point
+        Cartesian3 rotation[3];
+        Cartesian3 translation[3];
+        // Distance over which the record is used
+        float radius;
+    };
+
+    IrradianceCache();
+
+    // Empties the cache for a frame whose geometry lies between low and high,
+    // shaded with materials
+    void reset(const Cartesian3& low, const Cartesian3& high, const MaterialTable& materials);
+    // Irradiance at point with normal, blended from the records valid there. false if there are none.
+    bool lookup(const Cartesian3& point, const Cartesian3& normal, Cartesian3& irradiance) const;
+    void insert(const Record& record);
+    // Share of light arriving evenly from above that the specular lobe of material sends back
+    // towards a viewer at cosView to the normal, for each unit of specular colour
+    float glossyReflectance(uint16_t material, float cosView) const;
+
+    // Direction of stratum (j, k) of the hemisphere around normal, u and v in [0, 1) placing it
+    // in the stratum. Strata are equal in projected solid angle, so each direction's radiance
+    // counts the same towards the irradiance.
+    static Cartesian3 StratumDirection(int j, int k, float u, float v, const Cartesian3& tangent, const Cartesian3& bitangent, const Cartesian3& normal);
+    // Tangent and bitangent completing normal to an orthonormal basis
+    static void Basis(const Cartesian3& normal, Cartesian3& tangent, Cartesian3& bitangent);
+    // A record from the radiance arriving along each stratum's direction and the distance to
+    // what it hit, both indexed j * IRRADIANCE_PHI_STRATA + k. Its radius is kept between
+    // minRadius and maxRadius.
+    static Record Gather(const Cartesian3& position, const Cartesian3& normal, const Cartesian3& tangent, const Cartesian3& bitangent,
+                         const Cartesian3* radiance, const float* distance, float minRadius, float maxRadius);
+
+private:
+    std::vector<Record> records;
+    // Indices of the records whose sphere overlaps each cell, by cell key
+    std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+    // IRRADIANCE_VIEW_BINS values for each material, from a grazing view to one along the normal
+    std::vector<float> glossy;
+    Cartesian3 origin;
+    float cellSize;
+    mutable std::shared_mutex mutex;
+
+    int cellOf(float coordinate, float base) const;
+    static uint64_t Key(int x, int y, int z);
+};
+
+#endif // IRRADIANCE_CACHE_H
@@ -31,6 +31,10 @@ public:
     bool enabled;
 
     inline Homogeneous4 GetColor(){return lightColor;}
+    inline LightType GetType(){return type;}
+    inline Homogeneous4 GetDirection(){return lightDirection;}
+    inline Homogeneous4 GetTangent1(){return tangent1;}
+    inline Homogeneous4 GetTangent2(){return tangent2;}
 
 };
 
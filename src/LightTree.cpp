@@ -0,0 +1,98 @@
+#include "LightTree.h"
+#include <algorithm>
+#include <cmath>
+
+void LightTree::build(std::vector<Emitter> emitters)
+{
+    nodes.clear();
+    if (emitters.empty())
+        return;
+    nodes.reserve(2 * emitters.size() - 1);
+    build(emitters, 0, int(emitters.size()));
+}
+
+int LightTree::build(std::vector<Emitter>& emitters, int first, int last)
+{
+    int index = int(nodes.size());
+    nodes.push_back(Node());
+    Node node;
+    node.power = 0.0f;
+    BVH::AABB centres;
+    for (int i = first; i < last; i++) {
+        node.bounds.grow(emitters[i].bounds);
+        centres.grow((emitters[i].bounds.min + emitters[i].bounds.max) * 0.5f);
+        node.power += emitters[i].power;
+    }
+
+    if (last - first == 1) {
+        node.left = emitters[first].light;
+        node.right = -1;
+    }
+    else {
+        // Halve the lights along the longest side of their centres' box
+        Cartesian3 extent = centres.max - centres.min;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        auto centre = [axis](const Emitter& emitter) {
+            Cartesian3 sum = emitter.bounds.min + emitter.bounds.max;
+            return axis == 0 ? sum.x : (axis == 1 ? sum.y : sum.z);
+        };
+        int middle = (first + last) / 2;
+        std::nth_element(emitters.begin() + first, emitters.begin() + middle, emitters.begin() + last,
+                         [&centre](const Emitter& a, const Emitter& b) { return centre(a) < centre(b); });
+        node.left = build(emitters, first, middle);
+        node.right = build(emitters, middle, last);
+    }
+    nodes[index] = node;
+    return index;
+}
+
+float LightTree::importance(const Node& node, const Cartesian3& point, const Cartesian3& normal) const
+{
+    Cartesian3 toNode = (node.bounds.min + node.bounds.max) * 0.5f - point;
+    float radius = (node.bounds.max - node.bounds.min).length() * 0.5f;
+    float distanceSquared = toNode.dot(toNode);
+    // From inside the node's bounding sphere its lights may be in any direction
+    if (distanceSquared <= radius * radius)
+        return node.power;
+
+    // The sphere spans an angle thetaU around the direction to its centre, the
+    // cosine to the normal is at most cos(max(theta - thetaU, 0))
+    float distance = std::sqrt(distanceSquared);
+    float cosTheta = normal.dot(toNode) / distance;
+    float sinU = radius / distance;
+    float cosU = std::sqrt(1.0f - sinU * sinU);
+    if (cosTheta >= cosU)
+        return node.power;
+    float sinTheta = std::sqrt(std::max(1.0f - cosTheta * cosTheta, 0.0f));
+    return node.power * std::max(cosTheta * cosU + sinTheta * sinU, 0.0f);
+}
+
+int LightTree::sample(const Cartesian3& point, const Cartesian3& normal, float u, float& probability) const
+{
+    probability = 1.0f;
+    if (nodes.empty() || importance(nodes[0], point, normal) <= 0.0f)
+        return -1;
+
+    int index = 0;
+    while (nodes[index].right >= 0) {
+        const Node& node = nodes[index];
+        float left = importance(nodes[node.left], point, normal);
+        float right = importance(nodes[node.right], point, normal);
+        if (left + right <= 0.0f)
+            return -1;
+        // u is stretched back over [0, 1) for the next level, so one number serves the whole walk
+        float chooseLeft = left / (left + right);
+        if (u < chooseLeft) {
+            u = u / chooseLeft;
+            probability *= chooseLeft;
+            index = node.left;
+        }
+        else {
+            u = (u - chooseLeft) / (1.0f - chooseLeft);
+            probability *= 1.0f - chooseLeft;
+            index = node.right;
+        }
+        u = std::min(u, 0.99999994f);
+    }
+    return nodes[index].left;
+}
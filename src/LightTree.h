@@ -0,0 +1,61 @@
+#ifndef LIGHT_TREE_H
+#define LIGHT_TREE_H
+
+#include <vector>
+#include "Cartesian3.h"
+#include "BVH.h"
+
+// Monte Carlo renders with more lights than this pick them from a LightTree.
+// With fewer, shading every light gives less noise for the time spent.
+#define LIGHT_TREE_MIN_LIGHTS 64
+// Lights drawn from the tree for each shading point
+#define LIGHT_TREE_SAMPLES 4
+
+// A binary hierarchy over the scene's lights for picking the few that matter
+// at a shading point. Each node bounds its lights in space and adds up their
+// power. A light is drawn by walking down from the root and choosing either
+// child in proportion to an estimate of how much light it can send to the
+// point, so the cost per point grows with the depth of the tree rather than
+// the number of lights.
+//
+// The estimate follows the shading model. Triangle::phong has no distance
+// falloff and lights shine equally in every direction, so a node's importance
+// is its power scaled by a bound on the cosine between the surface normal and
+// the direction to its box. Nodes entirely below the surface are never picked,
+// and every light that can reach the point keeps a non-zero probability.
+class LightTree
+{
+public:
+    // A light as the tree sees it, in view space
+    struct Emitter {
+        // Box around every position the light is sampled at
+        BVH::AABB bounds;
+        float power;
+        // Index into the snapshot's lights
+        int light;
+    };
+
+    // Replaces the tree with one over emitters
+    void build(std::vector<Emitter> emitters);
+    bool empty() const { return nodes.empty(); }
+
+    // Picks a light for a point with the given shading normal using one uniform number u in [0, 1).
+    // Returns the light's index and the probability it had of being picked, or -1 if no light
+    // can reach the point.
+    int sample(const Cartesian3& point, const Cartesian3& normal, float u, float& probability) const;
+
+private:
+    struct Node {
+        BVH::AABB bounds;
+        float power;
+        // Inner nodes have both children. A leaf has right at -1 and its light in left.
+        int left, right;
+    };
+    std::vector<Node> nodes;
+
+    // Builds the node for emitters first to last - 1, returns its index
+    int build(std::vector<Emitter>& emitters, int first, int last);
+    float importance(const Node& node, const Cartesian3& point, const Cartesian3& normal) const;
+};
+
+#endif // LIGHT_TREE_H
@@ -1,4 +1,5 @@
 #include "Material.h"
+#include "TextureCache.h"
 #include <string>
 Material::Material(Cartesian3 ambient,Cartesian3 diffuse,Cartesian3 specular,Cartesian3 emissive,float shininess,std::istream &textureStream)
 {
@@ -10,8 +11,7 @@ Material::Material(Cartesian3 ambient,Cartesian3 diffuse,Cartesian3 specular,Car
     this->reflectivity=0;
     this->indexOfRefraction=1;
     this->transparency=0;
-    texture = new RGBAImage();
-    texture->ReadPPM(textureStream);
+    texture = TextureCache::instance().adopt(textureStream);
     name = "default";
     setFromFile = false;
 }
@@ -48,7 +48,7 @@ Material::Material()
 
 Material::~Material()
 {
-    delete texture;
+    // textures belong to the TextureCache
 }
 
 std::vector<Material*> Material::readMaterials(std::istream &materialStream)
@@ -132,12 +132,10 @@ std::vector<Material*> Material::readMaterials(std::istream &materialStream)
         {
             std::string filename = "";
             materialStream >> filename;
-            std::ifstream textureFile(filename.c_str());
-            if(!textureFile.good()){
+            // only the header is read now, the cache loads tiles as rendering touches them
+            m->texture = TextureCache::instance().load(filename);
+            if(m->texture == nullptr){
                 std::cout << "Problem reading texture " << filename << " for the material " << m->name << std::endl;
-            }else{
-                m->texture = new RGBAImage();
-                m->texture->ReadPPM(textureFile);
             }
         }
     } // not eof
@@ -146,7 +144,7 @@ std::vector<Material*> Material::readMaterials(std::istream &materialStream)
     return r;
 }
 
-bool Material::isLight(){
+bool Material::isLight() const {
     std::size_t found = name.find("light");
     return found !=std::string::npos;
 }
@@ -2,7 +2,7 @@
 #define MATERIAL_H
 
 #include "Cartesian3.h"
-#include "RGBAImage.h"
+#include "Texture.h"
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -23,8 +23,9 @@ public:
     float reflectivity;
     float indexOfRefraction;
     float transparency;
-    RGBAImage *texture;
-    bool isLight();
+    // mip mapped map_Ka texture owned by the TextureCache, or nullptr
+    Texture *texture;
+    bool isLight() const;
     Material();
     Material(Cartesian3 ambient,Cartesian3 diffuse,Cartesian3 specular,Cartesian3 emissive,float shininess,std::istream &textureStream);
     Material(Cartesian3 ambient,Cartesian3 diffuse,Cartesian3 specular,Cartesian3 emissive,float shininess); //no texture in constructor;
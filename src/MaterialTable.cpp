@@ -0,0 +1,45 @@
+#include "MaterialTable.h"
+#include <iostream>
+
+uint16_t MaterialTable::intern(const Material* material)
+{
+    auto found = ids.find(material);
+    if (found != ids.end())
+        return found->second;
+
+    if (data.size() == MATERIAL_MAX_COUNT) {
+        std::cerr << "More than " << MATERIAL_MAX_COUNT << " materials, reusing the last one" << std::endl;
+        return uint16_t(MATERIAL_MAX_COUNT - 1);
+    }
+
+    MaterialData flat;
+    flat.ambient = material->ambient;
+    flat.diffuse = material->diffuse;
+    flat.specular = material->specular;
+    flat.emissive = material->emissive;
+    flat.shininess = material->shininess;
+    flat.reflectivity = material->reflectivity;
+    flat.indexOfRefraction = material->indexOfRefraction;
+    flat.transparency = material->transparency;
+
+    // isLight() searches the name, so it is asked once here rather than per hit
+    uint16_t bits = (material->isLight() ? MATERIAL_LIGHT : 0)
+                  | (material->reflectivity > 0.0f ? MATERIAL_REFLECTIVE : 0)
+                  | (material->transparency > 0.0f ? MATERIAL_TRANSPARENT : 0)
+                  | (material->texture != nullptr ? MATERIAL_TEXTURED : 0);
+
+    uint16_t id = uint16_t(data.size());
+    data.push_back(flat);
+    flagBits.push_back(bits);
+    textures.push_back(material->texture);
+    ids.emplace(material, id);
+    return id;
+}
+
+void MaterialTable::clear()
+{
+    data.clear();
+    flagBits.clear();
+    textures.clear();
+    ids.clear();
+}
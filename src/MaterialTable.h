@@ -0,0 +1,59 @@
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "Cartesian3.h"
+#include "Material.h"
+#include "Texture.h"
+
+// Properties of a material worked out once, when the scene is built
+#define MATERIAL_LIGHT 1
+#define MATERIAL_REFLECTIVE 2
+#define MATERIAL_TRANSPARENT 4
+#define MATERIAL_TEXTURED 8
+
+// Material IDs are 16 bit
+#define MATERIAL_MAX_COUNT 65536
+
+// The shading parameters of a Material, one cache line each
+struct alignas(64) MaterialData
+{
+    Cartesian3 ambient;
+    Cartesian3 diffuse;
+    Cartesian3 specular;
+    Cartesian3 emissive;
+    float shininess;
+    float reflectivity;
+    float indexOfRefraction;
+    float transparency;
+};
+
+static_assert(sizeof(MaterialData) == 64, "MaterialData should fill exactly one cache line");
+
+// Every material the scene's triangles use, flattened into a contiguous table.
+// Triangles keep a 16 bit index into it together with the material's flags,
+// so tests like "is this a light" never leave the triangle and shading reads
+// one MaterialData instead of chasing a Material through the heap.
+class MaterialTable
+{
+public:
+    // ID of material, adding it to the table the first time it is seen
+    uint16_t intern(const Material* material);
+    void clear();
+
+    const MaterialData& operator[](uint16_t id) const { return data[id]; }
+    uint16_t flags(uint16_t id) const { return flagBits[id]; }
+    // nullptr for untextured materials
+    const Texture* texture(uint16_t id) const { return textures[id]; }
+    size_t size() const { return data.size(); }
+
+private:
+    std::vector<MaterialData> data;
+    std::vector<uint16_t> flagBits;
+    std::vector<const Texture*> textures;
+    std::unordered_map<const Material*, uint16_t> ids;
+};
+
+#endif // MATERIAL_TABLE_H
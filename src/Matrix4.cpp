@@ -4,6 +4,11 @@
 #include "Quaternion.h"
 #include <limits>
 #include <math.h>
+#include <cmath>
+#include <utility>
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
 
 // constructor - default to the zero matrix
 Matrix4::Matrix4()
@@ -13,20 +18,13 @@ Matrix4::Matrix4()
             coordinates[row][col] = 0.0;
     } // default constructor
 
-Matrix4::Matrix4(const Matrix4 &other)
-    { // copy constructor
-    for (int row = 0; row < 4; row++)
-        for (int col = 0; col < 4; col++)
-            coordinates[row][col] = other.coordinates[row][col];
-    } // copy constructor
-
 // equality operator
 bool Matrix4::operator ==(const Matrix4 &other) const
     { // operator ==()
     // loop through, testing for mismatches
     for (int row = 0; row < 4; row++)
         for (int col = 0; col < 4; col++)
-            if (abs(coordinates[row][col] - other.coordinates[row][col]) > std::numeric_limits<float>::epsilon())
+            if (std::abs(coordinates[row][col] - other.coordinates[row][col]) > std::numeric_limits<float>::epsilon())
                 return false;
     // if no mismatches, matrices are the same
     return true;
@@ -66,6 +64,18 @@ Matrix4 Matrix4::operator *(float factor) const
 // multiplication is the only operator we use
 Homogeneous4 Matrix4::operator *(const Homogeneous4 &vector) const
     { // operator *()
+#if defined(__SSE__)
+    // multiply each row by the vector, then transpose so the four
+    // dot products can be summed with three vertical adds
+    __m128 v = _mm_loadu_ps(&vector.x);
+    __m128 row0 = _mm_mul_ps(_mm_loadu_ps(coordinates[0]), v);
+    __m128 row1 = _mm_mul_ps(_mm_loadu_ps(coordinates[1]), v);
+    __m128 row2 = _mm_mul_ps(_mm_loadu_ps(coordinates[2]), v);
+    __m128 row3 = _mm_mul_ps(_mm_loadu_ps(coordinates[3]), v);
+    _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+    Homogeneous4 productVector;
+    _mm_storeu_ps(&productVector.x, _mm_add_ps(_mm_add_ps(row0, row1), _mm_add_ps(row2, row3)));
+#else
     // get a zero-initialised vector
     Homogeneous4 productVector;
     productVector.x += coordinates[0][0] * vector.x;
@@ -87,6 +97,7 @@ Homogeneous4 Matrix4::operator *(const Homogeneous4 &vector) const
     productVector.w += coordinates[3][1] * vector.y;
     productVector.w += coordinates[3][2] * vector.z;
     productVector.w += coordinates[3][3] * vector.w;
+#endif
     
     // return the result
     return productVector;
@@ -139,11 +150,26 @@ Matrix4 Matrix4::operator *(const Matrix4 &other) const
     // start with a zero matrix
     Matrix4 productMatrix;
     
+#if defined(__SSE__)
+    // each row of the product is a sum of the other matrix's rows,
+    // weighted by the entries of the matching row of this one
+    __m128 otherRows[4];
+    for (int entry = 0; entry < 4; entry++)
+        otherRows[entry] = _mm_loadu_ps(other.coordinates[entry]);
+    for (int row = 0; row < 4; row++)
+        {
+        __m128 sum = _mm_mul_ps(_mm_set1_ps(coordinates[row][0]), otherRows[0]);
+        for (int entry = 1; entry < 4; entry++)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(coordinates[row][entry]), otherRows[entry]));
+        _mm_storeu_ps(productMatrix.coordinates[row], sum);
+        }
+#else
     // now loop, adding products
     for (int row = 0; row < 4; row++)
         for (int col = 0; col < 4; col++)
             for (int entry = 0; entry < 4; entry++)
                 productMatrix.coordinates[row][col] += coordinates[row][entry] * other.coordinates[entry][col];
+#endif
 
     // return the result
     return productMatrix;
@@ -164,6 +190,54 @@ Matrix4 Matrix4::transpose() const
     return transposeMatrix;
     } // transpose()
 
+// matrix inverse by Gauss-Jordan elimination, the zero matrix if there is none
+Matrix4 Matrix4::invert() const
+    { // invert()
+    // reduce a copy to the identity while applying the same steps to the result
+    Matrix4 reduced = *this;
+    Matrix4 inverseMatrix;
+    inverseMatrix.SetIdentity();
+
+    for (int col = 0; col < 4; col++)
+        { // per column
+        // the largest entry left in the column keeps the division stable
+        int pivot = col;
+        for (int row = col + 1; row < 4; row++)
+            if (std::abs(reduced.coordinates[row][col]) > std::abs(reduced.coordinates[pivot][col]))
+                pivot = row;
+        if (reduced.coordinates[pivot][col] == 0.0f)
+            return Matrix4();
+        for (int k = 0; k < 4; k++)
+            {
+            std::swap(reduced.coordinates[col][k], reduced.coordinates[pivot][k]);
+            std::swap(inverseMatrix.coordinates[col][k], inverseMatrix.coordinates[pivot][k]);
+            }
+
+        float scale = 1.0f / reduced.coordinates[col][col];
+        for (int k = 0; k < 4; k++)
+            {
+            reduced.coordinates[col][k] *= scale;
+            inverseMatrix.coordinates[col][k] *= scale;
+            }
+
+        // and clear the column from every other row
+        for (int row = 0; row < 4; row++)
+            {
+            if (row == col)
+                continue;
+            float factor = reduced.coordinates[row][col];
+            for (int k = 0; k < 4; k++)
+                {
+                reduced.coordinates[row][k] -= factor * reduced.coordinates[col][k];
+                inverseMatrix.coordinates[row][k] -= factor * inverseMatrix.coordinates[col][k];
+                }
+            }
+        } // per column
+
+    // return the result
+    return inverseMatrix;
+    } // invert()
+
 // returns a column-major array of 16 values
 // for use with OpenGL
 columnMajorMatrix Matrix4::columnMajor() const
@@ -34,8 +34,6 @@ class Matrix4
 
     // constructor - default to the zero matrix
     Matrix4();
-    // copy constructor
-    Matrix4(const Matrix4 &other);
     
     // equality operator
     bool operator ==(const Matrix4 &other) const;
@@ -0,0 +1,92 @@
+#include "PhotonMap.h"
+#include <algorithm>
+#include <cmath>
+
+#define PI 3.14159265359f
+
+PhotonMap::PhotonMap() :
+    radius(0.0f),
+    cellSize(1.0f)
+{
+}
+
+int PhotonMap::cellOf(float coordinate) const
+{
+    return int(std::floor(coordinate / cellSize));
+}
+
+uint64_t PhotonMap::Key(int x, int y, int z)
+{
+    // 21 bits per axis, offset so negative cells stay apart
+    const uint64_t mask = (1u << 21) - 1;
+    return ((uint64_t(x + (1 << 20)) & mask) << 42) | ((uint64_t(y + (1 << 20)) & mask) << 21) | (uint64_t(z + (1 << 20)) & mask);
+}
+
+void PhotonMap::clear()
+{
+    photons.clear();
+    cells.clear();
+}
+
+void PhotonMap::build(std::vector<Photon>& landed, float gatherRadius)
+{
+    clear();
+    radius = gatherRadius;
+    cellSize = 2.0f * gatherRadius;
+    if (landed.empty() || gatherRadius <= 0.0f)
+        return;
+
+    std::vector<std::pair<uint64_t, uint32_t>> keys(landed.size());
+    for (size_t i = 0; i < landed.size(); i++) {
+        const Cartesian3& p = landed[i].position;
+        keys[i] = { Key(cellOf(p.x), cellOf(p.y), cellOf(p.z)), uint32_t(i) };
+    }
+    std::sort(keys.begin(), keys.end());
+
+    photons.reserve(landed.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (i == 0 || keys[i].first != keys[i - 1].first)
+            cells[keys[i].first] = { uint32_t(i), uint32_t(i) };
+        cells[keys[i].first].second = uint32_t(i + 1);
+        photons.push_back(landed[keys[i].second]);
+    }
+}
+
+Cartesian3 PhotonMap::irradiance(const Cartesian3& point, const Cartesian3& normal) const
+{
+    Cartesian3 sum;
+    if (photons.empty())
+        return sum;
+
+    // The cells the radius around point reaches into, two along each axis
+    int x0 = cellOf(point.x - radius), y0 = cellOf(point.y - radius), z0 = cellOf(point.z - radius);
+    float radius2 = radius * radius;
+    for (int x = x0; x <= x0 + 1; x++)
+        for (int y = y0; y <= y0 + 1; y++)
+            for (int z = z0; z <= z0 + 1; z++) {
+                auto cell = cells.find(Key(x, y, z));
+                if (cell == cells.end())
+                    continue;
+                for (uint32_t i = cell->second.first; i < cell->second.second; i++) {
+                    const Photon& photon = photons[i];
+                    Cartesian3 offset = photon.position - point;
+                    float distance2 = offset.dot(offset);
+                    // Photons arriving from below the surface lit its other side
+                    if (distance2 >= radius2 || photon.direction.dot(normal) >= 0.0f)
+                        continue;
+                    float distance = distance2 > 0.0f ? std::sqrt(distance2) : 0.0f;
+                    sum = sum + photon.power * (1.0f - distance / radius);
+                }
+            }
+    // The cone filter's weights integrate to a third of the disc's area
+    return sum * (3.0f / (PI * radius2));
+}
+
+float PhotonMap::PassRadius(float firstRadius, int pass)
+{
+    // r(i+1)^2 = r(i)^2 (i + alpha) / (i + 1), counting passes from 1
+    float radius2 = firstRadius * firstRadius;
+    for (int i = 1; i <= pass; i++)
+        radius2 *= (i + PHOTON_ALPHA) / (i + 1);
+    return std::sqrt(radius2);
+}
@@ -0,0 +1,57 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Cartesian3.h"
+
+// Gather radius of the first pass, as a fraction of the longest side of the scene's box
+#define PHOTON_RADIUS_FRACTION 0.01f
+// How much of the photons gathered so far each pass keeps as the radius shrinks (Knaus and Zwicker's alpha)
+#define PHOTON_ALPHA 0.7f
+
+// Caustic photons of one pass in a hashed grid of cells as wide as the gather
+// radius is across, so finding those within the radius of a point looks at the
+// eight cells around it. The photons are sorted by cell when the map is built
+// and each cell keeps the range it holds, so a lookup reads them contiguously.
+class PhotonMap
+{
+public:
+    struct Photon {
+        Cartesian3 position;
+        // Direction the photon was travelling in when it landed
+        Cartesian3 direction;
+        Cartesian3 power;
+    };
+
+    PhotonMap();
+
+    // Replaces the map with photons, to be gathered within radius of a point
+    void build(std::vector<Photon>& photons, float radius);
+    void clear();
+    bool empty() const { return photons.empty(); }
+    size_t size() const { return photons.size(); }
+
+    // Irradiance at point on a surface facing normal, from the photons landing
+    // within the radius around it from above. Each is weighted by a cone filter,
+    // so the estimate blurs less than a flat disc of the same radius.
+    Cartesian3 irradiance(const Cartesian3& point, const Cartesian3& normal) const;
+
+    // Gather radius of pass (from 0), shrinking from firstRadius so that the
+    // passes' estimates average out to the caustic itself rather than a blur of it
+    static float PassRadius(float firstRadius, int pass);
+
+private:
+    std::vector<Photon> photons;
+    // First photon and one past the last of each cell, by cell key
+    std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> cells;
+    float radius;
+    float cellSize;
+
+    int cellOf(float coordinate) const;
+    static uint64_t Key(int x, int y, int z);
+};
+
+#endif // PHOTON_MAP_H
@@ -0,0 +1,84 @@
+#include "PostProcess.h"
+#include "SRGB.h"
+#include <cmath>
+
+// Number of pixels tonemapped per batch before they are handed to the encoder
+#define POST_PROCESS_BATCH 256
+
+// Reinhard's global operator, c / (1 + c)
+static inline float reinhard(float c)
+{
+    return c / (1.0f + c);
+}
+
+// Narkowicz's fit of the ACES filmic curve, already scaled for an exposure of 0
+static inline float aces(float c)
+{
+    c *= 0.6f;
+    return (c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f);
+}
+
+// Multiplies n pixels by multiplier(i), applies the curve and leaves them in batch
+template <typename Multiplier>
+static inline void toneMapBatch(const float* red, const float* green, const float* blue, int n, Multiplier multiplier, RenderParameters::ToneMap toneMap, Homogeneous4* batch)
+{
+    // The switch sits outside the loops so each curve vectorises on its own
+    switch (toneMap) {
+        case RenderParameters::reinhard:
+            #pragma omp simd
+            for (int i = 0; i < n; i++) {
+                batch[i].x = reinhard(std::max(red[i] * multiplier(i), 0.0f));
+                batch[i].y = reinhard(std::max(green[i] * multiplier(i), 0.0f));
+                batch[i].z = reinhard(std::max(blue[i] * multiplier(i), 0.0f));
+            }
+            break;
+        case RenderParameters::aces:
+            #pragma omp simd
+            for (int i = 0; i < n; i++) {
+                batch[i].x = aces(std::max(red[i] * multiplier(i), 0.0f));
+                batch[i].y = aces(std::max(green[i] * multiplier(i), 0.0f));
+                batch[i].z = aces(std::max(blue[i] * multiplier(i), 0.0f));
+            }
+            break;
+        default:
+            // The encoder clamps to [0, 1]
+            #pragma omp simd
+            for (int i = 0; i < n; i++) {
+                batch[i].x = red[i] * multiplier(i);
+                batch[i].y = green[i] * multiplier(i);
+                batch[i].z = blue[i] * multiplier(i);
+            }
+            break;
+    }
+}
+
+void PostProcess::develop(const RGBAFloatImage& hdr, long first, long count, float scale, float exposure, RenderParameters::ToneMap toneMap, RGBAImage& out)
+{
+    float multiplier = scale * std::exp2(exposure);
+    RGBAValue* pixels = out.block + first;
+    Homogeneous4 batch[POST_PROCESS_BATCH];
+
+    for (long start = 0; start < count; start += POST_PROCESS_BATCH) {
+        int n = int(std::min(long(POST_PROCESS_BATCH), count - start));
+        long offset = first + start;
+        toneMapBatch(hdr.red + offset, hdr.green + offset, hdr.blue + offset, n, [=](int) { return multiplier; }, toneMap, batch);
+        SRGB::encodeTile(batch, n, 1.0f, pixels + start);
+    }
+}
+
+void PostProcess::develop(const RGBAFloatImage& hdr, long first, long count, const float* counts, float exposure, RenderParameters::ToneMap toneMap, RGBAImage& out)
+{
+    float exposureScale = std::exp2(exposure);
+    RGBAValue* pixels = out.block + first;
+    Homogeneous4 batch[POST_PROCESS_BATCH];
+    float multipliers[POST_PROCESS_BATCH];
+
+    for (long start = 0; start < count; start += POST_PROCESS_BATCH) {
+        int n = int(std::min(long(POST_PROCESS_BATCH), count - start));
+        long offset = first + start;
+        for (int i = 0; i < n; i++)
+            multipliers[i] = counts[offset + i] > 0.0f ? exposureScale / counts[offset + i] : 0.0f;
+        toneMapBatch(hdr.red + offset, hdr.green + offset, hdr.blue + offset, n, [&](int i) { return multipliers[i]; }, toneMap, batch);
+        SRGB::encodeTile(batch, n, 1.0f, pixels + start);
+    }
+}
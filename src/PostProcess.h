@@ -0,0 +1,23 @@
+#ifndef POST_PROCESS_H
+#define POST_PROCESS_H
+
+#include "RGBAFloatImage.h"
+#include "RGBAImage.h"
+#include "RenderParameters.h"
+
+// Turns the linear HDR render into the displayed 8 bit image. Exposure,
+// the tonemap curve and the sRGB encode run in one pass over the pixels,
+// so the renderer can keep accumulating unclamped radiance.
+class PostProcess
+{
+public:
+    // Develops count pixels of hdr starting at pixel index first into out.
+    // Each pixel is multiplied by scale (one over the samples accumulated)
+    // and by 2^exposure before the curve is applied.
+    static void develop(const RGBAFloatImage& hdr, long first, long count, float scale, float exposure, RenderParameters::ToneMap toneMap, RGBAImage& out);
+    // The same for pixels that saw different numbers of samples, each is divided by
+    // its own count from counts, indexed like hdr. Pixels without samples are black.
+    static void develop(const RGBAFloatImage& hdr, long first, long count, const float* counts, float exposure, RenderParameters::ToneMap toneMap, RGBAImage& out);
+};
+
+#endif // POST_PROCESS_H
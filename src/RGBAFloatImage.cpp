@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <bit>
+#include <cstdint>
+#include <utility>
+
+#include "RGBAFloatImage.h"
+
+// alignment of every plane, one cache line
+#define PLANE_ALIGNMENT 64
+
+// constructor
+RGBAFloatImage::RGBAFloatImage()
+    :
+    red(nullptr),
+    green(nullptr),
+    blue(nullptr),
+    alpha(nullptr),
+    width(0),
+    height(0)
+    { // RGBAFloatImage constructor
+    } // RGBAFloatImage constructor
+
+// destructor
+RGBAFloatImage::~RGBAFloatImage()
+    { // RGBAFloatImage destructor
+    free(red);
+    free(green);
+    free(blue);
+    free(alpha);
+    } // RGBAFloatImage destructor
+
+// resizes the image, destroying any contents
+bool RGBAFloatImage::Resize(long Width, long Height)
+    { // Resize()
+    if ((Width < 0) || (Height < 0))
+        { // failure
+        std::cout << "Cannot handle image of size " << Width << " x " << Height << std::endl;
+        return false;
+        } // failure
+
+    free(red);
+    free(green);
+    free(blue);
+    free(alpha);
+    red = green = blue = alpha = nullptr;
+    width = height = 0;
+
+    // aligned_alloc() needs the size to be a multiple of the alignment
+    size_t bytes = static_cast<size_t>(Width * Height) * sizeof(float);
+    bytes = (bytes + PLANE_ALIGNMENT - 1) / PLANE_ALIGNMENT * PLANE_ALIGNMENT;
+    if (bytes == 0)
+        return true;
+
+    float **planes[4] = { &red, &green, &blue, &alpha };
+    for (float **plane : planes)
+        { // plane
+        *plane = static_cast<float *>(aligned_alloc(PLANE_ALIGNMENT, bytes));
+        if (*plane == nullptr)
+            return false;
+        } // plane
+
+    width = Width;
+    height = Height;
+    clear();
+
+    return true;
+    } // Resize()
+
+// exchanges the planes and sizes of two images without copying them
+void RGBAFloatImage::swap(RGBAFloatImage &other)
+    { // swap()
+    std::swap(red, other.red);
+    std::swap(green, other.green);
+    std::swap(blue, other.blue);
+    std::swap(alpha, other.alpha);
+    std::swap(width, other.width);
+    std::swap(height, other.height);
+    } // swap()
+
+// sets every channel of every pixel to zero
+void RGBAFloatImage::clear()
+    { // clear()
+    size_t bytes = static_cast<size_t>(width * height) * sizeof(float);
+    if (bytes == 0)
+        return;
+    memset(red, 0, bytes);
+    memset(green, 0, bytes);
+    memset(blue, 0, bytes);
+    memset(alpha, 0, bytes);
+    } // clear()
+
+// sets every channel of count pixels starting at pixel index first to zero
+void RGBAFloatImage::clear(long first, long count)
+    { // clear()
+    size_t bytes = static_cast<size_t>(count) * sizeof(float);
+    if (bytes == 0)
+        return;
+    memset(red + first, 0, bytes);
+    memset(green + first, 0, bytes);
+    memset(blue + first, 0, bytes);
+    memset(alpha + first, 0, bytes);
+    } // clear()
+
+// adds count colours to consecutive pixels starting at pixel index first
+void RGBAFloatImage::accumulate(long first, long count, const Homogeneous4 *colours)
+    { // accumulate()
+    float *r = red + first, *g = green + first, *b = blue + first, *a = alpha + first;
+    #pragma omp simd
+    for (long i = 0; i < count; i++)
+        { // pixel
+        r[i] += colours[i].x;
+        g[i] += colours[i].y;
+        b[i] += colours[i].z;
+        a[i] += colours[i].w;
+        } // pixel
+    } // accumulate()
+
+// file read routine
+bool RGBAFloatImage::ReadPFM(std::istream &inStream)
+    { // ReadPFM()
+    // colour files start with PF, greyscale ones with Pf
+    std::string magic;
+    inStream >> magic;
+    if ((magic != "PF") && (magic != "Pf"))
+        { // failed read
+        std::cerr << "Float stream did not start with PFM code (PF or Pf)" << std::endl;
+        return false;
+        } // failed read
+    int channels = (magic == "PF") ? 3 : 1;
+
+    // the sign of the scale gives the byte order, negative for little endian
+    long newWidth, newHeight;
+    float endianScale;
+    inStream >> newWidth >> newHeight >> endianScale;
+    if (!inStream.good() || (newWidth < 1) || (newHeight < 1))
+        { // bad header
+        std::cerr << "Float stream had a bad PFM header" << std::endl;
+        return false;
+        } // bad header
+    bool swap = (endianScale < 0.0f) != (std::endian::native == std::endian::little);
+
+    // exactly one whitespace character separates the header from the pixels
+    inStream.get();
+
+    if (!Resize(newWidth, newHeight))
+        return false;
+
+    // read a row at a time and scatter it to the planes
+    std::vector<float> packed(static_cast<size_t>(channels * width));
+    std::streamsize rowBytes = static_cast<std::streamsize>(packed.size() * sizeof(float));
+    for (long row = 0; row < height; row++)
+        { // row
+        inStream.read(reinterpret_cast<char *>(packed.data()), rowBytes);
+        if (inStream.gcount() != rowBytes)
+            { // short read
+            std::cerr << "Float stream ended before all " << width * height << " pixels were read" << std::endl;
+            return false;
+            } // short read
+        if (swap)
+            for (float &value : packed)
+                { // reverse the bytes
+                uint32_t bits = std::bit_cast<uint32_t>(value);
+                bits = (bits >> 24) | ((bits >> 8) & 0xff00u) | ((bits << 8) & 0xff0000u) | (bits << 24);
+                value = std::bit_cast<float>(bits);
+                } // reverse the bytes
+
+        long first = row * width;
+        for (long col = 0; col < width; col++)
+            { // col
+            red[first + col] = packed[channels * col];
+            green[first + col] = packed[channels * col + (channels - 1) / 2];
+            blue[first + col] = packed[channels * col + channels - 1];
+            alpha[first + col] = 1.0f;
+            } // col
+        } // row
+
+    return true;
+    } // ReadPFM()
+
+// file write routine
+void RGBAFloatImage::WritePFM(std::ostream &outStream, float scale)
+    { // WritePFM()
+    WritePFMHeader(outStream, width, height);
+
+    std::vector<float> packed(static_cast<size_t>(3 * width));
+    for (long row = 0; row < height; row++)
+        { // row
+        PackRGB(row * width, width, scale, packed.data());
+        outStream.write(reinterpret_cast<const char *>(packed.data()), static_cast<std::streamsize>(packed.size() * sizeof(float)));
+        } // row
+    } // WritePFM()
+
+// writes the header of a width x height PFM file
+void RGBAFloatImage::WritePFMHeader(std::ostream &outStream, long width, long height)
+    { // WritePFMHeader()
+    // pixels are written in the machine's own byte order
+    outStream << "PF\n" << width << " " << height << "\n" << (std::endian::native == std::endian::little ? "-1.0" : "1.0") << "\n";
+    } // WritePFMHeader()
+
+// interleaves count pixels starting at pixel index first as RGB triples multiplied by scale
+void RGBAFloatImage::PackRGB(long first, long count, float scale, float *packed) const
+    { // PackRGB()
+    for (long i = 0; i < count; i++)
+        { // pixel
+        packed[3 * i] = red[first + i] * scale;
+        packed[3 * i + 1] = green[first + i] * scale;
+        packed[3 * i + 2] = blue[first + i] * scale;
+        } // pixel
+    } // PackRGB()
+
+// the reverse of PackRGB with a scale of one, alpha is set to one
+void RGBAFloatImage::UnpackRGB(long first, long count, const float *packed)
+    { // UnpackRGB()
+    for (long i = 0; i < count; i++)
+        { // pixel
+        red[first + i] = packed[3 * i];
+        green[first + i] = packed[3 * i + 1];
+        blue[first + i] = packed[3 * i + 2];
+        alpha[first + i] = 1.0f;
+        } // pixel
+    } // UnpackRGB()
@@ -0,0 +1,66 @@
+#ifndef RGBAFLOATIMAGE_H
+#define RGBAFLOATIMAGE_H
+
+#include <iostream>
+#include "Homogeneous4.h"
+
+// High dynamic range companion to RGBAImage. Pixels are 32 bit floats kept in
+// one 64 byte aligned plane per channel, so a row of any channel can be loaded
+// straight into SIMD registers. Nothing is clamped, values stay linear.
+class RGBAFloatImage
+    { // class RGBAFloatImage
+    public:
+    // the channel planes, each width * height floats in row major order
+    float *red, *green, *blue, *alpha;
+
+    // dimensions of the image
+    long width, height;
+
+    // constructor
+    RGBAFloatImage();
+
+    // destructor
+    ~RGBAFloatImage();
+
+    // no copies, the planes are owned
+    RGBAFloatImage(const RGBAFloatImage &other) = delete;
+    RGBAFloatImage &operator =(const RGBAFloatImage &other) = delete;
+
+    // resizes the image, destroying any contents
+    bool Resize(long Width, long Height);
+
+    // exchanges the planes and sizes of two images without copying them
+    void swap(RGBAFloatImage &other);
+
+    // sets every channel of every pixel to zero
+    void clear();
+
+    // sets every channel of count pixels starting at pixel index first to zero
+    void clear(long first, long count);
+
+    // adds count colours to consecutive pixels starting at pixel index first
+    void accumulate(long first, long count, const Homogeneous4 *colours);
+
+    // routines for binary Portable Float Map read & write, alpha is not stored.
+    // PFM lists rows bottom to top, which is the order of the rows here
+    bool ReadPFM(std::istream &inStream);
+    void WritePFM(std::ostream &outStream, float scale = 1.0f);
+
+    // writes the header of a width x height PFM file
+    static void WritePFMHeader(std::ostream &outStream, long width, long height);
+
+    // interleaves count pixels starting at pixel index first as RGB triples multiplied by scale
+    void PackRGB(long first, long count, float scale, float *packed) const;
+
+    // the reverse of PackRGB with a scale of one, alpha is set to one
+    void UnpackRGB(long first, long count, const float *packed);
+
+    // reads back pixel index as a Homogeneous4
+    inline Homogeneous4 pixel(long index) const
+        { // pixel()
+        return Homogeneous4(red[index], green[index], blue[index], alpha[index]);
+        } // pixel()
+
+    }; // class RGBAFloatImage
+
+#endif
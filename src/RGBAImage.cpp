@@ -1,11 +1,14 @@
-#define MAX_IMAGE_DIMENSION 4096
-#define MAX_LINE_LENGTH 1024
+// sanity bound on each side, guards against corrupt headers rather than limiting renders
+#define MAX_IMAGE_DIMENSION 65536
 
 #include <stdlib.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <vector>
+#include <limits>
+#include <cctype>
 #include "string.h"
 
 #include "RGBAImage.h"
@@ -150,31 +153,43 @@ RGBAValue RGBAImage::GetTexel(float u, float v, bool bilinearFiltering)
 
     } // GetTexel()
 
-// file read routine
-bool RGBAImage::ReadPPM(std::istream &inStream)
-    { // ReadPPMFile()
-    // buffer for reading in line
-    char lineBuffer[MAX_LINE_LENGTH];
+// skips whitespace and # comments between the numbers of a PPM header
+static void SkipHeaderSpace(std::istream &inStream)
+    { // SkipHeaderSpace()
+    while (inStream.good())
+        { // next character
+        int next = inStream.peek();
+        if (next == '#')
+            inStream.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        else if (isspace(next))
+            inStream.get();
+        else
+            break;
+        } // next character
+    } // SkipHeaderSpace()
 
-    // read in the first line
-    inStream.getline(lineBuffer, MAX_LINE_LENGTH);
-    
+// reads a PPM header, leaving the stream at the first pixel
+bool RGBAImage::ReadPPMHeader(std::istream &inStream, bool &binary, long &newWidth, long &newHeight)
+    { // ReadPPMHeader()
     // check for magic number (file code) in first two characters
-    if (strcmp(lineBuffer,"P3") != 0)
+    std::string magic;
+    inStream >> magic;
+    if ((magic != "P3") && (magic != "P6"))
         { // failed read
-        std::cerr << "RGBA stream did not start with PPM code (P3)" << std::endl;
+        std::cerr << "RGBA stream did not start with PPM code (P3 or P6)" << std::endl;
         return false;
         } // failed read
-
-    while (inStream.good() && inStream.peek() == '#')
-        inStream.getline(lineBuffer, MAX_LINE_LENGTH);
+    binary = (magic == "P6");
 
     // read in new width & height
-    long newWidth, newHeight;
-    inStream >> newWidth >> newHeight;
+    SkipHeaderSpace(inStream);
+    inStream >> newWidth;
+    SkipHeaderSpace(inStream);
+    inStream >> newHeight;
 
     // check the byte max value
     int maxValue;
+    SkipHeaderSpace(inStream);
     inStream >> maxValue;
     
     if (maxValue != 255)
@@ -191,26 +206,77 @@ bool RGBAImage::ReadPPM(std::istream &inStream)
         return false;
         } // bad sizes
 
+    // binary pixels follow exactly one whitespace character
+    if (binary)
+        inStream.get();
+
+    return true;
+    } // ReadPPMHeader()
+
+// file read routine, for ASCII (P3) and binary (P6) files
+bool RGBAImage::ReadPPM(std::istream &inStream)
+    { // ReadPPMFile()
+    bool binary;
+    long newWidth, newHeight;
+    if (!ReadPPMHeader(inStream, binary, newWidth, newHeight))
+        return false;
+
     // resize the image
-    Resize(newWidth, newHeight);
+    if (!Resize(newWidth, newHeight))
+        return false;
 
-    // loop through pixels, reading them:
-    for (int row = 0; row < height; row++)
-        for (int col = 0; col < width; col++)       
-            inStream >> (*this)[row][col];
+    if (binary)
+        { // binary
+        // read the packed RGB triples in one go into the last three quarters of the block,
+        // then spread them out front to back - pixel i is written to bytes 4i..4i+3,
+        // which never reaches the triple of a later pixel still waiting at width*height + 3i
+        long pixels = width * height;
+        unsigned char *bytes = reinterpret_cast<unsigned char *>(block);
+        unsigned char *packed = bytes + pixels;
+        inStream.read(reinterpret_cast<char *>(packed), static_cast<std::streamsize>(3 * pixels));
+        if (inStream.gcount() != static_cast<std::streamsize>(3 * pixels))
+            { // short read
+            std::cerr << "RGBA stream ended before all " << pixels << " pixels were read" << std::endl;
+            return false;
+            } // short read
+        for (long i = 0; i < pixels; i++)
+            { // pixel
+            unsigned char red = packed[3 * i], green = packed[3 * i + 1], blue = packed[3 * i + 2];
+            block[i] = RGBAValue(red, green, blue);
+            } // pixel
+        } // binary
+    else
+        { // ASCII
+        // loop through pixels, reading them:
+        for (int row = 0; row < height; row++)
+            for (int col = 0; col < width; col++)       
+                inStream >> (*this)[row][col];
+        } // ASCII
 
     // done
     return true;
     } // ReadPPMFile()
 
 // file write routine
-void RGBAImage::WritePPM(std::ostream &outStream)
+void RGBAImage::WritePPM(std::ostream &outStream, bool binary)
     { // WritePPMFile()
     // print out header information
-    outStream << "P3" << std::endl;
+    outStream << (binary ? "P6" : "P3") << std::endl;
     outStream << "# PPM File" << std::endl;
     outStream << width << " " << height << std::endl;
     outStream << 255 << std::endl;
+
+    if (binary)
+        { // binary
+        // pack one row at a time and write it as a single block
+        std::vector<unsigned char> packed(static_cast<size_t>(3 * width));
+        for (int row = 0; row < height; row++)
+            { // row
+            PackRGB((*this)[row], width, packed.data());
+            outStream.write(reinterpret_cast<const char *>(packed.data()), static_cast<std::streamsize>(packed.size()));
+            } // row
+        return;
+        } // binary
         
     // loop through pixels, reading them:
     for (int row = 0; row < height; row++)
@@ -226,6 +292,17 @@ void RGBAImage::WritePPM(std::ostream &outStream)
         } // row
     } // WritePPMFile()
 
+// drops the alpha of count pixels, writing them as packed RGB triples
+void RGBAImage::PackRGB(const RGBAValue *pixels, long count, unsigned char *packed)
+    { // PackRGB()
+    for (long i = 0; i < count; i++)
+        { // pixel
+        packed[3 * i] = pixels[i].red;
+        packed[3 * i + 1] = pixels[i].green;
+        packed[3 * i + 2] = pixels[i].blue;
+        } // pixel
+    } // PackRGB()
+
 void RGBAImage::clear(RGBAValue color){
     for (int row = 0; row < height; row++)
         { // row
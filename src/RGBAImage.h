@@ -40,8 +40,14 @@ class RGBAImage
     RGBAValue GetTexel(float u, float v, bool bilinearFiltering);
 
     // routines for stream read & write
+    // reading accepts ASCII (P3) and binary (P6) files, writing is ASCII unless binary is set
     bool ReadPPM(std::istream &inStream);
-    void WritePPM(std::ostream &outStream);
+    // reads just the header, leaving the stream at the first pixel
+    static bool ReadPPMHeader(std::istream &inStream, bool &binary, long &width, long &height);
+    void WritePPM(std::ostream &outStream, bool binary = false);
+
+    // drops the alpha of count pixels, writing them as packed RGB triples as P6 stores them
+    static void PackRGB(const RGBAValue *pixels, long count, unsigned char *packed);
     
     //helper routine to clear
     void clear(RGBAValue color);
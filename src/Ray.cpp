@@ -5,4 +5,13 @@ Ray::Ray(Cartesian3 og, Cartesian3 dir,Type rayType)
     origin = og;
     direction = dir;
     ray_type = rayType;
+    coneWidth = 0.0f;
+    coneSpread = 0.0f;
+}
+
+void Ray::continueCone(const Ray& parent, float distance)
+{
+    // Surface curvature is ignored, the cone keeps its spread
+    coneWidth = parent.coneWidth + parent.coneSpread * distance;
+    coneSpread = parent.coneSpread;
 }
@@ -13,6 +13,12 @@ public:
     Cartesian3 origin;
     Cartesian3 direction;
     Type ray_type;
+    // Ray cone for picking texture detail: width at the origin and spread angle in radians
+    float coneWidth;
+    float coneSpread;
+
+    // Carries on parent's cone from the point distance along it
+    void continueCone(const Ray& parent, float distance);
 
 };
 
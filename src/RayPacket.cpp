@@ -0,0 +1,39 @@
+#include "RayPacket.h"
+#include <limits>
+
+RayPacket::RayPacket(Ray::Type rayType)
+{
+    ray_type = rayType;
+    for (int lane = 0; lane < PACKET_SIZE; lane++) {
+        originX[lane] = originY[lane] = originZ[lane] = 0.0f;
+        directionX[lane] = directionY[lane] = 0.0f;
+        directionZ[lane] = 1.0f;
+        invDirectionX[lane] = invDirectionY[lane] = invDirectionZ[lane] = 0.0f;
+        tMax[lane] = 0.0f;
+        triangle[lane] = -1;
+        active[lane] = 0;
+    }
+}
+
+void RayPacket::set(int lane, const Ray& ray, float maxDistance)
+{
+    originX[lane] = ray.origin.x;
+    originY[lane] = ray.origin.y;
+    originZ[lane] = ray.origin.z;
+    directionX[lane] = ray.direction.x;
+    directionY[lane] = ray.direction.y;
+    directionZ[lane] = ray.direction.z;
+    invDirectionX[lane] = 1.0f / ray.direction.x;
+    invDirectionY[lane] = 1.0f / ray.direction.y;
+    invDirectionZ[lane] = 1.0f / ray.direction.z;
+    tMax[lane] = maxDistance;
+    triangle[lane] = -1;
+    active[lane] = 1;
+}
+
+Ray RayPacket::ray(int lane) const
+{
+    return Ray(Cartesian3(originX[lane], originY[lane], originZ[lane]),
+               Cartesian3(directionX[lane], directionY[lane], directionZ[lane]),
+               ray_type);
+}
@@ -0,0 +1,46 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include <type_traits>
+#include "Ray.h"
+#include "SIMD.h"
+
+// Number of rays traced together, 4, 8 or 16 to match SSE, AVX2 or AVX-512 widths
+#define PACKET_SIZE 8
+// Once fewer rays than this still hit a subtree they finish it one at a time
+#define PACKET_MIN_ACTIVE 2
+
+// Widest SIMD vector that evenly divides a packet, kernels step through the packet in chunks of it
+using PacketFloat = std::conditional_t<PACKET_SIZE % 8 == 0, Floatx8, Floatx4>;
+using PacketVec3 = Vec3xN<PacketFloat>;
+
+// A bundle of rays stored structure-of-arrays so each lane
+// of a SIMD register holds the same component of a different ray
+class RayPacket
+{
+public:
+    alignas(64) float originX[PACKET_SIZE];
+    alignas(64) float originY[PACKET_SIZE];
+    alignas(64) float originZ[PACKET_SIZE];
+    alignas(64) float directionX[PACKET_SIZE];
+    alignas(64) float directionY[PACKET_SIZE];
+    alignas(64) float directionZ[PACKET_SIZE];
+    alignas(64) float invDirectionX[PACKET_SIZE];
+    alignas(64) float invDirectionY[PACKET_SIZE];
+    alignas(64) float invDirectionZ[PACKET_SIZE];
+    // Closest hit so far, or the maximum distance for shadow rays
+    alignas(64) float tMax[PACKET_SIZE];
+    // Index of the closest triangle, -1 if nothing was hit
+    int triangle[PACKET_SIZE];
+    // Lanes that carry a ray, kept as int rather than bool so masks vectorise alongside the floats
+    alignas(64) int active[PACKET_SIZE];
+
+    Ray::Type ray_type;
+
+    RayPacket(Ray::Type rayType);
+
+    void set(int lane, const Ray& ray, float maxDistance);
+    Ray ray(int lane) const;
+};
+
+#endif // RAY_PACKET_H
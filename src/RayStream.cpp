@@ -0,0 +1,63 @@
+#include "RayStream.h"
+#include <algorithm>
+
+RayStream::RayStream(std::pmr::memory_resource* memory) :
+    entries(memory),
+    keys(memory),
+    sorted(memory)
+{
+}
+
+void RayStream::reserve(size_t count)
+{
+    entries.reserve(count);
+    keys.reserve(count);
+    sorted.reserve(count);
+}
+
+void RayStream::clear()
+{
+    entries.clear();
+}
+
+void RayStream::append(const Batch& batch)
+{
+    entries.insert(entries.end(), batch.begin(), batch.end());
+}
+
+void RayStream::sort(const Cartesian3& min, const Cartesian3& max)
+{
+    int n = int(entries.size());
+    if (n < 2) return;
+
+    Cartesian3 extent = max - min;
+    Cartesian3 scale(extent.x > 0.0f ? 1023.0f / extent.x : 0.0f,
+                     extent.y > 0.0f ? 1023.0f / extent.y : 0.0f,
+                     extent.z > 0.0f ? 1023.0f / extent.z : 0.0f);
+
+    // Octant and Morton code in the high bits, entry index in the low bits, so one sort orders both
+    keys.resize(n);
+    for (int i = 0; i < n; i++) {
+        const Ray& ray = entries[i].ray;
+        unsigned long long octant = (ray.direction.x < 0.0f ? 4 : 0) | (ray.direction.y < 0.0f ? 2 : 0) | (ray.direction.z < 0.0f ? 1 : 0);
+
+        Cartesian3 c = ray.origin - min;
+        unsigned int x = unsigned(std::clamp(c.x * scale.x, 0.0f, 1023.0f));
+        unsigned int y = unsigned(std::clamp(c.y * scale.y, 0.0f, 1023.0f));
+        unsigned int z = unsigned(std::clamp(c.z * scale.z, 0.0f, 1023.0f));
+        unsigned long long code = 0;
+        for (int b = 0; b < 10; b++) {
+            code |= (unsigned long long)((x >> b) & 1) << (3 * b + 2);
+            code |= (unsigned long long)((y >> b) & 1) << (3 * b + 1);
+            code |= (unsigned long long)((z >> b) & 1) << (3 * b);
+        }
+        keys[i] = (((octant << 30) | code) << 32) | unsigned(i);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    sorted.clear();
+    sorted.reserve(n);
+    for (int i = 0; i < n; i++)
+        sorted.push_back(entries[keys[i] & 0xffffffffu]);
+    entries.swap(sorted);
+}
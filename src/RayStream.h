@@ -0,0 +1,53 @@
+#ifndef RAY_STREAM_H
+#define RAY_STREAM_H
+
+#include <memory_resource>
+#include "Ray.h"
+#include "Cartesian3.h"
+
+// Rows of pixels whose secondary rays are gathered into one stream
+#define STREAM_ROWS 16
+
+// A batch of secondary rays that are collected first and traced later.
+// Sorting the batch by direction octant and origin cell puts rays that
+// walk the same parts of the BVH next to each other, so tracing the stream
+// in order touches far fewer distinct nodes and triangles than tracing the
+// rays as their paths produce them. Its buffers live in the memory resource it
+// is given, normally the render's arena.
+class RayStream
+{
+public:
+    struct Entry {
+        Ray ray;
+        // Pixel the ray contributes to, relative to the start of the stream's rows
+        int pixel;
+        // Triangle the ray leaves from and barycentric coordinates of its origin on it
+        int triangle;
+        Cartesian3 bary;
+        // Path state to carry on with once the ray is traced
+        int bounces;
+        float currentIOR;
+        bool hitLight;
+    };
+
+    // Rays gathered by one packet before they are added to the stream
+    typedef std::pmr::vector<Entry> Batch;
+
+    Batch entries;
+
+    explicit RayStream(std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+
+    // Makes room for count entries up front, so a stream in an arena does not leave outgrown copies behind
+    void reserve(size_t count);
+    void clear();
+    void append(const Batch& batch);
+    // Reorders the entries by direction octant, then by the Morton code of
+    // the origin's cell in a 1024^3 grid over [min, max]
+    void sort(const Cartesian3& min, const Cartesian3& max);
+
+private:
+    std::pmr::vector<unsigned long long> keys;
+    Batch sorted;
+};
+
+#endif // RAY_STREAM_H
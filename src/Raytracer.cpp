@@ -3,17 +3,52 @@
 #include <random>
 #include <omp.h>
 #include <algorithm>
+#include <array>
+#include <utility>
 // include the header file
 #include "Raytracer.h"
+#include "PostProcess.h"
+#include "Checkpoint.h"
+#include "Topology.h"
 
 #define PI 3.14159265359f
 
-#define N_THREADS 16
-#define N_LOOPS 600
 #define N_BOUNCES 10
 #define TERMINATION_FACTOR 0.35f
 #define MONTE_CARLO_RAYS 1
 #define ANTI_ALIAS_SAMPLES 1
+#define MONTE_CARLO_PDF (MONTE_CARLO_RAYS / (2 * PI))
+// Photons each task of the emission pass shoots
+#define PHOTON_BLOCK 1024
+// Pixels on a side of the blocks the preview fills from one sample first, a power of two
+#define PREVIEW_BLOCK 8
+// Sweeps of the focus rectangle ahead of each pass over the frame when it is prioritised
+#define FOCUS_EXTRA_PASSES 3
+
+// Each worker thread samples from its own engine. Consecutive seeds go through a
+// seed_seq first, a plain LCG seeded with 1, 2, 3... would give correlated sequences.
+static std::atomic<unsigned int> nextSeed(1);
+static std::default_random_engine seededEngine() {
+    std::seed_seq seed{ nextSeed++ };
+    return std::default_random_engine(seed);
+}
+thread_local std::default_random_engine generator = seededEngine();
+thread_local std::uniform_real_distribution<float> distribution(0, 1);
+
+// Restarts this thread's engine from the render's seed and the work about to be traced,
+// so each pass of each run draws its own samples whichever thread gets the work.
+// This runs for every packet, so the words are mixed with SplitMix64 steps rather
+// than through a std::seed_seq, which allocates.
+static void Reseed(unsigned seed, unsigned stage, int pass, int y, int x) {
+    uint64_t state = seed;
+    for (uint64_t word : { uint64_t(stage), uint64_t(unsigned(pass)), uint64_t(unsigned(y)), uint64_t(unsigned(x)) }) {
+        state = (state ^ word) + 0x9e3779b97f4a7c15ull;
+        state = (state ^ (state >> 30)) * 0xbf58476d1ce4e5b9ull;
+        state = (state ^ (state >> 27)) * 0x94d049bb133111ebull;
+        state = state ^ (state >> 31);
+    }
+    generator.seed(std::default_random_engine::result_type(state >> 32));
+}
 
 // constructor
 Raytracer::Raytracer(std::vector<ThreeDModel> *newTexturedObject, RenderParameters *newRenderParameters):
@@ -24,6 +59,15 @@ Raytracer::Raytracer(std::vector<ThreeDModel> *newTexturedObject, RenderParamete
         std::srand(static_cast<unsigned int>(std::time(nullptr)));
         restartRaytrace = false;
         raytracingRunning = false;
+        renderKernel = nullptr;
+        regionFirst = regionEnd = 0;
+        firstPass = completedPasses = 0;
+        seedPassOffset = 0;
+        unevenSamples = false;
+        recordingHits = carryingOver = false;
+        focusX = focusY = -1;
+        causticReach = photonRadius = 0.0f;
+        photonSample = -1;
     }     
 
 
@@ -35,10 +79,11 @@ Raytracer::~Raytracer()
 
 
 // called every time the widget is resized
-void Raytracer::resize(int w, int h)
+bool Raytracer::resize(int w, int h)
     { // RaytraceRenderWidget::resizeGL()
     // resize the render image
-    frameBuffer.Resize(w, h);
+    reprojection.invalidate();
+    return frameBuffer.Resize(w, h) && hdrBuffer.Resize(w, h) && statistics.Resize(w, h);
     } // RaytraceRenderWidget::resizeGL()
     
 void Raytracer::stopRaytracer() {
@@ -50,70 +95,399 @@ void Raytracer::stopRaytracer() {
     restartRaytrace = false;
 }
 
-inline
-float linear_from_srgb(std::uint8_t aValue) noexcept
-{
-    float const fvalue = float(aValue) / 255.f;
-
-    if (fvalue < 0.04045f)
-        return (1.f / 12.92f) * fvalue;
+void Raytracer::waitForRaytracer() {
+    while (raytracingRunning) {
+        std::chrono::milliseconds timespan(10);
+        std::this_thread::sleep_for(timespan);
+    }
+}
 
-    return std::pow((1.f / 1.055f) * (fvalue + 0.055f), 2.4f);
+// Clears the bits that cannot change the image given the others,
+// so equivalent settings share one compiled kernel
+constexpr unsigned Raytracer::CanonicalFeatures(unsigned features)
+{
+    // Monte Carlo also jitters the camera rays and ortho only changes them, so both always count
+    unsigned camera = features & (FEATURE_MONTE_CARLO | FEATURE_ORTHO);
+    // Interpolation rendering shows normals before any lighting is worked out
+    if (features & FEATURE_INTERPOLATION)
+        return FEATURE_INTERPOLATION | camera;
+    // Everything else is part of Phong shading
+    if (!(features & FEATURE_PHONG))
+        return camera;
+    // Fresnel rendering replaces the separate reflection and refraction paths
+    if (features & FEATURE_FRESNEL)
+        features &= ~(FEATURE_REFLECTION | FEATURE_REFRACTION);
+    return features;
+}
 
+template <unsigned... Features>
+constexpr std::array<Raytracer::RenderKernel, sizeof...(Features)> Raytracer::MakeKernels(std::integer_sequence<unsigned, Features...>)
+{
+    return { &Raytracer::RaytraceFeatures<CanonicalFeatures(Features)>... };
 }
 
-inline
-std::uint8_t linear_to_srgb(float aValue) noexcept
+// Looks up the render loop compiled for a feature mask
+Raytracer::RenderKernel Raytracer::KernelFor(unsigned features)
 {
-    if (aValue < 0.0031308f)
-        return std::uint8_t(255.f * 12.92f * aValue + 0.5f);
-    return std::uint8_t(255.f * (1.055f * std::pow(aValue, 1.f / 2.4f) - 0.055f) + 0.5f);
+    static constexpr std::array<RenderKernel, FEATURE_COMBINATIONS> kernels = MakeKernels(std::make_integer_sequence<unsigned, FEATURE_COMBINATIONS>());
+    return kernels[features];
 }
 
 void Raytracer::RaytraceThread()
 {
     //Tutorial code here!
-    for (int j = 0; j < frameBuffer.height; j++) {
-        #pragma omp parallel for schedule(dynamic)
-        for (int i = 0; i < frameBuffer.width; i++) {
-            Homogeneous4 colour;
-
-            // Anti-aliasing
-            for (int s = 0; s < ANTI_ALIAS_SAMPLES; s++) {
-                // Calculate initial ray
-                Ray ray = calculateRay(i, j, !renderParameters->orthoProjection);
-                // Raytrace
-                colour = colour + TraceAndShadeWithRay(ray, N_BOUNCES, 1.0f, false);
+    (this->*renderKernel)();
+    // Only once the render loop's locals are gone, the arena scope among them, since
+    // the next Prepare() may reset the arena as soon as this is cleared
+    raytracingRunning = false;
+}
+
+// Render loop for one combination of shading features, every check on
+// them below is resolved when this is compiled
+template <unsigned Features>
+void Raytracer::RaytraceFeatures()
+{
+    int width = snapshot->width;
+    int height = snapshot->height;
+    PlaceThreads();
+    // A tile rendered after another reuses its memory
+    Arena::Scope frame(renderArena);
+    Homogeneous4* bandColours = renderArena.allocateArray<Homogeneous4>(size_t(width) * STREAM_ROWS);
+    // Every primary sample leaves at most MONTE_CARLO_RAYS bounce rays
+    size_t maxSecondary = (Features & FEATURE_MONTE_CARLO) ? size_t(width) * STREAM_ROWS * ANTI_ALIAS_SAMPLES * MONTE_CARLO_RAYS : 0;
+    Homogeneous4* results = renderArena.allocateArray<Homogeneous4>(maxSecondary);
+    RayStream secondary(&renderArena);
+    secondary.reserve(maxSecondary);
+
+    // The preview traces part of the first pass, which then skips those pixels.
+    // A render of the focus alone has no first pass over the whole frame to preview.
+    RenderParameters::Focus focus = snapshot->focus;
+    bool previewed = false;
+    if (snapshot->preview && focus != RenderParameters::only && firstPass == 0 && regionFirst == 0 && regionEnd == height) {
+        if constexpr ((Features & FEATURE_PHONG) != 0)
+            EmitPhotons<Features>(seedPassOffset, 0);
+        if (!TracePreview<Features>())
+            return;
+        previewed = true;
+    }
+
+    // With a focus, the rectangle around it is swept FOCUS_EXTRA_PASSES more times
+    // ahead of each pass over the frame, or is all that is traced, so pixels end
+    // up with different sample counts
+    int sweepsPerPass = focus == RenderParameters::around ? FOCUS_EXTRA_PASSES + 1 : 1;
+    if (focus != RenderParameters::everywhere)
+        unevenSamples = true;
+    std::pmr::vector<int> bands(&renderArena);
+
+    // Each pass adds one more sample per pixel to the HDR framebuffer,
+    // the displayed image is developed from the running sum after every band
+    for (int pass = firstPass; pass < snapshot->passes; pass++) {
+        for (int sweep = 0; sweep < sweepsPerPass; sweep++) {
+            bool whole = focus == RenderParameters::everywhere || (focus == RenderParameters::around && sweep == sweepsPerPass - 1);
+            int x0 = 0, x1 = width, y0 = regionFirst, y1 = regionEnd;
+            // The focus is read again for every sweep, so it follows the cursor
+            int focusX0, focusY0, focusX1, focusY1;
+            FocusRegion(focusX0, focusY0, focusX1, focusY1);
+            if (!whole) {
+                x0 = focusX0;
+                x1 = focusX1;
+                y0 = std::max(y0, focusY0);
+                y1 = std::min(y1, focusY1);
+            }
+            int columns = x1 - x0;
+            // Every sweep draws samples of its own
+            int sample = pass * sweepsPerPass + sweep + seedPassOffset;
+            // and gathers from photons of its own, in a radius that shrinks as they add up
+            if constexpr ((Features & FEATURE_PHONG) != 0)
+                EmitPhotons<Features>(sample, pass * sweepsPerPass + sweep);
+
+            // Bands nearest the focus are traced first
+            bands.clear();
+            for (int band = y0; band < y1; band += STREAM_ROWS)
+                bands.push_back(band);
+            if (focus != RenderParameters::everywhere) {
+                int centre = (focusY0 + focusY1) / 2;
+                std::stable_sort(bands.begin(), bands.end(), [&](int a, int b) {
+                    return std::abs(a + STREAM_ROWS / 2 - centre) < std::abs(b + STREAM_ROWS / 2 - centre);
+                });
             }
 
-            colour = colour / float(ANTI_ALIAS_SAMPLES);
-            
+            for (int band : bands) {
+                if (restartRaytrace)
+                    return;
+                int rows = std::min(STREAM_ROWS, y1 - band);
+                int packetsPerRow = (columns + PACKET_SIZE - 1) / PACKET_SIZE;
+                bool reusePreview = previewed && pass == 0 && whole;
+                secondary.clear();
+
+                // Neighbouring pixels in a row are traced together as one packet,
+                // their first Monte Carlo bounces are collected for the whole band
+                #pragma omp parallel for schedule(dynamic)
+                for (int p = 0; p < rows * packetsPerRow; p++) {
+                    int j = band + p / packetsPerRow;
+                    // Even rows only have their odd pixels left once the preview traced the even ones
+                    int first = reusePreview && j % 2 == 0 ? 1 : 0;
+                    int stride = first + 1;
+                    int k = (p % packetsPerRow) * PACKET_SIZE;
+                    int count = std::min(PACKET_SIZE, (columns - first + stride - 1) / stride - k);
+                    if (count <= 0)
+                        continue;
+                    int i = x0 + first + k * stride;
+                    Homogeneous4 colours[PACKET_SIZE];
+                    Arena& scratch = Arena::Scratch();
+                    Arena::Scope packetScope(scratch);
+                    RayStream::Batch deferred(&scratch);
+                    deferred.reserve((Features & FEATURE_MONTE_CARLO) ? PACKET_SIZE * ANTI_ALIAS_SAMPLES * MONTE_CARLO_RAYS : 0);
+
+                    if constexpr ((Features & FEATURE_MONTE_CARLO) != 0)
+                        Reseed(snapshot->seed, 0, sample, j, i);
+                    // Anti-aliasing
+                    for (int s = 0; s < ANTI_ALIAS_SAMPLES; s++)
+                        TracePrimaryPacket<Features>(i, j, count, colours, &deferred, stride);
+
+                    for (int lane = 0; lane < count; lane++)
+                        bandColours[(j - band) * width + i + lane * stride] = colours[lane];
+                    for (RayStream::Entry& entry : deferred)
+                        entry.pixel += (j - band) * width;
+
+                    if (!deferred.empty()) {
+                        #pragma omp critical
+                        secondary.append(deferred);
+                    }
+                }
 
-            // Clamp colours to 0->1
-            colour.x = std::clamp(colour.x, 0.0f, 1.0f);
-            colour.y = std::clamp(colour.y, 0.0f, 1.0f);
-            colour.z = std::clamp(colour.z, 0.0f, 1.0f);
-            colour.w = std::clamp(colour.w, 0.0f, 1.0f);
+                if (reusePreview) {
+                    for (int j = band + band % 2; j < band + rows; j += 2)
+                        for (int i = 0; i < width; i += 2)
+                            bandColours[(j - band) * width + i] = previewImage.pixel(long(j / 2) * previewImage.width + i / 2);
+                }
 
-            frameBuffer[j][i] = RGBAValue(
-                linear_to_srgb(colour.x),
-                linear_to_srgb(colour.y),
-                linear_to_srgb(colour.z),
-                255);
+                // Trace the band's bounce rays in an order that keeps neighbours on the same BVH paths
+                if (!secondary.entries.empty()) {
+                    const BVH::AABB& sceneBounds = raytraceScene.bvh.nodes[0].bounds;
+                    secondary.sort(sceneBounds.min, sceneBounds.max);
+                    TraceSecondaryStream<Features>(secondary, sample, band, results);
+                    for (size_t k = 0; k < secondary.entries.size(); k++)
+                        bandColours[secondary.entries[k].pixel] = bandColours[secondary.entries[k].pixel] + results[k];
+                }
 
+                // Accumulate unclamped, then average, expose, tonemap and encode the band.
+                // Whole rows are contiguous in both framebuffers, part rows go one at a time.
+                int spans = columns == width ? 1 : rows;
+                long spanLength = columns == width ? long(rows) * width : long(columns);
+                float scale = 1.0f / float((pass + 1) * ANTI_ALIAS_SAMPLES);
+                for (int span = 0; span < spans; span++) {
+                    long first = long(band + span) * width + x0;
+                    const Homogeneous4* colours = bandColours + long(span) * width + x0;
+                    hdrBuffer.accumulate(first, spanLength, colours);
+                    statistics.accumulate(first, spanLength, colours, float(ANTI_ALIAS_SAMPLES));
+                    if (unevenSamples)
+                        PostProcess::develop(hdrBuffer, first, spanLength, statistics.counts.data(), snapshot->exposure, snapshot->toneMap, frameBuffer);
+                    else
+                        PostProcess::develop(hdrBuffer, first, spanLength, scale, snapshot->exposure, snapshot->toneMap, frameBuffer);
+                }
+                if (pass == snapshot->passes - 1 && whole && bandFinished)
+                    bandFinished(band, rows, scale);
+            }
         }
+        completedPasses = pass + 1;
+        if (passFinished && regionFirst == 0 && regionEnd == height)
+            passFinished(completedPasses);
     }
-    if (restartRaytrace) {
-        raytracingRunning = false;
-        return;
+
+    // A resumed render that already had every pass still has to hand its rows on
+    if (firstPass >= snapshot->passes) {
+        PostProcess::develop(hdrBuffer, long(regionFirst) * width, long(regionEnd - regionFirst) * width, AverageScale(), snapshot->exposure, snapshot->toneMap, frameBuffer);
+        if (bandFinished)
+            bandFinished(regionFirst, regionEnd - regionFirst, AverageScale());
     }
+}
 
-    raytracingRunning = false;
+// Traces the first pass's samples of the pixels at even coordinates into previewImage
+// a level at a time: one pixel in each PREVIEW_BLOCK square block, then the pixels
+// halfway between those, and so on. After each level every pixel without samples
+// yet shows the sample at its block's corner. false if the render was stopped.
+template <unsigned Features>
+bool Raytracer::TracePreview()
+{
+    int width = snapshot->width;
+    int height = snapshot->height;
+    if (previewImage.width != (width + 1) / 2 || previewImage.height != (height + 1) / 2) {
+        if (!previewImage.Resize((width + 1) / 2, (height + 1) / 2) || !previewFrame.Resize((width + 1) / 2, (height + 1) / 2))
+            return false;
+    }
+    long previewPixels = previewImage.width * previewImage.height;
+
+    for (int step = PREVIEW_BLOCK; step >= 2; step /= 2) {
+        if (restartRaytrace)
+            return false;
+        int levelRows = (height + step - 1) / step;
+        int packetsPerRow = ((width + step - 1) / step + PACKET_SIZE - 1) / PACKET_SIZE;
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int p = 0; p < levelRows * packetsPerRow; p++) {
+            int j = (p / packetsPerRow) * step;
+            // Rows a coarser level went through already have every other sample of this one
+            int first = step < PREVIEW_BLOCK && j % (2 * step) == 0 ? step : 0;
+            int stride = first > 0 ? 2 * step : step;
+            int k = (p % packetsPerRow) * PACKET_SIZE;
+            int count = std::min(PACKET_SIZE, (width - first + stride - 1) / stride - k);
+            if (count <= 0)
+                continue;
+            int i = first + k * stride;
+            Homogeneous4 colours[PACKET_SIZE];
+            if constexpr ((Features & FEATURE_MONTE_CARLO) != 0)
+                Reseed(snapshot->seed, 2, seedPassOffset, j, i);
+            // Bounce rays are traced straight away, a level is too sparse to stream them
+            for (int s = 0; s < ANTI_ALIAS_SAMPLES; s++)
+                TracePrimaryPacket<Features>(i, j, count, colours, nullptr, stride);
+            for (int lane = 0; lane < count; lane++) {
+                long index = long(j / 2) * previewImage.width + (i + lane * stride) / 2;
+                previewImage.red[index] = colours[lane].x;
+                previewImage.green[index] = colours[lane].y;
+                previewImage.blue[index] = colours[lane].z;
+                previewImage.alpha[index] = colours[lane].w;
+            }
+        }
+
+        // Pixels that kept samples from the last frame show those, which are better than this
+        PostProcess::develop(previewImage, 0, previewPixels, 1.0f / ANTI_ALIAS_SAMPLES, snapshot->exposure, snapshot->toneMap, previewFrame);
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < height; y++) {
+            const RGBAValue* corners = previewFrame.block + long((y - y % step) / 2) * previewFrame.width;
+            for (int x = 0; x < width; x++) {
+                long pixel = long(y) * width + x;
+                if (statistics.counts[pixel] <= 0.0f)
+                    frameBuffer.block[pixel] = corners[(x - x % step) / 2];
+                else
+                    PostProcess::develop(hdrBuffer, pixel, 1, statistics.counts.data(), snapshot->exposure, snapshot->toneMap, frameBuffer);
+            }
+        }
+    }
+    return true;
 }
 
-std::default_random_engine generator;
-std::uniform_real_distribution<float> distribution(0, 1);
+// Traces one sample for count pixels starting at (pixelX, pixelY) and adds it to colours.
+// The camera rays go through the BVH as a packet, and so do the shadow rays
+// from their hit points towards each light, before every pixel is shaded on its own.
+// The pixels are stride apart. Monte Carlo bounce rays leaving the hits are appended to
+// deferred rather than traced, with pixel set to the pixel's offset in the row. Without
+// deferred they are traced here.
+template <unsigned Features>
+void Raytracer::TracePrimaryPacket(int pixelX, int pixelY, int count, Homogeneous4* colours, RayStream::Batch* deferred, int stride) {
+    RayPacket packet(Ray::Type::primary);
+    if constexpr ((Features & FEATURE_MONTE_CARLO) != 0) {
+        // Anti-aliasing by getting random position in pixel
+        float jitterX[PACKET_SIZE], jitterY[PACKET_SIZE];
+        for (int lane = 0; lane < count; lane++) {
+            jitterX[lane] = distribution(generator);
+            jitterY[lane] = distribution(generator);
+        }
+        snapshot->camera.generate(pixelX, pixelY, count, jitterX, jitterY, packet, stride);
+    }
+    else {
+        snapshot->camera.generate(pixelX, pixelY, count, nullptr, nullptr, packet, stride);
+    }
+
+    Scene::CollisionInfo hits[PACKET_SIZE];
+    raytraceScene.closestTriangles(packet, hits);
+    if (recordingHits)
+        RecordFirstHits<Features>(packet, hits, pixelX, pixelY, count, stride);
+
+    const RenderSnapshot& view = *snapshot;
+    int nLights = int(view.lights.size());
+    bool packetShadows = (Features & FEATURE_PHONG) && (Features & FEATURE_SHADOWS) && !(Features & FEATURE_INTERPOLATION) && nLights > 0;
+    // Each lane shades every light, or the few it picks from the light tree
+    int slots = view.lightTree.empty() ? nLights : LIGHT_TREE_SAMPLES;
+    Arena& scratch = Arena::Scratch();
+    Arena::Scope scope(scratch);
+    LightSample* lightSamples = packetShadows ? scratch.allocateArray<LightSample>(size_t(PACKET_SIZE) * slots) : nullptr;
+    int lightCounts[PACKET_SIZE] = {};
+
+    if (packetShadows) {
+        Cartesian3 hitPoints[PACKET_SIZE];
+        Cartesian3 normals[PACKET_SIZE];
+        bool needsShadow[PACKET_SIZE];
+        for (int lane = 0; lane < PACKET_SIZE; lane++) {
+            needsShadow[lane] = lane < count && hits[lane].t > 0.0f && !(hits[lane].tri.materialFlags & MATERIAL_LIGHT);
+            if (!needsShadow[lane]) continue;
+            hitPoints[lane] = packet.ray(lane).origin + packet.ray(lane).direction * hits[lane].t;
+            Cartesian3 bary = hits[lane].tri.barycentric(hitPoints[lane]);
+            normals[lane] = raytraceScene.shadingNormal(hits[lane].tri, bary);
+            if (view.lightTree.empty()) {
+                for (int li = 0; li < nLights; li++) {
+                    lightSamples[lane * slots + li].light = li;
+                    lightSamples[lane * slots + li].weight = 1.0f;
+                }
+                lightCounts[lane] = nLights;
+            }
+            else {
+                lightCounts[lane] = ChooseLights(hitPoints[lane], normals[lane], &lightSamples[lane * slots]);
+            }
+        }
+
+        for (int slot = 0; slot < slots; slot++) {
+            RayPacket shadowPacket(Ray::Type::shadow);
+            bool traced[PACKET_SIZE];
+            for (int lane = 0; lane < PACKET_SIZE; lane++) {
+                traced[lane] = needsShadow[lane] && slot < lightCounts[lane];
+                if (!traced[lane]) continue;
+                LightSample& sample = lightSamples[lane * slots + slot];
+                const RenderSnapshot::SnapshotLight& l = view.lights[sample.light];
+                // Light position in view space
+                sample.position = (Features & FEATURE_MONTE_CARLO) ? l.sample([&]() { return distribution(generator); }) : l.centre;
+                // Offset hit point based on the triangle's normal and aim at the light
+                Cartesian3 biasedHitPoint = hitPoints[lane] + normals[lane] * 0.001f;
+                Cartesian3 dirToLight = (sample.position.Point() - hitPoints[lane]).unit();
+                shadowPacket.set(lane, Ray(biasedHitPoint, dirToLight, Ray::Type::shadow), (sample.position.Point() - biasedHitPoint).length());
+            }
+
+            bool blocked[PACKET_SIZE];
+            raytraceScene.occluded(shadowPacket, blocked);
+            for (int lane = 0; lane < PACKET_SIZE; lane++)
+                if (traced[lane])
+                    lightSamples[lane * slots + slot].inShadow = blocked[lane];
+        }
+    }
+
+    for (int lane = 0; lane < count; lane++) {
+        Ray primary = packet.ray(lane);
+        view.camera.applyCone(primary);
+        size_t firstDeferred = deferred != nullptr ? deferred->size() : 0;
+        colours[lane] = colours[lane] + ShadeHit<Features>(primary, hits[lane], N_BOUNCES, 1.0f, false,
+                                                 packetShadows ? &lightSamples[lane * slots] : nullptr, lightCounts[lane], deferred);
+        for (size_t k = firstDeferred; deferred != nullptr && k < deferred->size(); k++)
+            (*deferred)[k].pixel = pixelX + lane * stride;
+    }
+}
 
+// Traces a sorted stream of Monte Carlo bounce rays a packet at a time and
+// writes each ray's contribution to its pixel into results, in stream order.
+// sample numbers the sweep the rays were traced in, which seeds them.
+template <unsigned Features>
+void Raytracer::TraceSecondaryStream(const RayStream& stream, int sample, int band, Homogeneous4* results) {
+    int n = int(stream.entries.size());
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int first = 0; first < n; first += PACKET_SIZE) {
+        int count = std::min(PACKET_SIZE, n - first);
+        Reseed(snapshot->seed, 1, sample, band, first);
+        RayPacket packet(Ray::Type::secondary);
+        for (int lane = 0; lane < count; lane++)
+            packet.set(lane, stream.entries[first + lane].ray, 0.0f);
+
+        Scene::CollisionInfo hits[PACKET_SIZE];
+        raytraceScene.closestTriangles(packet, hits);
+
+        for (int lane = 0; lane < count; lane++) {
+            const RayStream::Entry& entry = stream.entries[first + lane];
+            results[first + lane] = IndirectSample<Features>(entry.ray, hits[lane], raytraceScene.triangles[entry.triangle], entry.bary,
+                                                   entry.bounces, entry.currentIOR, entry.hitLight) / MONTE_CARLO_PDF;
+        }
+    }
+}
+
+template <unsigned Features>
 Homogeneous4 Raytracer::TraceAndShadeWithRay(Ray ray, int bounces, float currentIOR, bool hitLight) {
     Homogeneous4 colour(0.0f, 0.0f, 0.0f, 0.0f);
     
@@ -122,12 +496,236 @@ Homogeneous4 Raytracer::TraceAndShadeWithRay(Ray ray, int bounces, float current
 
     // Do russian roulette to possibly terminate rays,
     // only do on secondary rays to not possibly lose much detail
-    if (renderParameters->monteCarloEnabled && ray.ray_type != Ray::Type::primary && distribution(generator) < TERMINATION_FACTOR)
+    if ((Features & FEATURE_MONTE_CARLO) && ray.ray_type != Ray::Type::primary && distribution(generator) < TERMINATION_FACTOR)
         return colour;
 
     // Follow ray to find closest triangle
     Scene::CollisionInfo ci = raytraceScene.closestTriangle(ray);
 
+    return ShadeHit<Features>(ray, ci, bounces, currentIOR, hitLight, nullptr, 0);
+}
+
+// Light gathered at the triangle from along one Monte Carlo ray whose closest hit is ci.
+// bary gives where on the triangle the ray started.
+template <unsigned Features>
+Homogeneous4 Raytracer::IndirectSample(const Ray& monteCarloRay, const Scene::CollisionInfo& ci, Triangle& from, const Cartesian3& bary, int bounces, float currentIOR, bool hitLight) {
+    if (ci.t <= 0.0f)
+        return Homogeneous4(0.0f, 0.0f, 0.0f, 0.0f);
+
+    // Shade the point the ray reached, unless the path ends here
+    Homogeneous4 endColor(0.0f, 0.0f, 0.0f, 0.0f);
+    if (bounces > 0 && distribution(generator) >= TERMINATION_FACTOR)
+        endColor = ShadeHit<Features>(monteCarloRay, ci, bounces, currentIOR, hitLight, nullptr, 0);
+
+    // Get hit montecarlo hit position
+    Cartesian3 hitP = monteCarloRay.origin + monteCarloRay.direction * ci.t;
+    // Get the shading for this point based on the colour we received with some part of the ambient(?)
+    const MaterialData& material = raytraceScene.materials[from.materialID];
+    Cartesian3 albedo = raytraceScene.albedo(from, bary, monteCarloRay.coneWidth, monteCarloRay.direction);
+    return from.phong(material, hitP, endColor, bary, raytraceScene.shadingNormal(from, bary), false, albedo).modulate(material.ambient);
+}
+
+template <unsigned Features>
+Cartesian3 Raytracer::CachedIrradiance(const Ray& ray, const Scene::CollisionInfo& ci, const Cartesian3& hitPoint, const Cartesian3& normal, int bounces, float currentIOR, bool hitLight) {
+    Cartesian3 irradiance;
+    if (irradianceCache.lookup(hitPoint, normal, irradiance))
+        return irradiance;
+
+    // Gather a record from one ray through each stratum of the hemisphere, each followed
+    // as a bounce ray would be. Russian roulette would only add noise here, so every
+    // path goes on and its light is scaled by the chance it would have survived.
+    Cartesian3 tangent, bitangent;
+    IrradianceCache::Basis(normal, tangent, bitangent);
+    Cartesian3 radiance[IRRADIANCE_SAMPLES];
+    float distance[IRRADIANCE_SAMPLES];
+    for (int j = 0; j < IRRADIANCE_THETA_STRATA; j++) {
+        for (int k = 0; k < IRRADIANCE_PHI_STRATA; k++) {
+            int s = j * IRRADIANCE_PHI_STRATA + k;
+            Cartesian3 direction = IrradianceCache::StratumDirection(j, k, distribution(generator), distribution(generator), tangent, bitangent, normal);
+            Ray gatherRay(hitPoint + direction * 0.0001f, direction, Ray::Type::secondary);
+            gatherRay.continueCone(ray, ci.t);
+            Scene::CollisionInfo hit = raytraceScene.closestTriangle(gatherRay);
+            radiance[s] = Cartesian3();
+            distance[s] = IRRADIANCE_FAR;
+            if (hit.t <= 0.0f)
+                continue;
+            distance[s] = hit.t;
+            if (bounces > 1)
+                radiance[s] = ShadeHit<Features>(gatherRay, hit, bounces - 1, currentIOR, hitLight, nullptr, 0).Vector() * (1.0f - TERMINATION_FACTOR);
+        }
+    }
+
+    // The record covers at least a few pixels and at most a few dozen, however open its surroundings
+    float footprint = ray.coneWidth + ray.coneSpread * ci.t;
+    IrradianceCache::Record record = IrradianceCache::Gather(hitPoint, normal, tangent, bitangent, radiance, distance,
+                                                             IRRADIANCE_MIN_PIXELS * footprint, IRRADIANCE_MAX_PIXELS * footprint);
+    irradianceCache.insert(record);
+    return record.irradiance;
+}
+
+template <unsigned Features>
+void Raytracer::EmitPhotons(int sample, int pass) {
+    if (causticReach <= 0.0f || sample == photonSample)
+        return;
+    photonSample = sample;
+
+    // Directional lights have no position to shoot from
+    std::vector<int> emitters;
+    for (size_t l = 0; l < snapshot->lights.size(); l++)
+        if (snapshot->lights[l].type != Light::Directional)
+            emitters.push_back(int(l));
+    if (emitters.empty()) {
+        photonMap.clear();
+        return;
+    }
+
+    // Every light shoots the same number, since each lights the scene in full
+    int perLight = std::max(snapshot->photonsPerPass / int(emitters.size()), 1);
+    int total = perLight * int(emitters.size());
+    int blocks = (total + PHOTON_BLOCK - 1) / PHOTON_BLOCK;
+    // Each block keeps its own photons and seed, so the map is the same whichever thread traced what
+    std::vector<std::vector<PhotonMap::Photon>> landed(blocks);
+    #pragma omp parallel for schedule(dynamic)
+    for (int block = 0; block < blocks; block++) {
+        Reseed(snapshot->seed, 3, sample, block, 0);
+        int end = std::min(total, (block + 1) * PHOTON_BLOCK);
+        for (int photon = block * PHOTON_BLOCK; photon < end; photon++)
+            TracePhoton<Features>(snapshot->lights[emitters[photon / perLight]], perLight, landed[block]);
+    }
+
+    std::vector<PhotonMap::Photon> photons;
+    for (const std::vector<PhotonMap::Photon>& found : landed)
+        photons.insert(photons.end(), found.begin(), found.end());
+    photonMap.build(photons, PhotonMap::PassRadius(photonRadius, pass));
+}
+
+template <unsigned Features>
+void Raytracer::TracePhoton(const RenderSnapshot::SnapshotLight& light, int photons, std::vector<PhotonMap::Photon>& landed) {
+    // Aim uniformly at the sphere around the mirrors and glass, or anywhere from inside it
+    Cartesian3 origin = light.sample([&]() { return distribution(generator); }).Point();
+    Cartesian3 toCentre = causticCentre - origin;
+    float distance = toCentre.length();
+    bool outside = distance > causticReach;
+    float cosMax = outside ? std::sqrt(1.0f - (causticReach / distance) * (causticReach / distance)) : -1.0f;
+    float cosTheta = 1.0f - distribution(generator) * (1.0f - cosMax);
+    float sinTheta = std::sqrt(std::max(1.0f - cosTheta * cosTheta, 0.0f));
+    float phi = 2.0f * PI * distribution(generator);
+    Cartesian3 axis = outside ? toCentre / distance : Cartesian3(0.0f, 0.0f, 1.0f);
+    Cartesian3 tangent, bitangent;
+    IrradianceCache::Basis(axis, tangent, bitangent);
+    Cartesian3 direction = (sinTheta * std::cos(phi)) * tangent + (sinTheta * std::sin(phi)) * bitangent + cosTheta * axis;
+
+    Ray ray(origin + direction * 0.0001f, direction, Ray::Type::secondary);
+    Scene::CollisionInfo ci = raytraceScene.closestTriangle(ray);
+    if (ci.t <= 0.0f)
+        return;
+    // Triangle::phong's lights do not fall off with distance, so a photon carries the light's
+    // colour over the area its share of the solid angle covers where it first lands
+    float solidAngle = 2.0f * PI * (1.0f - cosMax);
+    Cartesian3 power = light.colour.Vector() * (ci.t * ci.t * solidAngle / photons);
+
+    // The photon goes the way ShadeHit would follow a ray from the surfaces it meets
+    float currentIOR = 1.0f;
+    bool focused = false;
+    for (int bounce = 0; bounce < N_BOUNCES && ci.t > 0.0f; bounce++) {
+        if (ci.tri.materialFlags & MATERIAL_LIGHT)
+            return;
+        Cartesian3 hitPoint = ray.origin + ray.direction * ci.t;
+        Cartesian3 bary = ci.tri.barycentric(hitPoint);
+        Cartesian3 normal = raytraceScene.shadingNormal(ci.tri, bary);
+        const MaterialData& material = raytraceScene.materials[ci.tri.materialID];
+        float IOR = (currentIOR == material.indexOfRefraction) ? 1.0f : material.indexOfRefraction;
+        bool fresnelSurface = (Features & FEATURE_FRESNEL) && (ci.tri.materialFlags & (MATERIAL_REFLECTIVE | MATERIAL_TRANSPARENT));
+        bool mirror = !(Features & FEATURE_FRESNEL) && (Features & FEATURE_REFLECTION) && (ci.tri.materialFlags & MATERIAL_REFLECTIVE);
+        bool glass = !(Features & FEATURE_FRESNEL) && !mirror && (Features & FEATURE_REFRACTION) && (ci.tri.materialFlags & MATERIAL_TRANSPARENT);
+
+        // Light that came through a mirror or glass is a caustic wherever ShadeHit shades the
+        // surface itself, which takes in partly diffuse mirrors and glass but not Fresnel ones.
+        // Direct light is shaded as it is.
+        if (focused && !fresnelSurface)
+            landed.push_back({ hitPoint, ray.direction, power });
+
+        if (fresnelSurface) {
+            // Either way, with the chance of its share of what carries on
+            float fresnelMult = fresnel(currentIOR, IOR, ray, normal);
+            float reflected = material.reflectivity * fresnelMult;
+            float transmitted = material.transparency * (1.0f - fresnelMult);
+            if (reflected + transmitted <= 0.0f)
+                return;
+            bool reflect = distribution(generator) * (reflected + transmitted) < reflected;
+            ray = reflect ? reflectRay(ray, normal, hitPoint) : refractRay(ray, normal, hitPoint, IOR, currentIOR);
+            if (!reflect)
+                currentIOR = IOR;
+            power = power * (reflected + transmitted);
+        }
+        else if (mirror) {
+            ray = reflectRay(ray, normal, hitPoint);
+            power = power * material.reflectivity;
+        }
+        else if (glass) {
+            ray = refractRay(ray, normal, hitPoint, IOR, currentIOR);
+            currentIOR = IOR;
+            power = power * material.transparency;
+        }
+        else
+            return;
+        focused = true;
+        ci = raytraceScene.closestTriangle(ray);
+    }
+}
+
+void Raytracer::AimPhotons()
+{
+    causticReach = photonRadius = 0.0f;
+    photonSample = -1;
+    photonMap.clear();
+    unsigned features = snapshot->features;
+    if (!snapshot->caustics || !(features & FEATURE_PHONG) || raytraceScene.bvh.nodes.empty())
+        return;
+
+    // The surfaces ShadeHit follows rays off, for the features this frame has
+    BVH::AABB specular;
+    bool found = false;
+    for (const Triangle& triangle : raytraceScene.triangles) {
+        bool mirror = (features & (FEATURE_REFLECTION | FEATURE_FRESNEL)) && (triangle.materialFlags & MATERIAL_REFLECTIVE);
+        bool glass = (features & (FEATURE_REFRACTION | FEATURE_FRESNEL)) && (triangle.materialFlags & MATERIAL_TRANSPARENT);
+        if (!mirror && !glass)
+            continue;
+        for (int v = 0; v < 3; v++)
+            specular.grow(triangle.verts[v].Point());
+        found = true;
+    }
+    if (!found)
+        return;
+    causticCentre = (specular.min + specular.max) * 0.5f;
+    causticReach = (specular.max - specular.min).length() * 0.5f;
+    const BVH::AABB& scene = raytraceScene.bvh.nodes[0].bounds;
+    photonRadius = PHOTON_RADIUS_FRACTION * std::max({ scene.max.x - scene.min.x, scene.max.y - scene.min.y, scene.max.z - scene.min.z });
+}
+
+int Raytracer::ChooseLights(const Cartesian3& point, const Cartesian3& normal, LightSample* samples)
+{
+    int found = 0;
+    for (int s = 0; s < LIGHT_TREE_SAMPLES; s++) {
+        float probability;
+        int light = snapshot->lightTree.sample(point, normal, distribution(generator), probability);
+        if (light < 0)
+            break;
+        samples[found].light = light;
+        // Each draw estimates the sum over every light, their mean is kept
+        samples[found].weight = 1.0f / (probability * LIGHT_TREE_SAMPLES);
+        found++;
+    }
+    return found;
+}
+
+// Shades the closest hit ci of ray. If lightSamples is given it holds the nLightSamples
+// lights to shade with their positions and shadowing for this hit, otherwise they are worked out here.
+// If deferred is given the Monte Carlo rays are added to it instead of being traced.
+template <unsigned Features>
+Homogeneous4 Raytracer::ShadeHit(Ray ray, Scene::CollisionInfo ci, int bounces, float currentIOR, bool hitLight, const LightSample* lightSamples, int nLightSamples, RayStream::Batch* deferred) {
+    Homogeneous4 colour(0.0f, 0.0f, 0.0f, 0.0f);
+
     // If we hit something
     if (ci.t > 0.0f) {
         // Calculate where our ray hit
@@ -135,67 +733,92 @@ Homogeneous4 Raytracer::TraceAndShadeWithRay(Ray ray, int bounces, float current
         // Find barycentric coordinates of where the ray hit the triangle
         Cartesian3 bary = ci.tri.barycentric(hitPoint);
         // Calculate interpolated normal on triangle
-        Cartesian3 normal = (bary.x * ci.tri.normals[0].Vector() + bary.y * ci.tri.normals[1].Vector() + bary.z * ci.tri.normals[2].Vector()).unit();
+        Cartesian3 normal = raytraceScene.shadingNormal(ci.tri, bary);
 
         // Hit material properties
-        float surfaceReflectivity = ci.tri.shared_material->reflectivity;
-        float surfaceTransparency = ci.tri.shared_material->transparency;
+        const MaterialData& material = raytraceScene.materials[ci.tri.materialID];
+        float surfaceReflectivity = material.reflectivity;
+        float surfaceTransparency = material.transparency;
         // If the triangle we hit has an IOR matching our current IOR then is it most likely the case we are exiting that object and going to air
-        float IOR = (currentIOR == ci.tri.shared_material->indexOfRefraction) ? 1.0f : ci.tri.shared_material->indexOfRefraction;
+        float IOR = (currentIOR == material.indexOfRefraction) ? 1.0f : material.indexOfRefraction;
 
         // Do NEE by tracking if the hit material is light and we have not yet hit a light for this ray's path
         // and if so then we return the lights emissive colour
-        if (ci.tri.shared_material->isLight() && !hitLight) {
+        if ((ci.tri.materialFlags & MATERIAL_LIGHT) && !hitLight) {
             hitLight = true;
-            return ci.tri.shared_material->emissive;
+            return material.emissive;
         }
 
-        if (renderParameters->interpolationRendering)
+        if constexpr ((Features & FEATURE_INTERPOLATION) != 0)
             return Homogeneous4(std::abs(normal.x), std::abs(normal.y), std::abs(normal.z), 255);
 
-        if (renderParameters->phongEnabled) {
-
-            for (Light* l : renderParameters->lights) {
-                // Transform light position to view space
-                Homogeneous4 transformedLightPos = raytraceScene.getModelview() * (renderParameters->monteCarloEnabled ? l->GetPosition() : l->GetPositionCenter());
+        if constexpr ((Features & FEATURE_PHONG) != 0) {
+            // Texture colour filtered over the ray cone's footprint at the hit
+            Cartesian3 albedo = raytraceScene.albedo(ci.tri, bary, ray.coneWidth + ray.coneSpread * ci.t, ray.direction);
+
+            // The lights to shade, every light unless some were picked from the light tree
+            LightSample picked[LIGHT_TREE_SAMPLES];
+            const LightSample* chosen = lightSamples;
+            int nShaded = lightSamples != nullptr ? nLightSamples : int(snapshot->lights.size());
+            if ((Features & FEATURE_MONTE_CARLO) && lightSamples == nullptr && !snapshot->lightTree.empty()) {
+                nShaded = ChooseLights(hitPoint, normal, picked);
+                chosen = picked;
+            }
 
+            for (int i = 0; i < nShaded; i++) {
+                const RenderSnapshot::SnapshotLight& l = snapshot->lights[chosen != nullptr ? chosen[i].light : i];
+                Homogeneous4 transformedLightPos;
                 bool inShadow = false;
 
-                // Do shadows
-                if (renderParameters->shadowsEnabled) {
-                    // Calculate direction to light and normalise
-                    Cartesian3 dirToLight = (transformedLightPos.Point() - hitPoint).unit();
-                    // Offset hit point based on the triangle's normal
-                    Cartesian3 biasedHitPoint = hitPoint + normal * 0.001f;
-                    // Create ray
-                    Ray shadowRay(biasedHitPoint, dirToLight, Ray::Type::shadow);
-
-                    // Fire ray into scene and get closest triangle
-                    Scene::CollisionInfo ci2 = raytraceScene.closestTriangle(shadowRay);
-
-                    // If we hit something and it is closer than the light we are looping over, then we are in shadow
-                    if (ci2.t > 0 && ci2.t < (transformedLightPos.Point() - biasedHitPoint).length())
-                        inShadow = true;
+                if (lightSamples != nullptr) {
+                    transformedLightPos = lightSamples[i].position;
+                    inShadow = lightSamples[i].inShadow;
                 }
+                else {
+                    // Light position in view space
+                    transformedLightPos = (Features & FEATURE_MONTE_CARLO) ? l.sample([&]() { return distribution(generator); }) : l.centre;
+
+                    // Do shadows
+                    if constexpr ((Features & FEATURE_SHADOWS) != 0) {
+                        // Calculate direction to light and normalise
+                        Cartesian3 dirToLight = (transformedLightPos.Point() - hitPoint).unit();
+                        // Offset hit point based on the triangle's normal
+                        Cartesian3 biasedHitPoint = hitPoint + normal * 0.001f;
+                        // Create ray
+                        Ray shadowRay(biasedHitPoint, dirToLight, Ray::Type::shadow);
+
+                        // If anything is closer than the light we are looping over, then we are in shadow
+                        inShadow = raytraceScene.occluded(shadowRay, (transformedLightPos.Point() - biasedHitPoint).length());
+                    }
+                }
+
+                Homogeneous4 lit = ci.tri.phong(material, transformedLightPos, l.colour, bary, normal, inShadow, albedo);
+                colour = colour + (chosen != nullptr ? lit * chosen[i].weight : lit);
+            }
 
-                colour = colour + ci.tri.phong(transformedLightPos, l->GetColor(), bary, inShadow);
+            // Light the mirrors and glass focus here, which the shadow rays above count as blocked
+            if (!photonMap.empty()) {
+                Cartesian3 caustic = photonMap.irradiance(hitPoint, normal);
+                colour = colour + Homogeneous4(material.diffuse.x * albedo.x * caustic.x, material.diffuse.y * albedo.y * caustic.y, material.diffuse.z * albedo.z * caustic.z, 0.0f);
             }
 
             // Reflection and refraction cases, only run either if fresnel rendering is also off
-            if (!renderParameters->fresnelRendering && renderParameters->reflectionEnabled && surfaceReflectivity > 0.0f) {
+            if (!(Features & FEATURE_FRESNEL) && (Features & FEATURE_REFLECTION) && (ci.tri.materialFlags & MATERIAL_REFLECTIVE)) {
                 Ray reflectedRay = reflectRay(ray, normal, hitPoint);
+                reflectedRay.continueCone(ray, ci.t);
 
-                return surfaceReflectivity * TraceAndShadeWithRay(reflectedRay, --bounces, currentIOR, hitLight) + (1 - surfaceReflectivity) * colour;
+                return surfaceReflectivity * TraceAndShadeWithRay<Features>(reflectedRay, --bounces, currentIOR, hitLight) + (1 - surfaceReflectivity) * colour;
             }
 
-            if (!renderParameters->fresnelRendering && renderParameters->refractionEnabled && surfaceTransparency > 0.0f) {
+            if (!(Features & FEATURE_FRESNEL) && (Features & FEATURE_REFRACTION) && (ci.tri.materialFlags & MATERIAL_TRANSPARENT)) {
                 Ray refractedRay = refractRay(ray, normal, hitPoint, IOR, currentIOR);
+                refractedRay.continueCone(ray, ci.t);
 
-                return surfaceTransparency * TraceAndShadeWithRay(refractedRay, --bounces, IOR, hitLight) + (1 - surfaceTransparency) * colour;
+                return surfaceTransparency * TraceAndShadeWithRay<Features>(refractedRay, --bounces, IOR, hitLight) + (1 - surfaceTransparency) * colour;
             }
 
             // Fresnel rendering
-            if (renderParameters->fresnelRendering && (surfaceReflectivity > 0.0f || surfaceTransparency > 0.0f)) {
+            if ((Features & FEATURE_FRESNEL) && (ci.tri.materialFlags & (MATERIAL_REFLECTIVE | MATERIAL_TRANSPARENT))) {
                 // Get fresnel multiplier
                 float fresnelMult = fresnel(currentIOR, IOR, ray, normal);
 
@@ -205,41 +828,57 @@ Homogeneous4 Raytracer::TraceAndShadeWithRay(Ray ray, int bounces, float current
 
                 // Cast both reflect and refract rays
                 Ray reflectedRay = reflectRay(ray, normal, hitPoint);
+                reflectedRay.continueCone(ray, ci.t);
                 Ray refractedRay = refractRay(ray, normal, hitPoint, IOR, currentIOR);
+                refractedRay.continueCone(ray, ci.t);
 
                 // Caclulate colour
-                return reflectivity * TraceAndShadeWithRay(reflectedRay, --bounces, currentIOR, hitLight) + transparency * TraceAndShadeWithRay(refractedRay, --bounces, IOR, hitLight); // last trace call use IOR maybe?
+                return reflectivity * TraceAndShadeWithRay<Features>(reflectedRay, --bounces, currentIOR, hitLight) + transparency * TraceAndShadeWithRay<Features>(refractedRay, --bounces, IOR, hitLight); // last trace call use IOR maybe?
             }
 
             // Indirect lighting (ambient)
-            if (renderParameters->monteCarloEnabled) {
-                Homogeneous4 indirectColour(0, 0, 0, 1);
-                for (int i = 0; i < MONTE_CARLO_RAYS; i++) { // Setting MONTE_CARLO_RAYS to greater than 1 makes the scene very black and dark not too sure why
-                    // Sample random position in hemisphere
-                    Cartesian3 randomDir = monteCarlo3DHemisphere(normal).unit();
-                    Ray monteCarloRay(hitPoint + randomDir * 0.0001f, randomDir, Ray::Type::secondary);
-
-                    // Trace montecarlo ray
-                    Homogeneous4 endColor = TraceAndShadeWithRay(monteCarloRay, --bounces, currentIOR, hitLight);
-                    
-                    Scene::CollisionInfo ci2 = raytraceScene.closestTriangle(monteCarloRay);
-                    if (ci2.t > 0.0f) {
-                        // Get hit montecarlo hit position
-                        Cartesian3 hitP = monteCarloRay.origin + monteCarloRay.direction * ci2.t;
-                        // Get the shading for this point based on the colour we received with some part of the ambient(?)
-                        indirectColour = indirectColour + ci.tri.phong(hitP, endColor, bary, false).modulate(ci.tri.shared_material->ambient);
-                    }
+            if constexpr ((Features & FEATURE_MONTE_CARLO) != 0) {
+                // Camera ray hits take the light from other surfaces from the irradiance cache instead.
+                // It holds irradiance only, so the glossy part of the bounce is taken as if that light
+                // came evenly from every direction: mean radiance (irradiance over pi) times the lobe's reflectance.
+                if (snapshot->irradianceCaching && ray.ray_type == Ray::Type::primary) {
+                    Cartesian3 irradiance = CachedIrradiance<Features>(ray, ci, hitPoint, normal, bounces, currentIOR, hitLight);
+                    const Cartesian3& ambient = material.ambient;
+                    float glossy = irradianceCache.glossyReflectance(ci.tri.materialID, -normal.dot(ray.direction.unit())) / PI;
+                    Cartesian3 reflectance = Cartesian3(material.diffuse.x * albedo.x, material.diffuse.y * albedo.y, material.diffuse.z * albedo.z) + material.specular * glossy;
+                    colour = colour + Homogeneous4(reflectance.x * irradiance.x * ambient.x, reflectance.y * irradiance.y * ambient.y, reflectance.z * irradiance.z * ambient.z, 0.0f);
                 }
-                // Divide by our PDF
-                float pdf = MONTE_CARLO_RAYS / (2 * PI);
-                indirectColour = indirectColour / pdf;
+                else {
+                    Homogeneous4 indirectColour(0, 0, 0, 1);
+                    for (int i = 0; i < MONTE_CARLO_RAYS; i++) { // Setting MONTE_CARLO_RAYS to greater than 1 makes the scene very black and dark not too sure why
+                        // Sample random position in hemisphere
+                        Cartesian3 randomDir = monteCarlo3DHemisphere(normal).unit();
+                        Ray monteCarloRay(hitPoint + randomDir * 0.0001f, randomDir, Ray::Type::secondary);
+                        monteCarloRay.continueCone(ray, ci.t);
+
+                        --bounces;
+
+                        // Leave the ray to be traced later with the rest of the stream
+                        if (deferred != nullptr) {
+                            deferred->push_back({monteCarloRay, 0, ci.tri.triangle_id, bary, bounces, currentIOR, hitLight});
+                            continue;
+                        }
+
+                        // Trace montecarlo ray
+                        Scene::CollisionInfo ci2 = raytraceScene.closestTriangle(monteCarloRay);
+                        indirectColour = indirectColour + IndirectSample<Features>(monteCarloRay, ci2, ci.tri, bary, bounces, currentIOR, hitLight);
+                    }
+                    // Divide by our PDF
+                    indirectColour = indirectColour / MONTE_CARLO_PDF;
 
-                // Add it to final colour
-                colour = colour + indirectColour;
+                    // Add it to final colour
+                    colour = colour + indirectColour;
+                }
             }
             // If montecarlo is not enabled just use ambient colour for indirect lighting
             else {
-                colour = colour + ci.tri.shared_material->ambient;
+                const Cartesian3& ambient = material.ambient;
+                colour = colour + Cartesian3(ambient.x * albedo.x, ambient.y * albedo.y, ambient.z * albedo.z);
             }
         }
     }
@@ -336,60 +975,210 @@ Cartesian3 Raytracer::monteCarlo3DHemisphere(Cartesian3 normal) {
     return rotationMatrix * randomDir;
 }
 
-Ray Raytracer::calculateRay(int pixelX, int pixelY, bool perspective) {
-    Cartesian3 pos, rayDirection;
-
-    // Anti-aliasing by getting random position in pixel
-    float dx = renderParameters->monteCarloEnabled ? distribution(generator) : 0.5f;
-    float dy = renderParameters->monteCarloEnabled ? distribution(generator) : 0.5f;
-
-    int width = frameBuffer.width;
-    int height = frameBuffer.height;
-
-    float i_ndcs = ((((float)pixelX + dx) / (float)width) - 0.5) * 2;
-    float j_ndcs = ((((float)pixelY + dy) / (float)height) - 0.5) * 2;
+    // routine that generates the image
+void Raytracer::Raytrace()
+{ // RaytraceRenderWidget::Raytrace()
+    stopRaytracer();
+    Prepare();
+    // The next frame can only reproject from this one if its first hits are known,
+    // the render records them as it traces the first pass
+    if (renderParameters->temporalReuse) {
+        reprojection.begin(*snapshot);
+        recordingHits = true;
+    }
+    else {
+        reprojection.invalidate();
+    }
+    Start();
+} // RaytraceRenderWidget::Raytrace()
 
-    float aspect = (float)width / (float)height;
-    
-    float x = i_ndcs;
-    float y = j_ndcs;    
-
-    if (perspective) {
-        float tanOver2 = std::tan(renderParameters->fov / 2);
-        x *= tanOver2;
-        y *= tanOver2;
-
-        x *= aspect;
-
-        pos = Cartesian3(0, 0, 0);
-        rayDirection = Cartesian3(x, y, 1);
-        rayDirection = rayDirection.unit();
-    } else {
-        if (aspect > 1.0)
-            x *= aspect;
-        else
-            y /= aspect;
+void Raytracer::Reproject()
+{
+    // Only Monte Carlo renders average many samples, anything else has one pass to redo
+    if (!renderParameters->temporalReuse || !renderParameters->monteCarloEnabled) {
+        Raytrace();
+        return;
+    }
+    stopRaytracer();
+    // The last frame's samples are set aside before Prepare() clears the buffers
+    if (previousHdr.width != hdrBuffer.width || previousHdr.height != hdrBuffer.height) {
+        if (!previousHdr.Resize(hdrBuffer.width, hdrBuffer.height) || !previousStatistics.Resize(hdrBuffer.width, hdrBuffer.height)) {
+            Raytrace();
+            return;
+        }
+    }
+    hdrBuffer.swap(previousHdr);
+    std::swap(statistics, previousStatistics);
+    // Every sweep of every pass the last frame started, finished or not, drew its samples already
+    int offset = seedPassOffset + (completedPasses + 1) * (FOCUS_EXTRA_PASSES + 1);
+    Prepare();
+    seedPassOffset = offset;
+    // Pixels are looked up in the last frame as the render first reaches them,
+    // so the GL thread traces nothing here
+    reprojection.begin(*snapshot);
+    recordingHits = carryingOver = true;
+    unevenSamples = true;
+    Start();
+}
 
-        pos = Cartesian3(x, y, 0);
-        rayDirection = Cartesian3(0, 0, 1);
+// A pixel's first hit is that of whichever of its samples is traced first, the
+// preview's or the first pass's, so it costs no rays of its own. Each pixel is in
+// one packet of a sweep, so the threads recording them never share one.
+template <unsigned Features>
+void Raytracer::RecordFirstHits(const RayPacket& packet, Scene::CollisionInfo* hits, int pixelX, int pixelY, int count, int stride)
+{
+    // What a mirror or glass shows changes with the view, so their samples are never kept
+    constexpr unsigned viewDependent = ((Features & (FEATURE_REFLECTION | FEATURE_FRESNEL)) ? MATERIAL_REFLECTIVE : 0)
+                                     | ((Features & (FEATURE_REFRACTION | FEATURE_FRESNEL)) ? MATERIAL_TRANSPARENT : 0);
+    for (int lane = 0; lane < count; lane++) {
+        long pixel = long(pixelY) * snapshot->width + pixelX + lane * stride;
+        ReprojectionCache::Hit& hit = reprojection.hits[pixel];
+        if (hit.material != ReprojectionCache::Hit::unseen)
+            continue;
+        Scene::CollisionInfo& ci = hits[lane];
+        if (ci.t <= 0.0f || (ci.tri.materialFlags & viewDependent)) {
+            hit.material = -1;
+            continue;
+        }
+        Ray ray = packet.ray(lane);
+        hit.position = ray.origin + ray.direction * ci.t;
+        hit.normal = raytraceScene.shadingNormal(ci.tri, ci.tri.barycentric(hit.position));
+        hit.material = ci.tri.materialID;
+
+        // Nothing has been added to the pixel yet, its own sample follows
+        long source = carryingOver ? reprojection.previousPixel(pixel) : -1;
+        if (source < 0 || previousStatistics.counts[source] <= 0.0f)
+            continue;
+        float keep = std::min(1.0f, REPROJECTION_MAX_SAMPLES / previousStatistics.counts[source]);
+        hdrBuffer.red[pixel] = previousHdr.red[source] * keep;
+        hdrBuffer.green[pixel] = previousHdr.green[source] * keep;
+        hdrBuffer.blue[pixel] = previousHdr.blue[source] * keep;
+        hdrBuffer.alpha[pixel] = previousHdr.alpha[source] * keep;
+        statistics.counts[pixel] = previousStatistics.counts[source] * keep;
+        statistics.squares[pixel] = previousStatistics.squares[source] * keep;
     }
+}
 
-    return Ray(pos, rayDirection, Ray::Type::primary);
+// Traces the passes a checkpoint of this frame is missing
+bool Raytracer::Resume(const std::string& checkpoint, uint64_t fingerprint)
+{
+    stopRaytracer();
+    Prepare();
+    Checkpoint::Header header;
+    if (!Checkpoint::Load(checkpoint, header, hdrBuffer, statistics, false) || header.fingerprint != fingerprint) {
+        hdrBuffer.clear();
+        statistics.clear();
+        return false;
+    }
+    // Later passes are seeded by their number, so they add new samples rather than repeat old ones
+    firstPass = completedPasses = int(header.passes);
+    std::cout << "Resuming from " << checkpoint << " after " << firstPass << " passes" << std::endl;
+    Start();
+    return true;
 }
 
+void Raytracer::Start()
+{
+    // Flag the render as running before the thread can finish and clear it
+    raytracingRunning = true;
+    std::thread raytracingThread(&Raytracer::RaytraceThread,this);
+    raytracingThread.detach();
+}
 
-    // routine that generates the image
-void Raytracer::Raytrace()
-{ // RaytraceRenderWidget::Raytrace()
-    stopRaytracer();
+// Sets up a frame from the current scene and parameters without tracing it
+void Raytracer::Prepare()
+{
+    // The scene is built with as many threads as the render will use
+    const Topology& topology = Topology::System();
+    omp_set_num_threads(topology.threadCount(renderParameters->threads, topology.nodesInUse(renderParameters->numaNodes)));
     //To make our lifes easier, lets calculate things on VCS.
     //So we need to process our scene to get a triangle soup in VCS.
-    raytraceScene.updateScene();
+    renderArena.reset();
+    raytraceScene.updateScene(renderArena);
+    // Everything the workers read from the render parameters is copied now,
+    // the GL thread may change them while the render runs
+    snapshot = std::make_shared<const RenderSnapshot>(*renderParameters, raytraceScene.getModelview(), frameBuffer.width, frameBuffer.height);
+    renderKernel = KernelFor(snapshot->features);
     frameBuffer.clear(RGBAValue(0.0f, 0.0f, 0.0f,1.0f));
-    std::thread raytracingThread(&Raytracer::RaytraceThread,this);
-    raytracingThread.detach();
+    hdrBuffer.clear();
+    statistics.clear();
+    regionFirst = 0;
+    regionEnd = snapshot->height;
+    firstPass = completedPasses = 0;
+    seedPassOffset = 0;
+    unevenSamples = false;
+    recordingHits = carryingOver = false;
+    AimPhotons();
+    // Records are in this frame's view space
+    if (snapshot->irradianceCaching && !raytraceScene.bvh.nodes.empty())
+        irradianceCache.reset(raytraceScene.bvh.nodes[0].bounds.min, raytraceScene.bvh.nodes[0].bounds.max, raytraceScene.materials);
+}
+
+// Sizes the render thread's OpenMP team for the snapshot and pins its threads.
+// A team of the same size keeps its threads between parallel regions, so
+// they stay where they were pinned for the whole render.
+void Raytracer::PlaceThreads()
+{
+    omp_set_num_threads(snapshot->threads);
+    if (!snapshot->pinThreads)
+        return;
+    const Topology& topology = Topology::System();
+    #pragma omp parallel
+    {
+        int thread = omp_get_thread_num(), threads = omp_get_num_threads();
+        Topology::Pin(topology.cpuOf(thread, threads, snapshot->numaNodes), topology.nodeOf(thread, threads, snapshot->numaNodes));
+    }
+}
+
+void Raytracer::setFocus(int x, int y)
+{
+    focusX = x;
+    focusY = y;
+}
+
+void Raytracer::FocusRegion(int& x0, int& y0, int& x1, int& y1) const
+{
+    int width = snapshot->width, height = snapshot->height;
+    int x = focusX, y = focusY;
+    if (x < 0 || y < 0) {
+        x = width / 2;
+        y = height / 2;
+    }
+    int half = snapshot->focusSize / 2;
+    x0 = std::clamp(x - half, 0, width);
+    x1 = std::clamp(x + half, x0, width);
+    y0 = std::clamp(y - half, 0, height);
+    y1 = std::clamp(y + half, y0, height);
+}
+
+// Traces a run of rows of the prepared frame on the calling thread
+void Raytracer::RaytraceRows(int firstRow, int rows)
+{
+    regionFirst = std::clamp(firstRow, 0, snapshot->height);
+    regionEnd = std::clamp(firstRow + rows, regionFirst, snapshot->height);
+    // The passes add to whatever the rows held, a tile sent out again starts over
+    hdrBuffer.clear(long(regionFirst) * snapshot->width, long(regionEnd - regionFirst) * snapshot->width);
+    statistics.clear(long(regionFirst) * snapshot->width, long(regionEnd - regionFirst) * snapshot->width);
     raytracingRunning = true;
-} // RaytraceRenderWidget::Raytrace()
+    RaytraceThread();
+}
+
+// Develops the finished HDR image again with the current exposure and tonemap
+void Raytracer::Develop()
+{
+    // A render in progress keeps developing with the settings it started with
+    if (raytracingRunning || !snapshot)
+        return;
+    if (unevenSamples)
+        PostProcess::develop(hdrBuffer, 0, hdrBuffer.width * hdrBuffer.height, statistics.counts.data(), renderParameters->exposure, renderParameters->toneMap, frameBuffer);
+    else
+        PostProcess::develop(hdrBuffer, 0, hdrBuffer.width * hdrBuffer.height, AverageScale(), renderParameters->exposure, renderParameters->toneMap, frameBuffer);
+}
+
+float Raytracer::AverageScale() const
+{
+    return 1.0f / float(std::max(completedPasses, 1) * ANTI_ALIAS_SAMPLES);
+}
     
 
 
@@ -5,11 +5,24 @@
 #include <vector>
 #include <mutex>
 #include <atomic>
+#include <array>
+#include <utility>
+#include <memory>
+#include <functional>
 
 // and include all of our own headers that we need
 #include "ThreeDModel.h"
 #include "RenderParameters.h"
 #include "Scene.h"
+#include "RayStream.h"
+#include "RenderSnapshot.h"
+#include "RGBAFloatImage.h"
+#include "SampleStatistics.h"
+#include "Arena.h"
+#include "ReprojectionCache.h"
+#include "IrradianceCache.h"
+#include "PhotonMap.h"
+
 
 class Raytracer 										
 	{ 
@@ -36,12 +49,47 @@ class Raytracer
 	// destructor
 	~Raytracer();
 	
-	void resize(int w, int h);
+	// false if the framebuffers could not be allocated
+	bool resize(int w, int h);
 	void stopRaytracer();
+	// blocks until the current render has finished
+	void waitForRaytracer();
 	RGBAImage frameBuffer;
+	// Linear, unclamped sum of every sample traced so far, frameBuffer is developed from it
+	RGBAFloatImage hdrBuffer;
+	// Sample counts and squared luminances of the pixels in hdrBuffer
+	SampleStatistics statistics;
+	// Called from the render thread once rows firstRow to firstRow + rows - 1 are final,
+	// scale turns their hdrBuffer sums into averages
+	std::function<void(int firstRow, int rows, float scale)> bandFinished;
+	// Called from the render thread whenever a pass over the whole frame is complete,
+	// with the number of passes now in hdrBuffer. The buffers stay still during the call.
+	std::function<void(int passes)> passFinished;
+
+	// Light position and visibility worked out ahead of shading, so the shadow
+	// rays for a whole packet of primary hits can be traced together.
+	// weight is one unless the light was picked from the light tree.
+	struct LightSample {
+		Homogeneous4 position;
+		bool inShadow;
+		int light;
+		float weight;
+	};
 
-	Ray calculateRay(int pixelX, int pixelY, bool perspective);
-	Homogeneous4 TraceAndShadeWithRay(Ray ray, int bounces, float reflectivity, bool hitLight);
+	template <unsigned Features> Homogeneous4 TraceAndShadeWithRay(Ray ray, int bounces, float reflectivity, bool hitLight);
+	template <unsigned Features> Homogeneous4 ShadeHit(Ray ray, Scene::CollisionInfo ci, int bounces, float currentIOR, bool hitLight, const LightSample* lightSamples, int nLightSamples, RayStream::Batch* deferred = nullptr);
+	// Draws LIGHT_TREE_SAMPLES lights for a shading point from the snapshot's light tree into
+	// samples, setting light and weight. Returns how many were found, points no light reaches get none.
+	int ChooseLights(const Cartesian3& point, const Cartesian3& normal, LightSample* samples);
+	template <unsigned Features> Homogeneous4 IndirectSample(const Ray& monteCarloRay, const Scene::CollisionInfo& ci, Triangle& from, const Cartesian3& bary, int bounces, float currentIOR, bool hitLight);
+	// Diffuse indirect irradiance at a camera ray's hit from the irradiance cache, gathering a new record if none is valid there
+	template <unsigned Features> Cartesian3 CachedIrradiance(const Ray& ray, const Scene::CollisionInfo& ci, const Cartesian3& hitPoint, const Cartesian3& normal, int bounces, float currentIOR, bool hitLight);
+	// Shoots the sweep's caustic photons from the point and area lights into photonMap, gathered within the radius for sweep number pass
+	template <unsigned Features> void EmitPhotons(int sample, int pass);
+	// Follows one of the photons photons shot from light through the mirrors and glass it meets, adding it to landed where it reaches a diffuse surface
+	template <unsigned Features> void TracePhoton(const RenderSnapshot::SnapshotLight& light, int photons, std::vector<PhotonMap::Photon>& landed);
+	template <unsigned Features> void TracePrimaryPacket(int pixelX, int pixelY, int count, Homogeneous4* colours, RayStream::Batch* deferred, int stride = 1);
+	template <unsigned Features> void TraceSecondaryStream(const RayStream& stream, int sample, int band, Homogeneous4* results);
 	Ray reflectRay(Ray ray, Cartesian3 normal, Cartesian3 hitPoint);
 	Ray refractRay(Ray ray, Cartesian3 normal, Cartesian3 hitPoint, float surfaceIOR, float currentIOR);
 	float fresnel(float currentIOR, float surfaceIOR, Ray ray, Cartesian3 normal);
@@ -55,9 +103,86 @@ class Raytracer
 
     // routine that generates the image
     void Raytrace();
+    // Like Raytrace(), after the camera moved. Pixels whose surface was in view
+    // in the last frame start from the samples it had there, only the others
+    // start over. Without Monte Carlo, or if the last frame was not recorded
+    // with temporalReuse on, it is the same as Raytrace().
+    void Reproject();
+    // Sets up a frame from the current scene and parameters without tracing it
+    void Prepare();
+    // Like Raytrace(), but starts from the samples in a checkpoint of the same frame and
+    // only traces the passes it lacks. false if the checkpoint is not of this frame.
+    bool Resume(const std::string& checkpoint, uint64_t fingerprint);
+    // Traces rows firstRow to firstRow + rows - 1 of the prepared frame on the calling thread,
+    // replacing their hdrBuffer sums. Distributed workers render their tiles with this.
+    void RaytraceRows(int firstRow, int rows);
+    // redevelops the last image after the exposure or tonemap changed
+    void Develop();
+    // turns the hdrBuffer sums of a finished frame into averages
+    float AverageScale() const;
+    // passes over the whole frame in hdrBuffer so far
+    int PassesDone() const { return completedPasses; }
+    // Moves the focus renders with one set give priority to, in pixels of the
+    // framebuffer. It may be called while a render runs, which follows it.
+    void setFocus(int x, int y);
     //threading stuff
     void RaytraceThread();
+
+    // A render loop specialised for one set of shading features
+    typedef void (Raytracer::*RenderKernel)();
+    static constexpr unsigned CanonicalFeatures(unsigned features);
+    static RenderKernel KernelFor(unsigned features);
     private:
+    template <unsigned Features> void RaytraceFeatures();
+    template <unsigned Features> bool TracePreview();
+    template <unsigned... Features> static constexpr std::array<RenderKernel, sizeof...(Features)> MakeKernels(std::integer_sequence<unsigned, Features...>);
+
+    // Picked in Raytrace() for the current settings
+    RenderKernel renderKernel;
+    // Read-only copy of the render parameters shared by every worker
+    std::shared_ptr<const RenderSnapshot> snapshot;
+    // Scene build scratch and the render loop's band buffers and ray stream, emptied by Prepare()
+    Arena renderArena;
+    // Rows the render loop traces, the whole frame unless a tile was asked for
+    int regionFirst, regionEnd;
+    // Passes already in hdrBuffer when the render loop starts, and those in it now
+    int firstPass, completedPasses;
+    // Added to the pass number samples are seeded with, so a frame that carried samples
+    // over from the last one draws new ones rather than those it already has
+    int seedPassOffset;
+    // First hits of the frame in hdrBuffer, and the last frame's samples while they are carried over
+    ReprojectionCache reprojection;
+    RGBAFloatImage previousHdr;
+    SampleStatistics previousStatistics;
+    // Pixels of the frame have different sample counts, so they are developed with their own
+    bool unevenSamples;
+    // Whether camera rays record the first hit of each pixel in reprojection, and
+    // whether a pixel then starts from the last frame's samples. Set up with the frame.
+    bool recordingHits, carryingOver;
+    // Records the hits of the packet's pixels no ray went through yet this frame,
+    // and carries their samples over from the last frame when they have any
+    template <unsigned Features> void RecordFirstHits(const RayPacket& packet, Scene::CollisionInfo* hits, int pixelX, int pixelY, int count, int stride);
+    // Records of the diffuse light between surfaces, for the frame being rendered
+    IrradianceCache irradianceCache;
+    // Caustic photons of the current sweep, aimed at the sphere around the surfaces that reflect
+    // or refract in this frame (none if causticReach is 0), and the first sweep's gather radius
+    PhotonMap photonMap;
+    Cartesian3 causticCentre;
+    float causticReach, photonRadius;
+    // Sample number photonMap was shot for, -1 before the first
+    int photonSample;
+    // Sets up causticCentre, causticReach and photonRadius for the prepared frame
+    void AimPhotons();
+    // Centre of the focus, the middle of the frame until setFocus() is called
+    std::atomic<int> focusX, focusY;
+    // The rectangle around the focus, clipped to the frame, ends exclusive
+    void FocusRegion(int& x0, int& y0, int& x1, int& y1) const;
+    // The preview's samples, one for each pixel at even coordinates, and them developed
+    RGBAFloatImage previewImage;
+    RGBAImage previewFrame;
+    // Runs the render loop on a thread of its own
+    void Start();
+    void PlaceThreads();
 
 	std::atomic<bool> raytracingRunning;
 	std::atomic<bool> restartRaytrace;
@@ -0,0 +1,160 @@
+#include "RenderCoordinator.h"
+#include "RenderJob.h"
+#include <algorithm>
+#include <iostream>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+RenderCoordinator::RenderCoordinator() :
+    tileSeconds(DISTRIBUTED_TILE_SECONDS),
+    width(0),
+    height(0)
+{
+}
+
+bool RenderCoordinator::dispatch(Worker& worker)
+{
+    while (!queue.empty() && worker.tiles.size() < DISTRIBUTED_TILES_IN_FLIGHT) {
+        int firstRow = queue.front();
+        MessageWriter tile;
+        tile.put(int32_t(firstRow));
+        tile.put(int32_t(std::min(long(DISTRIBUTED_TILE_ROWS), height - firstRow)));
+        // A tile behind another only starts once that one is done, its clock is restarted then
+        Clock::time_point deadline = Clock::now() + std::chrono::seconds(tileSeconds);
+        if (!worker.tiles.empty())
+            deadline = std::max(deadline, worker.tiles.back().deadline + std::chrono::seconds(tileSeconds));
+        // The tile counts as the worker's even if the send fails, so it is queued again with the rest
+        queue.pop_front();
+        worker.tiles.push_back({ firstRow, deadline });
+        if (!worker.connection->send(renderTile, tile.bytes))
+            return false;
+    }
+    return true;
+}
+
+void RenderCoordinator::requeue(Worker& worker)
+{
+    for (size_t t = worker.tiles.size(); t-- > 0; )
+        queue.push_front(worker.tiles[t].firstRow);
+    worker.tiles.clear();
+}
+
+bool RenderCoordinator::run(const std::string& address, const std::vector<char>& job, long width, long height)
+{
+#ifndef _WIN32
+    this->width = width;
+    this->height = height;
+    std::unique_ptr<Connection> listener = Connection::Listen(address);
+    if (!listener) {
+        std::cout << "Could not listen on " << address << std::endl;
+        return false;
+    }
+
+    queue.clear();
+    for (long row = 0; row < height; row += DISTRIBUTED_TILE_ROWS)
+        queue.push_back(int(row));
+    long remaining = long(queue.size());
+    std::vector<Worker> workers;
+    std::cout << "Waiting for workers on " << address << ", " << remaining << " tiles to render" << std::endl;
+
+    while (remaining > 0) {
+        // The listener first, then one entry per worker in the same order
+        std::vector<pollfd> waiting(1 + workers.size());
+        waiting[0] = { listener->descriptor(), POLLIN, 0 };
+        for (size_t w = 0; w < workers.size(); w++)
+            waiting[w + 1] = { workers[w].connection->descriptor(), POLLIN, 0 };
+        // Wakes up by the earliest deadline even if nothing arrives
+        int timeout = -1;
+        Clock::time_point now = Clock::now();
+        for (const Worker& worker : workers)
+            if (!worker.tiles.empty()) {
+                long long left = std::chrono::duration_cast<std::chrono::milliseconds>(worker.tiles.front().deadline - now).count() + 1;
+                left = std::clamp(left, 0LL, 60000LL);
+                timeout = timeout < 0 ? int(left) : std::min(timeout, int(left));
+            }
+        if (poll(waiting.data(), nfds_t(waiting.size()), timeout) < 0)
+            continue;
+
+        std::vector<bool> lost(workers.size(), false);
+        for (size_t w = 0; w < workers.size(); w++) {
+            if (!(waiting[w + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            Worker& worker = workers[w];
+            uint32_t type;
+            std::vector<char> payload;
+            if (!worker.connection->receive(type, payload)) {
+                lost[w] = true;
+                continue;
+            }
+            if (type == renderFailed) {
+                std::cout << "Worker gave up: " << std::string(payload.begin(), payload.end()) << std::endl;
+                lost[w] = true;
+                continue;
+            }
+
+            MessageReader reader(payload);
+            int firstRow = reader.get<int32_t>(), rows = reader.get<int32_t>();
+            std::deque<Tile>::iterator tile = std::find_if(worker.tiles.begin(), worker.tiles.end(), [&](const Tile& t) { return t.firstRow == firstRow; });
+            size_t expected = size_t(rows) * size_t(width) * 3 * sizeof(float);
+            if (type != renderResult || !reader.ok || tile == worker.tiles.end() ||
+                rows != std::min(long(DISTRIBUTED_TILE_ROWS), height - firstRow) || reader.remaining() != expected) {
+                std::cout << "Dropping a worker that sent a malformed result" << std::endl;
+                lost[w] = true;
+                continue;
+            }
+            worker.tiles.erase(tile);
+            // The next tile only had its turn now, however long it was queued behind this one
+            if (!worker.tiles.empty())
+                worker.tiles.front().deadline = std::max(worker.tiles.front().deadline, Clock::now() + std::chrono::seconds(tileSeconds));
+            remaining--;
+            if (tileFinished)
+                tileFinished(firstRow, rows, reinterpret_cast<const float*>(reader.rest()));
+            if (!dispatch(worker))
+                lost[w] = true;
+        }
+
+        // A worker that sent nothing by its oldest tile's deadline is given up on, its
+        // tiles going to the others. Anything it sends later arrives on a closed socket.
+        now = Clock::now();
+        for (size_t w = 0; w < workers.size(); w++)
+            if (!lost[w] && !workers[w].tiles.empty() && workers[w].tiles.front().deadline <= now) {
+                std::cout << "Worker took over " << tileSeconds << " s on a tile" << std::endl;
+                lost[w] = true;
+            }
+
+        // Tiles of lost workers go to the ones still here, or to whoever connects next
+        for (size_t w = workers.size(); w-- > 0; ) {
+            if (!lost[w])
+                continue;
+            std::cout << "Lost a worker, " << workers[w].tiles.size() << " of its tiles queued again" << std::endl;
+            requeue(workers[w]);
+            workers.erase(workers.begin() + long(w));
+        }
+        for (Worker& worker : workers)
+            if (worker.tiles.empty())
+                dispatch(worker);
+
+        if (waiting[0].revents & POLLIN) {
+            Worker worker;
+            worker.connection = listener->accept();
+            if (worker.connection && worker.connection->send(renderJob, job) && dispatch(worker)) {
+                workers.push_back(std::move(worker));
+                std::cout << "Worker joined, " << workers.size() << " connected" << std::endl;
+            }
+            else if (worker.connection) {
+                requeue(worker);
+            }
+        }
+    }
+
+    for (Worker& worker : workers)
+        worker.connection->send(renderDone, std::vector<char>());
+    return true;
+#else
+    (void)job;
+    std::cout << "Distributed rendering needs POSIX sockets, could not listen on " << address << std::endl;
+    return false;
+#endif
+}
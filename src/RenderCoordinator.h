@@ -0,0 +1,62 @@
+#ifndef RENDER_COORDINATOR_H
+#define RENDER_COORDINATOR_H
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Connection.h"
+
+// Rows in each tile handed out, a multiple of STREAM_ROWS keeps the workers' bands full
+#define DISTRIBUTED_TILE_ROWS 32
+// Tiles a worker holds at once, so it can start the next while its last result is in transit
+#define DISTRIBUTED_TILES_IN_FLIGHT 2
+// Default seconds a worker may spend on a tile before it counts as lost
+#define DISTRIBUTED_TILE_SECONDS 600
+
+// Splits a frame into tiles of rows and farms them out to RenderWorker
+// processes connecting on a socket. Workers are given a new tile as soon as
+// they return one, so faster machines take more of the frame. A worker that
+// disconnects or stalls has its unfinished tiles queued again for the others,
+// and so does one that takes longer than tileSeconds over a tile, since a
+// process that was stopped or cut off without a reset may never be heard from.
+class RenderCoordinator
+{
+public:
+    // Called as each tile comes back, with rows * width averaged linear RGB triples
+    std::function<void(int firstRow, int rows, const float* rgb)> tileFinished;
+    // Seconds a worker has for each tile, counted from when it can start on it
+    int tileSeconds;
+
+    RenderCoordinator();
+
+    // Listens on address, sends job (a renderJob payload) to every worker that
+    // connects and returns once every row of the width x height frame is back.
+    // false if the address could not be listened on.
+    bool run(const std::string& address, const std::vector<char>& job, long width, long height);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct Tile {
+        int firstRow;
+        // When the worker counts as lost if the tile is not back
+        Clock::time_point deadline;
+    };
+    struct Worker {
+        std::unique_ptr<Connection> connection;
+        // Tiles it was sent and has not returned, oldest first
+        std::deque<Tile> tiles;
+    };
+
+    // Sends tiles from the queue until the worker has its share, false if it has gone
+    bool dispatch(Worker& worker);
+    // Queues a lost worker's tiles again at the front, they are the oldest
+    void requeue(Worker& worker);
+
+    long width, height;
+    std::deque<int> queue;
+};
+
+#endif // RENDER_COORDINATOR_H
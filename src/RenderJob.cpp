@@ -0,0 +1,156 @@
+#include "RenderJob.h"
+#include "Connection.h"
+#include <filesystem>
+#include <fstream>
+
+uint64_t RenderJob::HashFile(const std::string& path)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.good())
+        return 0;
+    uint64_t hash = FNV_OFFSET_BASIS;
+    std::vector<char> chunk(1 << 16);
+    while (file.read(chunk.data(), std::streamsize(chunk.size())) || file.gcount() > 0)
+        hash = Hash(chunk.data(), size_t(file.gcount()), hash);
+    return hash;
+}
+
+uint64_t RenderJob::Hash(const char* data, size_t size, uint64_t hash)
+{
+    for (size_t i = 0; i < size; i++) {
+        hash ^= uint64_t(static_cast<unsigned char>(data[i]));
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+RenderJob RenderJob::For(const std::string& geometryPath, const std::string& materialPath, long width, long height)
+{
+    RenderJob job;
+    std::error_code error;
+    job.geometryPath = std::filesystem::absolute(geometryPath, error).string();
+    job.materialPath = std::filesystem::absolute(materialPath, error).string();
+    job.geometryHash = HashFile(geometryPath);
+    job.materialHash = HashFile(materialPath);
+    job.width = width;
+    job.height = height;
+    return job;
+}
+
+static void PutQuaternion(MessageWriter& writer, const Quaternion& quaternion)
+{
+    writer.put(quaternion.coords.x);
+    writer.put(quaternion.coords.y);
+    writer.put(quaternion.coords.z);
+    writer.put(quaternion.coords.w);
+}
+
+static Quaternion GetQuaternion(MessageReader& reader)
+{
+    float x = reader.get<float>(), y = reader.get<float>(), z = reader.get<float>(), w = reader.get<float>();
+    return Quaternion(x, y, z, w);
+}
+
+static void PutVector(MessageWriter& writer, const Cartesian3& vector)
+{
+    writer.put(vector.x);
+    writer.put(vector.y);
+    writer.put(vector.z);
+}
+
+static Cartesian3 GetVector(MessageReader& reader)
+{
+    float x = reader.get<float>(), y = reader.get<float>(), z = reader.get<float>();
+    return Cartesian3(x, y, z);
+}
+
+// The parameters that decide what every pixel converges to, the lights come from the scene files
+static void PutFrame(MessageWriter& writer, const RenderParameters& parameters)
+{
+    bool flags[] = { parameters.interpolationRendering, parameters.phongEnabled, parameters.fresnelRendering,
+                     parameters.shadowsEnabled, parameters.reflectionEnabled, parameters.refractionEnabled,
+                     parameters.monteCarloEnabled, parameters.centreObject, parameters.orthoProjection, parameters.fastBVHBuild,
+                     parameters.irradianceCaching, parameters.caustics };
+    for (bool flag : flags)
+        writer.put(uint8_t(flag));
+    PutVector(writer, parameters.ModelPosition);
+    PutQuaternion(writer, parameters.ModelArcball.baseRotation);
+    PutQuaternion(writer, parameters.ModelArcball.currentRotation);
+    PutVector(writer, parameters.CameraPosition);
+    PutQuaternion(writer, parameters.CameraArcball.baseRotation);
+    PutQuaternion(writer, parameters.CameraArcball.currentRotation);
+    writer.put(parameters.fov);
+    writer.put(parameters.near);
+    writer.put(parameters.far);
+}
+
+static void GetFrame(MessageReader& reader, RenderParameters& parameters)
+{
+    bool* flags[] = { &parameters.interpolationRendering, &parameters.phongEnabled, &parameters.fresnelRendering,
+                      &parameters.shadowsEnabled, &parameters.reflectionEnabled, &parameters.refractionEnabled,
+                      &parameters.monteCarloEnabled, &parameters.centreObject, &parameters.orthoProjection, &parameters.fastBVHBuild,
+                      &parameters.irradianceCaching, &parameters.caustics };
+    for (bool* flag : flags)
+        *flag = reader.get<uint8_t>() != 0;
+    parameters.ModelPosition = GetVector(reader);
+    parameters.ModelArcball.baseRotation = GetQuaternion(reader);
+    parameters.ModelArcball.currentRotation = GetQuaternion(reader);
+    parameters.CameraPosition = GetVector(reader);
+    parameters.CameraArcball.baseRotation = GetQuaternion(reader);
+    parameters.CameraArcball.currentRotation = GetQuaternion(reader);
+    parameters.fov = reader.get<float>();
+    parameters.near = reader.get<float>();
+    parameters.far = reader.get<float>();
+}
+
+std::vector<char> RenderJob::serialize(const RenderParameters& parameters) const
+{
+    MessageWriter writer;
+    writer.put(uint32_t(RENDER_JOB_MAGIC));
+    writer.put(geometryPath);
+    writer.put(materialPath);
+    writer.put(geometryHash);
+    writer.put(materialHash);
+    writer.put(int64_t(width));
+    writer.put(int64_t(height));
+    PutFrame(writer, parameters);
+    writer.put(parameters.exposure);
+    writer.put(int32_t(parameters.toneMap));
+    writer.put(int32_t(parameters.monteCarloPasses));
+    writer.put(uint32_t(parameters.seed));
+    writer.put(int32_t(parameters.photonsPerPass));
+    return writer.bytes;
+}
+
+bool RenderJob::Deserialize(const std::vector<char>& payload, RenderJob& job, RenderParameters& parameters)
+{
+    MessageReader reader(payload);
+    if (reader.get<uint32_t>() != RENDER_JOB_MAGIC)
+        return false;
+    job.geometryPath = reader.getString();
+    job.materialPath = reader.getString();
+    job.geometryHash = reader.get<uint64_t>();
+    job.materialHash = reader.get<uint64_t>();
+    job.width = long(reader.get<int64_t>());
+    job.height = long(reader.get<int64_t>());
+    GetFrame(reader, parameters);
+    parameters.exposure = reader.get<float>();
+    parameters.toneMap = RenderParameters::ToneMap(reader.get<int32_t>());
+    parameters.monteCarloPasses = reader.get<int32_t>();
+    parameters.seed = reader.get<uint32_t>();
+    parameters.photonsPerPass = reader.get<int32_t>();
+    // Bytes left over mean the coordinator wrote a layout this worker does not know
+    return reader.ok && reader.remaining() == 0 && job.width > 0 && job.height > 0;
+}
+
+uint64_t RenderJob::fingerprint(const RenderParameters& parameters) const
+{
+    // Paths may differ between machines, the contents may not
+    MessageWriter writer;
+    writer.put(geometryHash);
+    writer.put(materialHash);
+    writer.put(int64_t(width));
+    writer.put(int64_t(height));
+    PutFrame(writer, parameters);
+    return Hash(writer.bytes.data(), writer.bytes.size());
+}
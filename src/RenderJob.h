@@ -0,0 +1,49 @@
+#ifndef RENDER_JOB_H
+#define RENDER_JOB_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "RenderParameters.h"
+
+// First value of every job, a worker built from other sources or with the
+// other byte order refuses the job rather than misreading it. "RTJ" and a
+// version, to be counted up whenever the payload's layout changes.
+#define RENDER_JOB_MAGIC 0x52544a32u
+
+// Starting value of the 64 bit FNV-1a hash
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+
+// Messages between a RenderCoordinator and its RenderWorkers
+enum RenderMessage{renderJob = 1, renderTile, renderResult, renderDone, renderFailed};
+
+// The frame a coordinator hands to its workers. The scene is sent as a
+// reference, every worker reads the files itself and checks their hashes so
+// a stale copy on one machine cannot end up in the picture. The render
+// parameters travel with the job, the worker's own defaults never count.
+struct RenderJob
+{
+    std::string geometryPath, materialPath;
+    uint64_t geometryHash, materialHash;
+    long width, height;
+
+    // FNV-1a of a file's contents, 0 if it cannot be read
+    static uint64_t HashFile(const std::string& path);
+    // FNV-1a of size bytes, continuing from hash
+    static uint64_t Hash(const char* data, size_t size, uint64_t hash = FNV_OFFSET_BASIS);
+
+    // The job for a frame of the given files, paths are made absolute for workers started elsewhere
+    static RenderJob For(const std::string& geometryPath, const std::string& materialPath, long width, long height);
+
+    // The job and the settings a worker needs, as a renderJob payload
+    std::vector<char> serialize(const RenderParameters& parameters) const;
+    // Reads a renderJob payload back, false if it is not one
+    static bool Deserialize(const std::vector<char>& payload, RenderJob& job, RenderParameters& parameters);
+
+    // Identifies the image a render converges to: the scene contents, the size and every setting
+    // that changes a pixel's expected value. Passes, seed, exposure and tonemap are left out,
+    // so checkpoints of runs that differ only in those can be merged.
+    uint64_t fingerprint(const RenderParameters& parameters) const;
+};
+
+#endif // RENDER_JOB_H
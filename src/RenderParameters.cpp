@@ -1,9 +1,9 @@
 #include "RenderParameters.h"
 using namespace std;
 
-void RenderParameters::findLights(std::vector<ThreeDModel> objects)
+void RenderParameters::findLights(const std::vector<ThreeDModel>& objects)
 {
-    for(ThreeDModel obj: objects)
+    for(const ThreeDModel& obj: objects)
     {
         //find objects that have a "light" material
         if(obj.material->isLight())
@@ -158,6 +158,16 @@ void RenderParameters::printSettings()
     cout << "Fresnel " << fresnelRendering << endl;
     cout << "monteCarloEnabled " << monteCarloEnabled << endl;
     cout << "Ortho " << orthoProjection << endl;
+    cout << "Fast BVH build " << fastBVHBuild << endl;
+    cout << "Irradiance caching " << irradianceCaching << endl;
+    cout << "Caustics " << caustics << " photons per pass " << photonsPerPass << endl;
+    cout << "Temporal reuse " << temporalReuse << " progressive preview " << progressivePreview << endl;
+    static const char* focusNames[] = {"everywhere", "around the cursor", "only around the cursor"};
+    cout << "Focus " << focusNames[focus] << " size " << focusSize << endl;
+    static const char* toneMapNames[] = {"none", "Reinhard", "ACES"};
+    cout << "Exposure " << exposure << " tonemap " << toneMapNames[toneMap] << endl;
+    cout << "Passes " << monteCarloPasses << " seed " << seed << endl;
+    cout << "Threads " << threads << " NUMA nodes " << numaNodes << " pinned " << pinThreads << " replicated " << replicateScene << endl;
 }
 
 Matrix4 RenderParameters::getProjectionMatrix(float window_w, float window_h) 
@@ -27,6 +27,10 @@ class RenderParameters
     { // class RenderParameters
     public:
 
+    // curves the post-process can map HDR colours to the display with
+    enum ToneMap{none, reinhard, aces};
+    // where a render spends its samples: evenly, more of them around the focus, or only there
+    enum Focus{everywhere, around, only};
 
     // we store x & y translations
 
@@ -45,7 +49,36 @@ class RenderParameters
     bool monteCarloEnabled;
     bool centreObject;
     bool orthoProjection;
-
+    bool fastBVHBuild;
+    // Monte Carlo renders look the diffuse light bounced onto surfaces up in an irradiance cache
+    bool irradianceCaching;
+    // Shoot photons from the lights each pass so light focused by mirrors and glass shows up
+    bool caustics;
+
+    // exposure in stops and the curve applied before sRGB encoding
+    float exposure;
+    ToneMap toneMap;
+    // number of progressive passes accumulated when Monte Carlo is enabled
+    int monteCarloPasses;
+    // caustic photons shot from the lights for each pass
+    int photonsPerPass;
+    // Monte Carlo samples are drawn from this seed, runs that will be merged need different ones
+    unsigned seed;
+    // Render threads, 0 for one per CPU of the NUMA nodes in use
+    int threads;
+    // NUMA nodes the render threads are spread over, 0 for all of them
+    int numaNodes;
+    // Keep each render thread on one CPU, so the memory it touches first stays on its node
+    bool pinThreads;
+    // Give each NUMA node its own copy of the triangles and BVH, only used with pinned threads
+    bool replicateScene;
+    // Keep the samples of pixels that still see the same surface when the camera moves
+    bool temporalReuse;
+    // Show a render's first pass coarse to fine, from one sample per 8x8 block down to every pixel
+    bool progressivePreview;
+    // How renders favour the square of focusSize pixels around the focus the viewer sets
+    Focus focus;
+    int focusSize;
     
     Cartesian3 ModelPosition;
     ArcBall ModelArcball;
@@ -61,7 +94,7 @@ class RenderParameters
     Matrix4 getProjectionMatrix(float window_w, float window_h);
 
     void computeMatricesFromInputs(float deltaTime, std::byte movementKeys);
-    void findLights(std::vector<ThreeDModel> objects);
+    void findLights(const std::vector<ThreeDModel>& objects);
     void printSettings();
     
 
@@ -79,6 +112,22 @@ class RenderParameters
         monteCarloEnabled(false),
         centreObject(false),
         orthoProjection(false),
+        fastBVHBuild(false),
+        irradianceCaching(false),
+        caustics(false),
+        exposure(0.0f),
+        toneMap(none),
+        monteCarloPasses(600),
+        photonsPerPass(100000),
+        seed(0),
+        threads(0),
+        numaNodes(0),
+        pinThreads(false),
+        replicateScene(false),
+        temporalReuse(false),
+        progressivePreview(false),
+        focus(everywhere),
+        focusSize(128),
         speed (0.01f),
         near(0.1f),
         far(500),
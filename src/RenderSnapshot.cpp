@@ -0,0 +1,85 @@
+#include "RenderSnapshot.h"
+#include <algorithm>
+#include "SampleStatistics.h"
+#include "Topology.h"
+
+RenderSnapshot::RenderSnapshot(RenderParameters& parameters, const Matrix4& modelview, int width, int height):
+    modelview(modelview),
+    width(width),
+    height(height)
+{
+    features = (parameters.interpolationRendering ? FEATURE_INTERPOLATION : 0)
+             | (parameters.phongEnabled ? FEATURE_PHONG : 0)
+             | (parameters.shadowsEnabled ? FEATURE_SHADOWS : 0)
+             | (parameters.reflectionEnabled ? FEATURE_REFLECTION : 0)
+             | (parameters.refractionEnabled ? FEATURE_REFRACTION : 0)
+             | (parameters.fresnelRendering ? FEATURE_FRESNEL : 0)
+             | (parameters.monteCarloEnabled ? FEATURE_MONTE_CARLO : 0)
+             | (parameters.orthoProjection ? FEATURE_ORTHO : 0);
+
+    tanHalfFov = std::tan(parameters.fov / 2);
+    aspect = (float)width / (float)height;
+    camera = Camera(width, height, tanHalfFov, parameters.orthoProjection);
+
+    exposure = parameters.exposure;
+    toneMap = parameters.toneMap;
+    // Without Monte Carlo every pass would trace the same image
+    passes = parameters.monteCarloEnabled ? std::max(parameters.monteCarloPasses, 1) : 1;
+    seed = parameters.seed;
+    irradianceCaching = parameters.irradianceCaching;
+    caustics = parameters.caustics;
+    photonsPerPass = std::max(parameters.photonsPerPass, 1);
+    preview = parameters.progressivePreview;
+    focus = parameters.focus;
+    focusSize = std::max(parameters.focusSize, 1);
+    numaNodes = Topology::System().nodesInUse(parameters.numaNodes);
+    threads = Topology::System().threadCount(parameters.threads, numaNodes);
+    pinThreads = parameters.pinThreads;
+
+    // The modelview is linear on homogeneous coordinates, so transforming the
+    // centre and offsets once gives the same samples as transforming every sample
+    lights.reserve(parameters.lights.size());
+    for (Light* l : parameters.lights) {
+        SnapshotLight light;
+        light.type = l->GetType();
+        light.colour = l->GetColor();
+        light.centre = modelview * l->GetPositionCenter();
+        light.tangent1 = modelview * l->GetTangent1();
+        light.tangent2 = modelview * l->GetTangent2();
+        light.axes[0] = modelview * Homogeneous4(1.0f, 0.0f, 0.0f, 0.0f);
+        light.axes[1] = modelview * Homogeneous4(0.0f, 1.0f, 0.0f, 0.0f);
+        light.axes[2] = modelview * Homogeneous4(0.0f, 0.0f, 1.0f, 0.0f);
+        light.direction = modelview * l->GetDirection();
+        lights.push_back(light);
+    }
+
+    // Directional lights have no place to be bounded, a scene with any shades every light
+    bool bounded = std::none_of(lights.begin(), lights.end(), [](const SnapshotLight& l) { return l.type == Light::Directional; });
+    if ((features & FEATURE_MONTE_CARLO) && bounded && lights.size() > LIGHT_TREE_MIN_LIGHTS) {
+        std::vector<LightTree::Emitter> emitters(lights.size());
+        for (size_t i = 0; i < lights.size(); i++) {
+            const SnapshotLight& l = lights[i];
+            LightTree::Emitter& emitter = emitters[i];
+            emitter.bounds.grow(l.centre.Point());
+            if (l.type == Light::Area) {
+                // The corners of the light's rectangle. The tangents are stored as points,
+                // so they are offset in model space before the modelview is applied.
+                Light* source = parameters.lights[i];
+                for (float u : { -0.5f, 0.5f })
+                    for (float v : { -0.5f, 0.5f })
+                        emitter.bounds.grow(modelview * (source->GetPositionCenter().Point() + u * source->GetTangent1().Point() + v * source->GetTangent2().Point()));
+            }
+            else {
+                // Point lights are jittered within 0.01 model units of their centre
+                float radius = 0.0f;
+                for (int axis = 0; axis < 3; axis++)
+                    radius = std::max(radius, 0.01f * l.axes[axis].Vector().length());
+                emitter.bounds.grow(l.centre.Point() + Cartesian3(radius, radius, radius));
+                emitter.bounds.grow(l.centre.Point() - Cartesian3(radius, radius, radius));
+            }
+            emitter.power = SampleStatistics::Luminance(l.colour.x, l.colour.y, l.colour.z);
+            emitter.light = int(i);
+        }
+        lightTree.build(emitters);
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef RENDER_SNAPSHOT_H
+#define RENDER_SNAPSHOT_H
+
+#include <vector>
+#include <cmath>
+#include "Homogeneous4.h"
+#include "Matrix4.h"
+#include "Light.h"
+#include "RenderParameters.h"
+#include "Camera.h"
+#include "LightTree.h"
+
+// Shading features a render kernel is compiled for, one bit per RenderParameters toggle
+#define FEATURE_INTERPOLATION 1
+#define FEATURE_PHONG 2
+#define FEATURE_SHADOWS 4
+#define FEATURE_REFLECTION 8
+#define FEATURE_REFRACTION 16
+#define FEATURE_FRESNEL 32
+#define FEATURE_MONTE_CARLO 64
+#define FEATURE_ORTHO 128
+#define FEATURE_COMBINATIONS 256
+
+// Everything a render reads from RenderParameters, copied once by Raytrace()
+// before the render thread starts. The GL thread keeps changing the live
+// parameters from its callbacks, the workers only ever see this read-only copy.
+struct alignas(64) RenderSnapshot
+{
+    // A light already transformed to view space
+    struct alignas(64) SnapshotLight {
+        Light::LightType type;
+        Homogeneous4 colour;
+        // View space position of the light's centre
+        Homogeneous4 centre;
+        // Area lights: the view space edges positions are spread along
+        Homogeneous4 tangent1;
+        Homogeneous4 tangent2;
+        // Point lights: view space images of the model axes, for jittering the centre
+        Homogeneous4 axes[3];
+        // Directional lights: the view space direction
+        Homogeneous4 direction;
+
+        // Same distribution as Light::GetPosition(), but in view space.
+        // random() is called for each uniform [0, 1) number needed.
+        template <typename Random>
+        Homogeneous4 sample(Random&& random) const {
+            if (type == Light::Directional)
+                return direction;
+            if (type == Light::Area) {
+                float u = -0.5f + random();
+                float v = -0.5f + random();
+                return centre + u * tangent1 + v * tangent2;
+            }
+            float pi = float(2 * acos(0.0));
+            float theta = (pi * 2.0f) * random();
+            float phi = (pi * 2.0f) * random();
+            float r = 0.01f * random();
+            return centre + (r * cos(phi) * sin(theta)) * axes[0] + (r * sin(phi) * sin(theta)) * axes[1] + (r * cos(theta)) * axes[2];
+        }
+    };
+
+    // FEATURE_ bits of the toggles that were on
+    unsigned features;
+    Matrix4 modelview;
+    // Rays are generated in view space, where the camera sits at the origin looking
+    // down +z, so the field of view and aspect ratio are all the camera basis needs
+    float tanHalfFov;
+    float aspect;
+    int width;
+    int height;
+    Camera camera;
+    std::vector<SnapshotLight> lights;
+    // Over the lights when Monte Carlo shading picks a few of many, empty when every light is shaded
+    LightTree lightTree;
+    // Post-process settings the bands are developed with as they finish
+    float exposure;
+    RenderParameters::ToneMap toneMap;
+    // Progressive passes accumulated into the HDR framebuffer
+    int passes;
+    unsigned seed;
+    // Camera ray hits take their diffuse indirect light from the irradiance cache
+    bool irradianceCaching;
+    // Each sweep shoots photonsPerPass caustic photons from the lights
+    bool caustics;
+    int photonsPerPass;
+    // Trace the first pass coarse to fine so the whole frame shows early
+    bool preview;
+    // Where samples are spent and the side of the square around the focus
+    RenderParameters::Focus focus;
+    int focusSize;
+    // Worker threads, resolved against the machine's topology, and the NUMA nodes they run on
+    int threads;
+    int numaNodes;
+    bool pinThreads;
+
+    RenderSnapshot(RenderParameters& parameters, const Matrix4& modelview, int width, int height);
+};
+
+#endif // RENDER_SNAPSHOT_H
@@ -0,0 +1,79 @@
+#include "RenderWorker.h"
+#include "RenderJob.h"
+#include "Connection.h"
+#include "Raytracer.h"
+#include "TextureCache.h"
+#include <fstream>
+#include <iostream>
+
+// Tells the coordinator why this worker is leaving, it hands the tiles to someone else
+static int Fail(Connection& connection, const std::string& reason)
+{
+    std::cout << reason << std::endl;
+    connection.send(renderFailed, std::vector<char>(reason.begin(), reason.end()));
+    return 1;
+}
+
+int RenderWorker::run(const std::string& address, const RenderParameters& machine)
+{
+    std::unique_ptr<Connection> connection = Connection::Connect(address, WORKER_CONNECT_SECONDS);
+    if (!connection) {
+        std::cout << "Could not connect to " << address << std::endl;
+        return 1;
+    }
+
+    uint32_t type;
+    std::vector<char> payload;
+    RenderJob job;
+    RenderParameters parameters;
+    if (!connection->receive(type, payload) || type != renderJob || !RenderJob::Deserialize(payload, job, parameters))
+        return Fail(*connection, "Did not receive a job this worker understands");
+    // How many threads run and where is up to each worker's own machine
+    parameters.threads = machine.threads;
+    parameters.numaNodes = machine.numaNodes;
+    parameters.pinThreads = machine.pinThreads;
+    parameters.replicateScene = machine.replicateScene;
+
+    // The files are read here, so they must be the ones the coordinator has
+    if (RenderJob::HashFile(job.geometryPath) != job.geometryHash || RenderJob::HashFile(job.materialPath) != job.materialHash)
+        return Fail(*connection, "Scene files " + job.geometryPath + " and " + job.materialPath + " differ from the coordinator's");
+    std::ifstream geometryFile(job.geometryPath);
+    std::ifstream materialFile(job.materialPath);
+    std::vector<ThreeDModel> objects = ThreeDModel::ReadObjectStreamMaterial(geometryFile, materialFile);
+    if (objects.empty())
+        return Fail(*connection, "Read failed for object " + job.geometryPath + " or material " + job.materialPath);
+    parameters.findLights(objects);
+
+    Raytracer raytracer(&objects, &parameters);
+    if (!raytracer.resize(int(job.width), int(job.height)))
+        return Fail(*connection, "Could not allocate a " + std::to_string(job.width) + "x" + std::to_string(job.height) + " framebuffer");
+    raytracer.Prepare();
+    std::cout << "Rendering tiles of " << job.geometryPath << " for " << address << std::endl;
+
+    std::vector<float> packed;
+    int tiles = 0;
+    while (connection->receive(type, payload) && type == renderTile) {
+        MessageReader reader(payload);
+        int firstRow = reader.get<int32_t>(), rows = reader.get<int32_t>();
+        if (!reader.ok || firstRow < 0 || rows < 1 || firstRow + rows > job.height)
+            return Fail(*connection, "Received a tile outside the frame");
+        raytracer.RaytraceRows(firstRow, rows);
+
+        long first = long(firstRow) * job.width, count = long(rows) * job.width;
+        packed.resize(size_t(count) * 3);
+        raytracer.hdrBuffer.PackRGB(first, count, raytracer.AverageScale(), packed.data());
+        MessageWriter result;
+        result.put(int32_t(firstRow));
+        result.put(int32_t(rows));
+        result.bytes.insert(result.bytes.end(), reinterpret_cast<const char*>(packed.data()),
+                            reinterpret_cast<const char*>(packed.data() + packed.size()));
+        if (!connection->send(renderResult, result.bytes))
+            break;
+        tiles++;
+    }
+
+    std::cout << "Rendered " << tiles << " tiles" << std::endl;
+    if (TextureCache::instance().stats().textures > 0)
+        TextureCache::instance().printStats();
+    return 0;
+}
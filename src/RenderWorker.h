@@ -0,0 +1,21 @@
+#ifndef RENDER_WORKER_H
+#define RENDER_WORKER_H
+
+#include "RenderParameters.h"
+#include <string>
+
+// Seconds a worker keeps trying to reach a coordinator that is not listening yet
+#define WORKER_CONNECT_SECONDS 30
+
+// The other end of a RenderCoordinator. A worker connects, loads the scene
+// the job names, and renders tiles of rows until the coordinator says the
+// frame is done or goes away.
+class RenderWorker
+{
+public:
+    // Serves the coordinator at address, returns the process exit code. The
+    // threads and NUMA placement set in machine replace the coordinator's.
+    static int run(const std::string& address, const RenderParameters& machine);
+};
+
+#endif // RENDER_WORKER_H
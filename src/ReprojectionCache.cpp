@@ -0,0 +1,65 @@
+#include "ReprojectionCache.h"
+#include <cmath>
+#include <utility>
+
+ReprojectionCache::ReprojectionCache() :
+    width(0),
+    height(0),
+    features(0),
+    tanHalfFov(0.0f),
+    recorded(false),
+    havePrevious(false)
+{
+}
+
+void ReprojectionCache::begin(const RenderSnapshot& frame)
+{
+    havePrevious = recorded && frame.width == width && frame.height == height && frame.features == features && frame.tanHalfFov == tanHalfFov;
+    if (havePrevious) {
+        std::swap(hits, previousHits);
+        toPrevious = modelview * frame.modelview.invert();
+    }
+    previousCamera = frame.camera;
+
+    width = frame.width;
+    height = frame.height;
+    features = frame.features;
+    tanHalfFov = frame.tanHalfFov;
+    modelview = frame.modelview;
+    Hit unseen;
+    unseen.material = Hit::unseen;
+    hits.assign(size_t(width) * size_t(height), unseen);
+    recorded = true;
+}
+
+void ReprojectionCache::invalidate()
+{
+    recorded = havePrevious = false;
+}
+
+long ReprojectionCache::previousPixel(long pixel) const
+{
+    const Hit& hit = hits[pixel];
+    if (!havePrevious || hit.material < 0)
+        return -1;
+
+    // The camera is the same, only the modelview changed
+    Cartesian3 position = toPrevious * hit.position;
+    Cartesian3 normal = (toPrevious * Homogeneous4(hit.normal.x, hit.normal.y, hit.normal.z, 0.0f)).Vector();
+    float x, y;
+    if (!previousCamera.project(position, x, y))
+        return -1;
+    long i = long(std::floor(x)), j = long(std::floor(y));
+    if (i < 0 || i >= width || j < 0 || j >= height)
+        return -1;
+
+    long source = j * width + i;
+    const Hit& old = previousHits[source];
+    if (old.material != hit.material || old.normal.dot(normal) < REPROJECTION_NORMAL_COSINE)
+        return -1;
+    // Measured along the normal, neighbouring points of one flat surface are all at distance 0
+    // while something that was in front of the point or behind it is not
+    if (std::abs(old.normal.dot(position - old.position)) > REPROJECTION_DEPTH_TOLERANCE * position.length())
+        return -1;
+    return source;
+}
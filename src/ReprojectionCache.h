@@ -0,0 +1,66 @@
+#ifndef REPROJECTION_CACHE_H
+#define REPROJECTION_CACHE_H
+
+#include <vector>
+#include "Cartesian3.h"
+#include "Matrix4.h"
+#include "Camera.h"
+#include "RenderSnapshot.h"
+
+// Samples a pixel may bring over from the last frame, older ones are scaled
+// away so view dependent highlights still follow the camera
+#define REPROJECTION_MAX_SAMPLES 64.0f
+// How far off the last frame's surface a point may be, as a fraction of its distance from the camera
+#define REPROJECTION_DEPTH_TOLERANCE 0.01f
+// Least cosine between a pixel's normal now and in the last frame
+#define REPROJECTION_NORMAL_COSINE 0.9f
+
+// First hits of the first camera ray traced through every pixel, for the
+// frame being rendered and the one before it. When the camera moves, a pixel's
+// surface point is taken back to the last frame's view and looked up there.
+// If that pixel saw the same material at the same depth, facing the same way,
+// the samples it accumulated are still good for the new one. Since the scene
+// only ever moves rigidly with the modelview, the light reaching a surface
+// stays the same, only surfaces that reflect or refract are never carried over.
+class ReprojectionCache
+{
+public:
+    struct Hit {
+        // View space position and shading normal
+        Cartesian3 position;
+        Cartesian3 normal;
+        // -1 if the ray missed or hit a surface whose shading follows the view,
+        // unseen until a ray has gone through the pixel this frame
+        int material;
+
+        static constexpr int unseen = -2;
+    };
+    // The current frame's hits in row major order, all unseen after begin()
+    // until the caller records them
+    std::vector<Hit> hits;
+
+    ReprojectionCache();
+
+    // Starts a new frame, keeping the hits of the last one if it was seen
+    // through the same camera so its pixels can be looked up
+    void begin(const RenderSnapshot& frame);
+    // Forgets every frame, the next one has nothing to carry over
+    void invalidate();
+
+    // Pixel of the last frame that saw what pixel of this one sees, -1 if there is none
+    long previousPixel(long pixel) const;
+
+private:
+    std::vector<Hit> previousHits;
+    long width, height;
+    // How the frame is seen, a frame seen differently cannot be reprojected from
+    unsigned features;
+    float tanHalfFov;
+    Matrix4 modelview;
+    Camera previousCamera;
+    // This frame's view space to the last one's
+    Matrix4 toPrevious;
+    bool recorded, havePrevious;
+};
+
+#endif // REPROJECTION_CACHE_H
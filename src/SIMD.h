@@ -0,0 +1,168 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <bit>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+#include "Cartesian3.h"
+
+#if defined(__SSE2__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// Small SIMD layer for batched kernels. Floatx4 and Floatx8 hold 4 or 8 floats
+// in one SSE or AVX register and fall back to plain arrays on other targets.
+// Comparisons return masks of the same type with every bit of a true lane set,
+// which select(), the bitwise operators and mask() understand.
+
+// Portable fallback used when the matching instruction set is not available
+template <int N>
+struct FloatLanes
+{
+    static constexpr int width = N;
+    float f[N];
+
+    FloatLanes() = default;
+    FloatLanes(float value) { for (int i = 0; i < N; i++) f[i] = value; }
+
+    static FloatLanes load(const float* p) { FloatLanes r; for (int i = 0; i < N; i++) r.f[i] = p[i]; return r; }
+    // True in every lane whose int is non zero
+    static FloatLanes fromLanes(const int* lanes) { FloatLanes r; for (int i = 0; i < N; i++) r.f[i] = fromBits(lanes[i] != 0 ? ~0u : 0u); return r; }
+    void store(float* p) const { for (int i = 0; i < N; i++) p[i] = f[i]; }
+    // One bit per lane of a mask, lane 0 in bit 0
+    int mask() const { int m = 0; for (int i = 0; i < N; i++) m |= int(bits(f[i]) >> 31) << i; return m; }
+
+    static float fromBits(std::uint32_t b) { return std::bit_cast<float>(b); }
+    static std::uint32_t bits(float v) { return std::bit_cast<std::uint32_t>(v); }
+
+    template <typename Op>
+    static FloatLanes map(const FloatLanes& a, const FloatLanes& b, Op op) { FloatLanes r; for (int i = 0; i < N; i++) r.f[i] = op(a.f[i], b.f[i]); return r; }
+    template <typename Op>
+    static FloatLanes compare(const FloatLanes& a, const FloatLanes& b, Op op) { FloatLanes r; for (int i = 0; i < N; i++) r.f[i] = fromBits(op(a.f[i], b.f[i]) ? ~0u : 0u); return r; }
+    template <typename Op>
+    static FloatLanes bitwise(const FloatLanes& a, const FloatLanes& b, Op op) { FloatLanes r; for (int i = 0; i < N; i++) r.f[i] = fromBits(op(bits(a.f[i]), bits(b.f[i]))); return r; }
+};
+
+template <int N> inline FloatLanes<N> operator +(const FloatLanes<N>& a, const FloatLanes<N>& b) { return FloatLanes<N>::map(a, b, [](float x, float y) { return x + y; }); }
+template <int N> inline FloatLanes<N> operator -(const FloatLanes<N>& a, const FloatLanes<N>& b) { return FloatLanes<N>::map(a, b, [](float x, float y) { return x - y; }); }
+template <int N> inline FloatLanes<N> operator *(const FloatLanes<N>& a, const FloatLanes<N>& b) { return FloatLanes<N>::map(a, b, [](float x, float y) { return x * y; }); }
+template <int N> inline FloatLanes<N> operator /(const FloatLanes<N>& a, const FloatLanes<N>& b) { return FloatLanes<N>::map(a, b, [](float x, float y) { return x / y; }); }
+template <int N> inline FloatLanes<N> min(const FloatLanes<N>& a, const FloatLanes<N>& b) { return FloatLanes<N>::map(a, b, [](float x, float y) { return std::min(x, y); }); }
+template <int N> inline FloatLanes<N> max(const FloatLanes<N>& a, const FloatLanes<N>& b) { return FloatLanes<N>::map(a, b, [](float x, float y) { return std::max(x, y); }); }
+template <int N> inline FloatLanes<N> operator <(const FloatLanes<N>& a, const FloatLanes<N>& b) { return FloatLanes<N>::compare(a, b, [](float x, float y) { return x < y; }); }
+template <int N> inline FloatLanes<N> operator <=(const FloatLanes<N>& a, const FloatLanes<N>& b) { return FloatLanes<N>::compare(a, b, [](float x, float y) { return x <= y; }); }
+template <int N> inline FloatLanes<N> operator >(const FloatLanes<N>& a, const FloatLanes<N>& b) { return FloatLanes<N>::compare(a, b, [](float x, float y) { return x > y; }); }
+template <int N> inline FloatLanes<N> operator >=(const FloatLanes<N>& a, const FloatLanes<N>& b) { return FloatLanes<N>::compare(a, b, [](float x, float y) { return x >= y; }); }
+template <int N> inline FloatLanes<N> operator &(const FloatLanes<N>& a, const FloatLanes<N>& b) { return FloatLanes<N>::bitwise(a, b, [](std::uint32_t x, std::uint32_t y) { return x & y; }); }
+template <int N> inline FloatLanes<N> operator |(const FloatLanes<N>& a, const FloatLanes<N>& b) { return FloatLanes<N>::bitwise(a, b, [](std::uint32_t x, std::uint32_t y) { return x | y; }); }
+template <int N> inline FloatLanes<N> sqrt(const FloatLanes<N>& a) { FloatLanes<N> r; for (int i = 0; i < N; i++) r.f[i] = std::sqrt(a.f[i]); return r; }
+// a where mask is set, b elsewhere
+template <int N> inline FloatLanes<N> select(const FloatLanes<N>& mask, const FloatLanes<N>& a, const FloatLanes<N>& b) {
+    FloatLanes<N> r;
+    for (int i = 0; i < N; i++) r.f[i] = (FloatLanes<N>::bits(mask.f[i]) >> 31) ? a.f[i] : b.f[i];
+    return r;
+}
+
+#if defined(__SSE2__)
+struct Floatx4
+{
+    static constexpr int width = 4;
+    __m128 v;
+
+    Floatx4() = default;
+    Floatx4(__m128 value) : v(value) {}
+    Floatx4(float value) : v(_mm_set1_ps(value)) {}
+
+    static Floatx4 load(const float* p) { return _mm_loadu_ps(p); }
+    static Floatx4 fromLanes(const int* lanes) { return _mm_cmpneq_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)lanes)), _mm_setzero_ps()); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+    int mask() const { return _mm_movemask_ps(v); }
+};
+
+inline Floatx4 operator +(Floatx4 a, Floatx4 b) { return _mm_add_ps(a.v, b.v); }
+inline Floatx4 operator -(Floatx4 a, Floatx4 b) { return _mm_sub_ps(a.v, b.v); }
+inline Floatx4 operator *(Floatx4 a, Floatx4 b) { return _mm_mul_ps(a.v, b.v); }
+inline Floatx4 operator /(Floatx4 a, Floatx4 b) { return _mm_div_ps(a.v, b.v); }
+inline Floatx4 min(Floatx4 a, Floatx4 b) { return _mm_min_ps(a.v, b.v); }
+inline Floatx4 max(Floatx4 a, Floatx4 b) { return _mm_max_ps(a.v, b.v); }
+inline Floatx4 operator <(Floatx4 a, Floatx4 b) { return _mm_cmplt_ps(a.v, b.v); }
+inline Floatx4 operator <=(Floatx4 a, Floatx4 b) { return _mm_cmple_ps(a.v, b.v); }
+inline Floatx4 operator >(Floatx4 a, Floatx4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline Floatx4 operator >=(Floatx4 a, Floatx4 b) { return _mm_cmpge_ps(a.v, b.v); }
+inline Floatx4 operator &(Floatx4 a, Floatx4 b) { return _mm_and_ps(a.v, b.v); }
+inline Floatx4 operator |(Floatx4 a, Floatx4 b) { return _mm_or_ps(a.v, b.v); }
+inline Floatx4 sqrt(Floatx4 a) { return _mm_sqrt_ps(a.v); }
+inline Floatx4 select(Floatx4 mask, Floatx4 a, Floatx4 b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+#else
+using Floatx4 = FloatLanes<4>;
+#endif
+
+#if defined(__AVX__)
+struct Floatx8
+{
+    static constexpr int width = 8;
+    __m256 v;
+
+    Floatx8() = default;
+    Floatx8(__m256 value) : v(value) {}
+    Floatx8(float value) : v(_mm256_set1_ps(value)) {}
+
+    static Floatx8 load(const float* p) { return _mm256_loadu_ps(p); }
+    static Floatx8 fromLanes(const int* lanes) { return _mm256_cmp_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)lanes)), _mm256_setzero_ps(), _CMP_NEQ_OQ); }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+    int mask() const { return _mm256_movemask_ps(v); }
+};
+
+inline Floatx8 operator +(Floatx8 a, Floatx8 b) { return _mm256_add_ps(a.v, b.v); }
+inline Floatx8 operator -(Floatx8 a, Floatx8 b) { return _mm256_sub_ps(a.v, b.v); }
+inline Floatx8 operator *(Floatx8 a, Floatx8 b) { return _mm256_mul_ps(a.v, b.v); }
+inline Floatx8 operator /(Floatx8 a, Floatx8 b) { return _mm256_div_ps(a.v, b.v); }
+inline Floatx8 min(Floatx8 a, Floatx8 b) { return _mm256_min_ps(a.v, b.v); }
+inline Floatx8 max(Floatx8 a, Floatx8 b) { return _mm256_max_ps(a.v, b.v); }
+inline Floatx8 operator <(Floatx8 a, Floatx8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline Floatx8 operator <=(Floatx8 a, Floatx8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline Floatx8 operator >(Floatx8 a, Floatx8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline Floatx8 operator >=(Floatx8 a, Floatx8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline Floatx8 operator &(Floatx8 a, Floatx8 b) { return _mm256_and_ps(a.v, b.v); }
+inline Floatx8 operator |(Floatx8 a, Floatx8 b) { return _mm256_or_ps(a.v, b.v); }
+inline Floatx8 sqrt(Floatx8 a) { return _mm256_sqrt_ps(a.v); }
+inline Floatx8 select(Floatx8 mask, Floatx8 a, Floatx8 b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+#else
+using Floatx8 = FloatLanes<8>;
+#endif
+
+// Structure-of-arrays 3D vector, one Cartesian3 per lane
+template <typename Float>
+struct Vec3xN
+{
+    Float x, y, z;
+
+    Vec3xN() = default;
+    Vec3xN(Float X, Float Y, Float Z) : x(X), y(Y), z(Z) {}
+    // The same vector in every lane
+    explicit Vec3xN(const Cartesian3& other) : x(other.x), y(other.y), z(other.z) {}
+
+    static Vec3xN load(const float* xs, const float* ys, const float* zs) {
+        return Vec3xN(Float::load(xs), Float::load(ys), Float::load(zs));
+    }
+
+    Vec3xN operator +(const Vec3xN& other) const { return Vec3xN(x + other.x, y + other.y, z + other.z); }
+    Vec3xN operator -(const Vec3xN& other) const { return Vec3xN(x - other.x, y - other.y, z - other.z); }
+    Vec3xN operator *(Float factor) const { return Vec3xN(x * factor, y * factor, z * factor); }
+    // Component by component product
+    Vec3xN modulate(const Vec3xN& other) const { return Vec3xN(x * other.x, y * other.y, z * other.z); }
+
+    Float dot(const Vec3xN& other) const { return x * other.x + y * other.y + z * other.z; }
+    Vec3xN cross(const Vec3xN& other) const {
+        return Vec3xN(y * other.z - z * other.y, z * other.x - x * other.z, x * other.y - y * other.x);
+    }
+};
+
+template <typename Float> inline Vec3xN<Float> min(const Vec3xN<Float>& a, const Vec3xN<Float>& b) { return Vec3xN<Float>(min(a.x, b.x), min(a.y, b.y), min(a.z, b.z)); }
+template <typename Float> inline Vec3xN<Float> max(const Vec3xN<Float>& a, const Vec3xN<Float>& b) { return Vec3xN<Float>(max(a.x, b.x), max(a.y, b.y), max(a.z, b.z)); }
+
+using Vec3x4 = Vec3xN<Floatx4>;
+using Vec3x8 = Vec3xN<Floatx8>;
+
+#endif // SIMD_H
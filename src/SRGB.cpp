@@ -0,0 +1,53 @@
+#include "SRGB.h"
+#include <cmath>
+
+// Number of pixels encodeTile converts per inner batch
+#define SRGB_TILE_BATCH 256
+
+SRGB::Tables::Tables()
+{
+    // Each entry holds the exact encoding of the value at its centre
+    for (int i = 0; i < SRGB_ENCODE_SIZE; i++) {
+        float value = float(i) / float(SRGB_ENCODE_SIZE - 1);
+        float srgb = value < 0.0031308f ? 12.92f * value : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+        encode[i] = std::uint8_t(std::clamp(255.f * srgb + 0.5f, 0.0f, 255.0f));
+    }
+
+    for (int i = 0; i < 256; i++) {
+        float value = float(i) / 255.f;
+        decode[i] = value < 0.04045f ? (1.f / 12.92f) * value : std::pow((1.f / 1.055f) * (value + 0.055f), 2.4f);
+    }
+}
+
+const SRGB::Tables& SRGB::tables()
+{
+    static const Tables instance;
+    return instance;
+}
+
+void SRGB::encodeTile(const Homogeneous4* colours, int count, float scale, RGBAValue* out)
+{
+    const std::uint8_t* table = tables().encode;
+    int indices[3 * SRGB_TILE_BATCH];
+
+    for (int first = 0; first < count; first += SRGB_TILE_BATCH) {
+        int batch = std::min(SRGB_TILE_BATCH, count - first);
+
+        // Clamping and scaling to table indices vectorises, the lookups that follow are plain loads
+        #pragma omp simd
+        for (int i = 0; i < batch; i++) {
+            const Homogeneous4& colour = colours[first + i];
+            indices[3 * i + 0] = int(std::clamp(colour.x * scale, 0.0f, 1.0f) * float(SRGB_ENCODE_SIZE - 1) + 0.5f);
+            indices[3 * i + 1] = int(std::clamp(colour.y * scale, 0.0f, 1.0f) * float(SRGB_ENCODE_SIZE - 1) + 0.5f);
+            indices[3 * i + 2] = int(std::clamp(colour.z * scale, 0.0f, 1.0f) * float(SRGB_ENCODE_SIZE - 1) + 0.5f);
+        }
+
+        for (int i = 0; i < batch; i++) {
+            RGBAValue& pixel = out[first + i];
+            pixel.red = table[indices[3 * i + 0]];
+            pixel.green = table[indices[3 * i + 1]];
+            pixel.blue = table[indices[3 * i + 2]];
+            pixel.alpha = 255;
+        }
+    }
+}
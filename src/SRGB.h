@@ -0,0 +1,41 @@
+#ifndef SRGB_H
+#define SRGB_H
+
+#include <cstdint>
+#include <algorithm>
+#include "Homogeneous4.h"
+#include "RGBAValue.h"
+
+// Resolution of the encode table, 2^14 entries keeps every result within one step of std::pow
+#define SRGB_ENCODE_BITS 14
+#define SRGB_ENCODE_SIZE (1 << SRGB_ENCODE_BITS)
+
+// Table driven sRGB transfer function, so converting pixels never calls std::pow
+class SRGB
+{
+public:
+    // Linear [0, 1] to 8 bit sRGB, values outside the range are clamped
+    static inline std::uint8_t encode(float linear) {
+        float clamped = std::clamp(linear, 0.0f, 1.0f);
+        return tables().encode[int(clamped * float(SRGB_ENCODE_SIZE - 1) + 0.5f)];
+    }
+
+    // 8 bit sRGB to linear [0, 1]
+    static inline float decode(std::uint8_t srgb) {
+        return tables().decode[srgb];
+    }
+
+    // Converts count linear colours, each multiplied by scale, to opaque 8 bit sRGB pixels
+    static void encodeTile(const Homogeneous4* colours, int count, float scale, RGBAValue* out);
+
+private:
+    struct Tables {
+        std::uint8_t encode[SRGB_ENCODE_SIZE];
+        float decode[256];
+        Tables();
+    };
+
+    static const Tables& tables();
+};
+
+#endif // SRGB_H
@@ -0,0 +1,78 @@
+#include "SampleStatistics.h"
+#include <algorithm>
+#include <cmath>
+#include <new>
+
+SampleStatistics::SampleStatistics() :
+    width(0),
+    height(0)
+{
+}
+
+bool SampleStatistics::Resize(long width, long height)
+{
+    try {
+        counts.assign(size_t(width * height), 0.0f);
+        squares.assign(size_t(width * height), 0.0f);
+    }
+    catch (const std::bad_alloc&) {
+        counts.clear();
+        squares.clear();
+        this->width = this->height = 0;
+        return false;
+    }
+    this->width = width;
+    this->height = height;
+    return true;
+}
+
+void SampleStatistics::clear()
+{
+    std::fill(counts.begin(), counts.end(), 0.0f);
+    std::fill(squares.begin(), squares.end(), 0.0f);
+}
+
+void SampleStatistics::clear(long first, long count)
+{
+    std::fill_n(counts.begin() + first, count, 0.0f);
+    std::fill_n(squares.begin() + first, count, 0.0f);
+}
+
+void SampleStatistics::accumulate(long first, long count, const Homogeneous4* colours, float samples)
+{
+    // The squares are of the pass's mean, weighted by its samples so they sum like the colours
+    float inverse = 1.0f / samples;
+    for (long i = 0; i < count; i++) {
+        float luminance = Luminance(colours[i].x, colours[i].y, colours[i].z) * inverse;
+        counts[first + i] += samples;
+        squares[first + i] += samples * luminance * luminance;
+    }
+}
+
+void SampleStatistics::average(RGBAFloatImage& sums) const
+{
+    long pixels = width * height;
+    for (long i = 0; i < pixels; i++) {
+        float scale = counts[i] > 0.0f ? 1.0f / counts[i] : 0.0f;
+        sums.red[i] *= scale;
+        sums.green[i] *= scale;
+        sums.blue[i] *= scale;
+        sums.alpha[i] *= scale;
+    }
+}
+
+float SampleStatistics::meanStandardError(const RGBAFloatImage& sums) const
+{
+    long pixels = width * height, sampled = 0;
+    double total = 0.0;
+    for (long i = 0; i < pixels; i++) {
+        // One value tells nothing about the spread
+        if (counts[i] <= 1.0f)
+            continue;
+        float mean = Luminance(sums.red[i], sums.green[i], sums.blue[i]) / counts[i];
+        float variance = std::max(squares[i] / counts[i] - mean * mean, 0.0f) * counts[i] / (counts[i] - 1.0f);
+        total += std::sqrt(variance / counts[i]);
+        sampled++;
+    }
+    return sampled > 0 ? float(total / double(sampled)) : 0.0f;
+}
@@ -0,0 +1,43 @@
+#ifndef SAMPLE_STATISTICS_H
+#define SAMPLE_STATISTICS_H
+
+#include <vector>
+#include "Homogeneous4.h"
+#include "RGBAFloatImage.h"
+
+// How many samples went into each pixel of an HDR sum and the sum of their
+// squared luminances. Together with the sums that is enough to average pixels
+// that saw different numbers of samples, as merged renders may, and to tell how
+// noisy each one still is. A pass's samples of a pixel count as one value.
+class SampleStatistics
+{
+public:
+    // one entry per pixel in row major order, like the RGBAFloatImage planes
+    std::vector<float> counts;
+    std::vector<float> squares;
+    long width, height;
+
+    SampleStatistics();
+
+    // resizes, destroying any contents
+    bool Resize(long width, long height);
+
+    void clear();
+    void clear(long first, long count);
+
+    // records one pass of samples for count pixels starting at pixel index first,
+    // colours being the sum of the samples each pixel got
+    void accumulate(long first, long count, const Homogeneous4* colours, float samples);
+
+    // divides every pixel of sums by its sample count
+    void average(RGBAFloatImage& sums) const;
+
+    // mean over the sampled pixels of the standard error of their luminance
+    float meanStandardError(const RGBAFloatImage& sums) const;
+
+    static inline float Luminance(float red, float green, float blue) {
+        return 0.2126f * red + 0.7152f * green + 0.0722f * blue;
+    }
+};
+
+#endif // SAMPLE_STATISTICS_H
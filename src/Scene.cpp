@@ -1,5 +1,9 @@
 #include "Scene.h"
+#include "Topology.h"
 #include <limits>
+#include <chrono>
+#include <bit>
+#include <thread>
 
 Scene::Scene(std::vector<ThreeDModel> *texobjs,RenderParameters *renderp)
 {
@@ -20,53 +24,367 @@ Matrix4 Scene::getModelview()
     return rp->getViewMatrix() * rp->getModelMatrix();
 }
 
+Cartesian3 Scene::shadingNormal(const Triangle& triangle, const Cartesian3& bary) const
+{
+    return (bary.x * attributes.normal(triangle.normals[0]) + bary.y * attributes.normal(triangle.normals[1]) + bary.z * attributes.normal(triangle.normals[2])).unit();
+}
+
+Cartesian3 Scene::albedo(const Triangle& triangle, const Cartesian3& bary, float coneWidth, const Cartesian3& direction) const
+{
+    if (!(triangle.materialFlags & MATERIAL_TEXTURED))
+        return Cartesian3(1.0f, 1.0f, 1.0f);
+    float us[3], vs[3];
+    for (int vertex = 0; vertex < 3; vertex++)
+        attributes.uv(triangle.uvs[vertex], us[vertex], vs[vertex]);
+    return triangle.albedo(bary, coneWidth, direction, materials.texture(triangle.materialID), us, vs);
+}
+
+const BVH& Scene::localBVH() const
+{
+    int node = Topology::CurrentNode();
+    return node >= 0 && node < int(replicas.size()) ? replicas[node].bvh : bvh;
+}
+
+const std::vector<Triangle>& Scene::localTriangles() const
+{
+    int node = Topology::CurrentNode();
+    return node >= 0 && node < int(replicas.size()) ? replicas[node].triangles : triangles;
+}
+
 Scene::CollisionInfo Scene::closestTriangle(Ray ray) {
+    const BVH& tree = localBVH();
+    const std::vector<Triangle>& soup = localTriangles();
     Scene::CollisionInfo ci;
     ci.t = -1.0f;
 
-    // Iterate over all triangles in scene
-    for (auto triangle : triangles) {
-        if (triangle.shared_material->isLight() && ray.ray_type == Ray::Type::shadow) {
-            continue;
+    int closest = -1;
+    float tClosest = std::numeric_limits<float>::max();
+
+    // Walk the BVH, only triangles in leaves the ray reaches get tested
+    tree.traverse(ray, tClosest, [&](int index) {
+        const Triangle& triangle = soup[index];
+        if (ray.ray_type == Ray::Type::shadow && (triangle.materialFlags & MATERIAL_LIGHT)) {
+            return;
         }
         float t = triangle.intersect(ray);
-        
+
         // Only accept intersection values greater than 0
         // Negative values indicate 'no hit' rays or triangles behind camera
-        if (t > 0.0f) {
-            // If we haven't set a ci.t yet or our t is less
-            // than the current ci.t, then overwrite the collision info 
-            if (ci.t == -1.0f || t < ci.t) {
-                ci.tri = triangle;
-                ci.t = t;
-            }
+        // Ties go to the lower index so the result does not depend on traversal order
+        if (t > 0.0f && (t < tClosest || (t == tClosest && index < closest))) {
+            tClosest = t;
+            closest = index;
         }
+    });
+
+    if (closest != -1) {
+        ci.tri = soup[closest];
+        ci.t = tClosest;
     }
 
     return ci;
 }
 
+bool Scene::occluded(Ray ray, float maxDistance) {
+    const BVH& tree = localBVH();
+    const std::vector<Triangle>& soup = localTriangles();
+    bool blocked = false;
+    float tMax = maxDistance;
+
+    // Any hit closer than the light will do, so stop at the first one
+    tree.traverse(ray, tMax, [&](int index) {
+        const Triangle& triangle = soup[index];
+        if ((triangle.materialFlags & MATERIAL_LIGHT)) {
+            return false;
+        }
+        float t = triangle.intersect(ray);
+        if (t > 0.0f && t < maxDistance) {
+            blocked = true;
+            return true;
+        }
+        return false;
+    });
+
+    return blocked;
+}
+
+void Scene::closestTriangles(RayPacket& packet, CollisionInfo* hits) {
+    const std::vector<Triangle>& soup = localTriangles();
+    for (int lane = 0; lane < PACKET_SIZE; lane++)
+        if (packet.active[lane])
+            packet.tMax[lane] = std::numeric_limits<float>::max();
+
+    tracePacket(packet, false);
+
+    for (int lane = 0; lane < PACKET_SIZE; lane++) {
+        hits[lane].t = -1.0f;
+        if (packet.triangle[lane] != -1) {
+            hits[lane].tri = soup[packet.triangle[lane]];
+            hits[lane].t = packet.tMax[lane];
+        }
+    }
+}
+
+void Scene::occluded(RayPacket& packet, bool* blocked) {
+    tracePacket(packet, true);
+
+    for (int lane = 0; lane < PACKET_SIZE; lane++)
+        blocked[lane] = packet.triangle[lane] != -1;
+}
+
+// Traces the active lanes of a packet through the BVH together.
+// A node the lead ray hits is entered straight away. Otherwise, when every ray
+// points into the same octant, the node is tested against the whole packet with
+// interval arithmetic before falling back to SIMD slab tests lane by lane.
+// Subtrees only a few rays reach are finished by single ray traversal.
+void Scene::tracePacket(RayPacket& packet, bool anyHit) {
+    const BVH& tree = localBVH();
+    const std::vector<Triangle>& soup = localTriangles();
+    if (tree.nodes.empty()) return;
+
+    bool shadow = packet.ray_type == Ray::Type::shadow;
+
+    // Interval bounds of the origins and inverse directions over the packet
+    bool coherent = true;
+    bool positive[3] = { false, false, false };
+    float originMin[3], originMax[3], invMin[3], invMax[3];
+    int firstLane = -1;
+    for (int lane = 0; lane < PACKET_SIZE; lane++) {
+        if (!packet.active[lane]) continue;
+        float o[3] = { packet.originX[lane], packet.originY[lane], packet.originZ[lane] };
+        float d[3] = { packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane] };
+        float inv[3] = { packet.invDirectionX[lane], packet.invDirectionY[lane], packet.invDirectionZ[lane] };
+        for (int axis = 0; axis < 3; axis++) {
+            // Axis aligned rays would put infinities into the interval maths
+            if (std::abs(d[axis]) < 1e-6f) coherent = false;
+            if (firstLane == -1) {
+                positive[axis] = d[axis] >= 0.0f;
+                originMin[axis] = originMax[axis] = o[axis];
+                invMin[axis] = invMax[axis] = inv[axis];
+            }
+            else {
+                if ((d[axis] >= 0.0f) != positive[axis]) coherent = false;
+                originMin[axis] = std::min(originMin[axis], o[axis]);
+                originMax[axis] = std::max(originMax[axis], o[axis]);
+                invMin[axis] = std::min(invMin[axis], inv[axis]);
+                invMax[axis] = std::max(invMax[axis], inv[axis]);
+            }
+        }
+        if (firstLane == -1) firstLane = lane;
+    }
+    if (firstLane == -1) return;
+
+    // Farthest distance any active ray still cares about, kept up to date after each leaf
+    float packetFar = 0.0f;
+    auto updatePacketFar = [&]() {
+        packetFar = 0.0f;
+        for (int lane = 0; lane < PACKET_SIZE; lane++)
+            if (packet.active[lane]) packetFar = std::max(packetFar, packet.tMax[lane]);
+    };
+    updatePacketFar();
+
+    // Conservative test whether any ray of the packet could hit the box
+    auto packetMisses = [&](const BVH::AABB& box) {
+        float boxMin[3] = { box.min.x, box.min.y, box.min.z };
+        float boxMax[3] = { box.max.x, box.max.y, box.max.z };
+        float entry = 0.0f;
+        float exit = packetFar;
+        for (int axis = 0; axis < 3; axis++) {
+            float near = positive[axis] ? boxMin[axis] : boxMax[axis];
+            float far = positive[axis] ? boxMax[axis] : boxMin[axis];
+            float n0 = (near - originMax[axis]) * invMin[axis], n1 = (near - originMax[axis]) * invMax[axis];
+            float n2 = (near - originMin[axis]) * invMin[axis], n3 = (near - originMin[axis]) * invMax[axis];
+            float f0 = (far - originMax[axis]) * invMin[axis], f1 = (far - originMax[axis]) * invMax[axis];
+            float f2 = (far - originMin[axis]) * invMin[axis], f3 = (far - originMin[axis]) * invMax[axis];
+            entry = std::max(entry, std::min(std::min(n0, n1), std::min(n2, n3)));
+            exit = std::min(exit, std::max(std::max(f0, f1), std::max(f2, f3)));
+        }
+        return entry > exit;
+    };
+
+    // Leaf test for a single lane, shared with the fallback traversal
+    auto laneHit = [&](int lane, int index, float t) {
+        if (t > 0.0f && (t < packet.tMax[lane] || (t == packet.tMax[lane] && index < packet.triangle[lane]))) {
+            packet.triangle[lane] = index;
+            if (anyHit)
+                packet.active[lane] = 0;
+            else
+                packet.tMax[lane] = t;
+            return true;
+        }
+        return false;
+    };
+
+    int stack[64];
+    int stackPtr = 0;
+    stack[stackPtr++] = 0;
+    // The first ray still looking for hits leads the packet
+    int lead = firstLane;
+
+    while (stackPtr > 0) {
+        int current = stack[--stackPtr];
+        const BVH::Node& node = tree.nodes[current];
+
+        if (!packet.active[lead]) {
+            while (lead < PACKET_SIZE && !packet.active[lead]) lead++;
+            if (lead == PACKET_SIZE) return;
+        }
+
+        // If the lead ray hits an interior node the packet descends without testing the others.
+        // Otherwise the whole packet gets culled by interval arithmetic or tested lane by lane.
+        Cartesian3 origin(packet.originX[lead], packet.originY[lead], packet.originZ[lead]);
+        Cartesian3 invDirection(packet.invDirectionX[lead], packet.invDirectionY[lead], packet.invDirectionZ[lead]);
+        bool leadHits = node.bounds.intersect(origin, invDirection, packet.tMax[lead]) != BVH::miss;
+
+        if (!leadHits || node.isLeaf()) {
+            if (!leadHits && coherent && packetMisses(node.bounds))
+                continue;
+
+            // Slab test every lane against the node
+            alignas(64) int lanes[PACKET_SIZE];
+            int count = 0;
+            PacketVec3 boxMin(node.bounds.min), boxMax(node.bounds.max);
+            PacketFloat zero(0.0f);
+            for (int base = 0; base < PACKET_SIZE; base += PacketFloat::width) {
+                PacketVec3 origins = PacketVec3::load(packet.originX + base, packet.originY + base, packet.originZ + base);
+                PacketVec3 invDirections = PacketVec3::load(packet.invDirectionX + base, packet.invDirectionY + base, packet.invDirectionZ + base);
+                PacketVec3 t1 = (boxMin - origins).modulate(invDirections);
+                PacketVec3 t2 = (boxMax - origins).modulate(invDirections);
+                PacketVec3 tMin = min(t1, t2), tMax = max(t1, t2);
+                PacketFloat tNear = max(max(tMin.x, tMin.y), tMin.z);
+                PacketFloat tFar = min(min(tMax.x, tMax.y), tMax.z);
+                PacketFloat hit = PacketFloat::fromLanes(packet.active + base) & (tFar >= tNear)
+                                & (tNear <= PacketFloat::load(packet.tMax + base)) & (tFar > zero);
+                int bits = hit.mask();
+                for (int lane = 0; lane < PacketFloat::width; lane++)
+                    lanes[base + lane] = (bits >> lane) & 1;
+                count += std::popcount(unsigned(bits));
+            }
+            if (count == 0)
+                continue;
+
+            // The packet has diverged, let the few remaining rays walk this subtree alone
+            if (count < PACKET_MIN_ACTIVE) {
+                for (int lane = 0; lane < PACKET_SIZE; lane++) {
+                    if (!lanes[lane]) continue;
+                    Ray ray = packet.ray(lane);
+                    float tMax = packet.tMax[lane];
+                    tree.traverse(ray, tMax, [&](int index) {
+                        const Triangle& triangle = soup[index];
+                        if (shadow && (triangle.materialFlags & MATERIAL_LIGHT))
+                            return false;
+                        bool hit = laneHit(lane, index, triangle.intersect(ray));
+                        tMax = packet.tMax[lane];
+                        return hit && anyHit;
+                    }, current);
+                }
+                updatePacketFar();
+                continue;
+            }
+
+            if (node.isLeaf()) {
+                for (int i = 0; i < node.triCount; i++) {
+                    int index = tree.triIndices[node.leftFirst + i];
+                    const Triangle& triangle = soup[index];
+                    if (shadow && (triangle.materialFlags & MATERIAL_LIGHT))
+                        continue;
+
+                    alignas(64) float t[PACKET_SIZE];
+                    triangle.intersect(packet, lanes, t);
+                    for (int lane = 0; lane < PACKET_SIZE; lane++)
+                        if (lanes[lane] && laneHit(lane, index, t[lane]) && anyHit)
+                            lanes[lane] = 0;
+                }
+                updatePacketFar();
+                continue;
+            }
+        }
+
+        // Push the far child first so the near one is visited next,
+        // near and far judged along the lead ray
+        const BVH::AABB& left = tree.nodes[node.leftFirst].bounds;
+        const BVH::AABB& right = tree.nodes[node.leftFirst + 1].bounds;
+        Cartesian3 direction(packet.directionX[lead], packet.directionY[lead], packet.directionZ[lead]);
+        float leftDistance = ((left.min + left.max) * 0.5f - origin).dot(direction);
+        float rightDistance = ((right.min + right.max) * 0.5f - origin).dot(direction);
+        if (leftDistance <= rightDistance) {
+            stack[stackPtr++] = node.leftFirst + 1;
+            stack[stackPtr++] = node.leftFirst;
+        }
+        else {
+            stack[stackPtr++] = node.leftFirst;
+            stack[stackPtr++] = node.leftFirst + 1;
+        }
+    }
+}
+
 //updateScene will build the scene like we would do for
 //rasterization. So very similar to "Render", but instead
 //of calling glVertex3f, and instead of GL_TRIANGLES, we
 //create triangles. We however need to transform things
 //to VCS to raytrace, as there is no transform phase to do that
 //for us.
-void Scene::updateScene()
+void Scene::updateScene(Arena& scratch)
 {
-    triangles.clear();
-    int triID = 0;
+#if SCENE_STATS
+    auto start = std::chrono::steady_clock::now();
+#endif
+    Matrix4 modelview = getModelview();
+    Arena::Scope scope(scratch);
+
+    // Work out where each face's triangles start so faces can be
+    // triangulated independently of each other
+    std::pmr::vector<std::pmr::vector<unsigned int>> faceOffsets(objects->size(), &scratch);
+    unsigned int triangleCount = 0;
+    for (unsigned int i = 0; i < objects->size(); i++)
+    {
+        const ThreeDModel& obj = objects->at(i);
+        faceOffsets[i].resize(obj.faceVertices.size());
+        for (unsigned int face = 0; face < obj.faceVertices.size(); face++)
+        {
+            faceOffsets[i][face] = triangleCount;
+            triangleCount += unsigned(obj.faceVertices[face].size() - 2);
+        }
+    }
+    triangles.resize(triangleCount);
+
+    // The material table and shading attributes are rebuilt with the triangles,
+    // materials may have been edited and the normals depend on the view
+    materials.clear();
+    attributes.clear();
+    // Entry 0 of each stands in for indices a face gives but the file does not have
+    attributes.addNormal(Cartesian3(0.0f, 0.0f, 1.0f));
+    attributes.addUV(0.0f, 0.0f);
+
     //We go through all the objects to construct the scene
     for (int i = 0;i< int(objects->size());i++)
     {
         typedef unsigned int uint;
-        ThreeDModel obj = objects->at(uint(i));
+        const ThreeDModel& obj = objects->at(uint(i));
         // Scale defaults to the zoom setting
 
         //This object may have a material. But if it does not, lets use from sliders.
+        uint16_t objectMaterial = materials.intern(obj.material == nullptr ? default_mat : obj.material);
 
-        // loop through the faces: note that they may not be triangles, which complicates life
+        // Store each normal and texture coordinate the faces use once, in the order first used.
+        // Every object holds the whole file's arrays, so only the used entries are kept.
+        Arena::Scope objectScope(scratch);
+        std::pmr::vector<uint32_t> normalIndex(obj.normals.size(), UINT32_MAX, &scratch);
+        std::pmr::vector<uint32_t> uvIndex(obj.textureCoords.size(), UINT32_MAX, &scratch);
         for (unsigned int face = 0; face < obj.faceVertices.size(); face++)
+            for (unsigned int corner = 0; corner < obj.faceVertices[face].size(); corner++)
+            {
+                unsigned int n = obj.faceNormals[face][corner];
+                unsigned int uv = obj.faceTexCoords[face][corner];
+                if (n < normalIndex.size() && normalIndex[n] == UINT32_MAX)
+                    normalIndex[n] = attributes.addNormal((modelview * Homogeneous4(obj.normals[n].x, obj.normals[n].y, obj.normals[n].z, 0.0f)).Vector());
+                if (uv < uvIndex.size() && uvIndex[uv] == UINT32_MAX)
+                    uvIndex[uv] = attributes.addUV(obj.textureCoords[uv].x, obj.textureCoords[uv].y);
+            }
+
+        // loop through the faces: note that they may not be triangles, which complicates life
+        #pragma omp parallel for
+        for (int face = 0; face < int(obj.faceVertices.size()); face++)
         { // per face
             // on each face, treat it as a triangle fan starting with the first vertex on the face
             for (unsigned int triangle = 0; triangle < obj.faceVertices[face].size() - 2; triangle++)
@@ -92,40 +410,79 @@ void Scene::updateScene()
                     //- arcball
                     //- center
 
-                    v = getModelview()*v;
+                    v = modelview*v;
                     t.verts[vertex] = v;
 
-                    Homogeneous4 n =  Homogeneous4(
-                                obj.normals[obj.faceNormals   [face][faceVertex]].x,
-                            obj.normals[obj.faceNormals   [face][faceVertex]].y,
-                            obj.normals[obj.faceNormals   [face][faceVertex]].z,
-                            0.0f);
-
-                    n = getModelview()*n;
-                    t.normals[vertex] = n;
-
-                    Cartesian3 tex = Cartesian3(
-                                obj.textureCoords[obj.faceTexCoords[face][faceVertex]].x,
-                            obj.textureCoords[obj.faceTexCoords[face][faceVertex]].y,
-                            0.0f
-                            );
-                    t.uvs[vertex] = tex;
-
-
-                    t.colors[vertex] = Cartesian3( 0.7f, 0.7f, 0.7f);
+                    // the view space normal and texture coordinates were stored above
+                    unsigned int n = obj.faceNormals[face][faceVertex];
+                    unsigned int uv = obj.faceTexCoords[face][faceVertex];
+                    t.normals[vertex] = n < normalIndex.size() ? normalIndex[n] : 0;
+                    t.uvs[vertex] = uv < uvIndex.size() ? uvIndex[uv] : 0;
 
                 } // per vertex
-                t.validate(triID++);
-                if(obj.material== nullptr){
-                    t.shared_material = default_mat;
-                }else{
-                    t.shared_material = obj.material;
-                }
-                triangles.push_back(t);
+                uint triID = faceOffsets[i][face] + triangle;
+                t.validate(int(triID));
+                t.materialID = objectMaterial;
+                t.materialFlags = materials.flags(objectMaterial);
+                triangles[triID] = t;
             } // per triangle
         } // per face
     }//per object
-}
 
+#if SCENE_STATS
+    auto built = std::chrono::steady_clock::now();
+#endif
 
+    // If only the vertex positions changed since the last build, refitting
+    // the existing hierarchy is much cheaper than building a new one.
+    // The refit reports when the tree has degraded too far and needs rebuilding.
+    BVH::BuildType buildType = rp->fastBVHBuild ? BVH::BuildType::fast : BVH::BuildType::sah;
+    bool sameTopology = !bvh.nodes.empty() && bvh.triIndices.size() == triangles.size() && bvh.buildType == buildType;
+    bool refitted = sameTopology && bvh.refit(triangles);
+    if (!refitted)
+        bvh.build(triangles, buildType);
 
+#if SCENE_STATS
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "Scene: " << triangles.size() << " triangles in "
+              << std::chrono::duration<double, std::milli>(built - start).count() << " ms, "
+              << (refitted ? "refit" : (buildType == BVH::BuildType::fast ? "LBVH build" : "SAH build"))
+              << " of " << bvh.nodes.size() << " nodes in "
+              << std::chrono::duration<double, std::milli>(end - built).count() << " ms, SAH cost "
+              << bvh.currentCost << " (" << bvh.builtCost << " when built)" << std::endl;
+#endif
+    attributes.report();
+    replicate();
+}
+
+// Copies the triangles and BVH once per NUMA node in use. Each copy is made by a
+// thread pinned to the node, so its pages are first touched, and placed, there.
+void Scene::replicate()
+{
+    const Topology& topology = Topology::System();
+    int nodes = topology.nodesInUse(rp->numaNodes);
+    if (!rp->pinThreads || !rp->replicateScene || nodes < 2) {
+        replicas.clear();
+        return;
+    }
+
+#if SCENE_STATS
+    auto start = std::chrono::steady_clock::now();
+#endif
+    replicas.resize(size_t(nodes));
+    std::vector<std::thread> copiers;
+    for (int node = 0; node < nodes; node++)
+        copiers.emplace_back([this, &topology, node]() {
+            // Unpinned the copy still works, it just may not be local
+            Topology::Pin(topology.nodes[node][0], node);
+            replicas[node].triangles = triangles;
+            replicas[node].bvh = bvh;
+        });
+    for (std::thread& copier : copiers)
+        copier.join();
+#if SCENE_STATS
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "Scene: replicated on " << nodes << " NUMA nodes in "
+              << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+#endif
+}
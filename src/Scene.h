@@ -7,6 +7,17 @@
 #include "Ray.h"
 #include "Triangle.h"
 #include "Material.h"
+#include "MaterialTable.h"
+#include "ShadingAttributes.h"
+#include "BVH.h"
+#include "RayPacket.h"
+#include "Arena.h"
+
+// Set to 1 to have updateScene() print how long the triangles, the BVH and
+// their copies for each NUMA node took to make each time the scene is built
+#ifndef SCENE_STATS
+#define SCENE_STATS 0
+#endif
 
 class Scene
 {
@@ -18,16 +29,48 @@ public:
    };
 
    CollisionInfo closestTriangle(Ray r);
+   // True if anything blocks the ray before maxDistance
+   bool occluded(Ray r, float maxDistance);
+   // Packet versions of the above, one result per lane
+   void closestTriangles(RayPacket& packet, CollisionInfo* hits);
+   void occluded(RayPacket& packet, bool* blocked);
 
     std::vector<ThreeDModel>* objects;
     RenderParameters* rp;
     Material *default_mat;
 
     std::vector<Triangle> triangles;
+    // Shading parameters of every material the triangles use
+    MaterialTable materials;
+    // View space normals and texture coordinates the triangles index into
+    ShadingAttributes attributes;
+    BVH bvh;
+
+    // A NUMA node's own copy of the triangles and BVH, made by a thread on that node
+    struct Replica {
+        std::vector<Triangle> triangles;
+        BVH bvh;
+    };
+    // One for each node in use when the render parameters ask for it, otherwise empty.
+    // Pinned threads trace against their node's copy.
+    std::vector<Replica> replicas;
 
     Scene(std::vector<ThreeDModel> *texobjs,RenderParameters *renderp);
-    void updateScene();
+    // Rebuilds the triangles and BVH, scratch holds the bookkeeping while it runs
+    void updateScene(Arena& scratch);
     Matrix4 getModelview();
+
+    // Interpolated unit shading normal of triangle at barycentric coordinates bary
+    Cartesian3 shadingNormal(const Triangle& triangle, const Cartesian3& bary) const;
+    // Texture colour of triangle's material at bary for a ray cone (see Triangle::albedo), white when untextured
+    Cartesian3 albedo(const Triangle& triangle, const Cartesian3& bary, float coneWidth, const Cartesian3& direction) const;
+
+private:
+    void tracePacket(RayPacket& packet, bool anyHit);
+    // The BVH and triangles to trace on the calling thread
+    const BVH& localBVH() const;
+    const std::vector<Triangle>& localTriangles() const;
+    void replicate();
 };
 
 #endif // SCENE_H
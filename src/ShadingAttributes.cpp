@@ -0,0 +1,144 @@
+#include "ShadingAttributes.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+void ShadingAttributes::clear()
+{
+    normals.clear();
+    uvs.clear();
+    maxNormalError = 0.0f;
+    maxUVError = 0.0f;
+}
+
+uint32_t ShadingAttributes::addNormal(const Cartesian3& normal)
+{
+    uint32_t encoded = EncodeNormal(normal);
+#if SHADING_ATTRIBUTE_VALIDATION
+    // atan2 keeps its precision for tiny angles where acos of the dot product does not
+    Cartesian3 decoded = DecodeNormal(encoded), unit = normal.unit();
+    float angle = std::atan2(decoded.cross(unit).length(), decoded.dot(unit));
+    maxNormalError = std::max(maxNormalError, angle * (180.0f / 3.14159265359f));
+#endif
+    normals.push_back(encoded);
+    return uint32_t(normals.size() - 1);
+}
+
+uint32_t ShadingAttributes::addUV(float u, float v)
+{
+    uint32_t packed = uint32_t(ToHalf(u)) | (uint32_t(ToHalf(v)) << 16);
+#if SHADING_ATTRIBUTE_VALIDATION
+    maxUVError = std::max(maxUVError, std::max(std::abs(FromHalf(uint16_t(packed & 0xffff)) - u), std::abs(FromHalf(uint16_t(packed >> 16)) - v)));
+#endif
+    uvs.push_back(packed);
+    return uint32_t(uvs.size() - 1);
+}
+
+void ShadingAttributes::report() const
+{
+#if SHADING_ATTRIBUTE_VALIDATION
+    std::cout << "Shading attributes: " << normals.size() << " normals, " << uvs.size() << " uvs in " << bytes()
+              << " bytes, max normal error " << maxNormalError << " degrees, max uv error " << maxUVError << std::endl;
+#endif
+}
+
+// Folds the unit sphere onto the |x| + |y| <= 1 square: the upper half maps
+// straight down, the lower half is mirrored into the corners
+uint32_t ShadingAttributes::EncodeNormal(const Cartesian3& normal)
+{
+    float l1 = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (l1 == 0.0f)
+        return 0;
+    float x = normal.x / l1, y = normal.y / l1;
+    if (normal.z < 0.0f) {
+        float foldedX = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    int16_t qx = int16_t(std::lround(std::clamp(x, -1.0f, 1.0f) * 32767.0f));
+    int16_t qy = int16_t(std::lround(std::clamp(y, -1.0f, 1.0f) * 32767.0f));
+    return uint32_t(uint16_t(qx)) | (uint32_t(uint16_t(qy)) << 16);
+}
+
+Cartesian3 ShadingAttributes::DecodeNormal(uint32_t encoded)
+{
+    float x = float(int16_t(encoded & 0xffff)) * (1.0f / 32767.0f);
+    float y = float(int16_t(encoded >> 16)) * (1.0f / 32767.0f);
+    float z = 1.0f - std::abs(x) - std::abs(y);
+    // Unfolding is the same reflection as folding
+    if (z < 0.0f) {
+        float unfoldedX = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float unfoldedY = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = unfoldedX;
+        y = unfoldedY;
+    }
+    float length = std::sqrt(x * x + y * y + z * z);
+    return Cartesian3(x / length, y / length, z / length);
+}
+
+// IEEE 754 binary16, rounded to nearest even. Values too large become infinity,
+// too small ones flush to zero through the subnormals
+uint16_t ShadingAttributes::ToHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    int32_t exponent = int32_t((bits >> 23) & 0xffu) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffffu;
+
+    if (exponent >= 31)
+        return uint16_t(sign | 0x7c00u);
+    if (exponent <= 0) {
+        if (exponent < -10)
+            return uint16_t(sign);
+        // Subnormal, shift the mantissa with its implicit leading one into place
+        mantissa |= 0x800000u;
+        uint32_t shift = uint32_t(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1u);
+        uint32_t midpoint = 1u << (shift - 1);
+        if (rest > midpoint || (rest == midpoint && (half & 1u)))
+            half++;
+        return uint16_t(sign | half);
+    }
+
+    uint32_t half = sign | (uint32_t(exponent) << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fffu;
+    // Rounding up may carry into the exponent, which is still the right answer
+    if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+        half++;
+    return uint16_t(half);
+}
+
+float ShadingAttributes::FromHalf(uint16_t half)
+{
+    uint32_t sign = uint32_t(half & 0x8000u) << 16;
+    uint32_t exponent = (half >> 10) & 0x1fu;
+    uint32_t mantissa = half & 0x3ffu;
+    uint32_t bits;
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        }
+        else {
+            // Subnormal, renormalise
+            int shift = 0;
+            while (!(mantissa & 0x400u)) {
+                mantissa <<= 1;
+                shift++;
+            }
+            bits = sign | (uint32_t(127 - 15 + 1 - shift) << 23) | ((mantissa & 0x3ffu) << 13);
+        }
+    }
+    else if (exponent == 31) {
+        bits = sign | 0x7f800000u | (mantissa << 13);
+    }
+    else {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
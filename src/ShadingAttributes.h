@@ -0,0 +1,51 @@
+#ifndef SHADING_ATTRIBUTES_H
+#define SHADING_ATTRIBUTES_H
+
+#include <cstdint>
+#include <vector>
+#include "Cartesian3.h"
+
+// Set to 1 to measure how far every stored attribute is from the value it was
+// made from, updateScene() then prints the largest errors
+#ifndef SHADING_ATTRIBUTE_VALIDATION
+#define SHADING_ATTRIBUTE_VALIDATION 0
+#endif
+
+// Compact store of the per vertex attributes only shading reads.
+// Normals are octahedral encoded into two 16 bit fixed point values and texture
+// coordinates are kept as two half floats, 4 bytes each. Triangles refer to
+// entries by index, so a vertex shared by many triangles is stored once.
+class ShadingAttributes
+{
+public:
+    void clear();
+
+    // Index of a new entry holding direction normal, which need not be unit length
+    uint32_t addNormal(const Cartesian3& normal);
+    // Index of a new entry holding texture coordinates (u, v)
+    uint32_t addUV(float u, float v);
+
+    Cartesian3 normal(uint32_t index) const { return DecodeNormal(normals[index]); }
+    void uv(uint32_t index, float& u, float& v) const {
+        u = FromHalf(uint16_t(uvs[index] & 0xffff));
+        v = FromHalf(uint16_t(uvs[index] >> 16));
+    }
+
+    size_t bytes() const { return (normals.size() + uvs.size()) * sizeof(uint32_t); }
+    // Prints the largest encoding errors seen since clear(), when validation is on
+    void report() const;
+
+    static uint32_t EncodeNormal(const Cartesian3& normal);
+    static Cartesian3 DecodeNormal(uint32_t encoded);
+    static uint16_t ToHalf(float value);
+    static float FromHalf(uint16_t half);
+
+private:
+    std::vector<uint32_t> normals;
+    std::vector<uint32_t> uvs;
+    // Largest angle in degrees between a normal and its decoding, and largest uv difference
+    float maxNormalError = 0.0f;
+    float maxUVError = 0.0f;
+};
+
+#endif // SHADING_ATTRIBUTES_H
@@ -0,0 +1,138 @@
+#include "Texture.h"
+#include "TextureCache.h"
+#include "SRGB.h"
+#include <algorithm>
+#include <fstream>
+#include <cmath>
+
+Texture::Texture(int id, long width, long height):
+    width(width),
+    height(height),
+    id(id),
+    dataOffset(0),
+    unreadable(false)
+{
+    // Level sizes halve, rounding down, until both sides reach one texel
+    long levelWidth = width, levelHeight = height;
+    levels.push_back({levelWidth, levelHeight});
+    while (levelWidth > 1 || levelHeight > 1) {
+        levelWidth = std::max(levelWidth / 2, 1L);
+        levelHeight = std::max(levelHeight / 2, 1L);
+        levels.push_back({levelWidth, levelHeight});
+    }
+}
+
+bool Texture::loadTile(int level, long tileX, long tileY, TextureTile& tile) const
+{
+    const Level& l = levels[level];
+    long firstX = tileX * TEXTURE_CACHE_TILE, firstY = tileY * TEXTURE_CACHE_TILE;
+    long columns = std::min(long(TEXTURE_CACHE_TILE), l.width - firstX);
+    long rows = std::min(long(TEXTURE_CACHE_TILE), l.height - firstY);
+
+    // Texel (x, y) of the level averages the full size texels (x << level, y << level)
+    // up to but not including ((x + 1) << level, (y + 1) << level), cut off at the image's edge
+    long sourceX = firstX << level, sourceY = firstY << level;
+    long sourceColumns = std::min(columns << level, width - sourceX);
+    long sourceRows = std::min(rows << level, height - sourceY);
+    // The last texel of a level whose sides were rounded down takes in what is left
+    if (firstX + columns == l.width)
+        sourceColumns = width - sourceX;
+    if (firstY + rows == l.height)
+        sourceRows = height - sourceY;
+
+    std::vector<float> sums(size_t(columns * rows) * 4, 0.0f);
+    std::vector<float> counts(size_t(columns * rows), 0.0f);
+    std::vector<unsigned char> packed(size_t(sourceColumns) * 3);
+    std::ifstream file;
+    if (!source) {
+        file.open(path, std::ios::in | std::ios::binary);
+        if (!file.good())
+            return false;
+    }
+
+    for (long y = 0; y < sourceRows; y++) {
+        long row = sourceY + y;
+        if (source) {
+            RGBAImage::PackRGB((*source)[int(row)] + sourceX, sourceColumns, packed.data());
+        }
+        else {
+            file.seekg(dataOffset + std::streamoff(row * width + sourceX) * 3);
+            file.read(reinterpret_cast<char*>(packed.data()), std::streamsize(packed.size()));
+            if (file.gcount() != std::streamsize(packed.size()))
+                return false;
+        }
+
+        long texelY = std::min(y >> level, rows - 1);
+        for (long x = 0; x < sourceColumns; x++) {
+            long texel = texelY * columns + std::min(x >> level, columns - 1);
+            sums[4 * texel + 0] += SRGB::decode(packed[3 * x + 0]);
+            sums[4 * texel + 1] += SRGB::decode(packed[3 * x + 1]);
+            sums[4 * texel + 2] += SRGB::decode(packed[3 * x + 2]);
+            counts[texel] += 1.0f;
+        }
+    }
+
+    // Average in linear space, averaging the encoded values would darken every level
+    for (long y = 0; y < rows; y++)
+        for (long x = 0; x < columns; x++) {
+            long texel = y * columns + x;
+            float scale = counts[texel] > 0.0f ? 1.0f / counts[texel] : 0.0f;
+            tile.texel(x, y) = RGBAValue(SRGB::encode(sums[4 * texel + 0] * scale), SRGB::encode(sums[4 * texel + 1] * scale),
+                                         SRGB::encode(sums[4 * texel + 2] * scale));
+        }
+    return true;
+}
+
+Homogeneous4 Texture::bilinear(int level, float u, float v) const
+{
+    const Level& l = levels[level];
+    // Texel centres sit at half integers
+    float x = std::clamp(u, 0.0f, 1.0f) * float(l.width) - 0.5f;
+    float y = std::clamp(v, 0.0f, 1.0f) * float(l.height) - 0.5f;
+    float fx = std::floor(x), fy = std::floor(y);
+    float ax = x - fx, ay = y - fy;
+    long xs[2] = { std::clamp(long(fx), 0L, l.width - 1), std::clamp(long(fx) + 1, 0L, l.width - 1) };
+    long ys[2] = { std::clamp(long(fy), 0L, l.height - 1), std::clamp(long(fy) + 1, 0L, l.height - 1) };
+    float weights[4] = { (1.0f - ax) * (1.0f - ay), ax * (1.0f - ay), (1.0f - ax) * ay, ax * ay };
+
+    // The four texels usually share one tile, it is only fetched again when they do not.
+    // A tile that could not be read adds nothing.
+    TextureCache& cache = TextureCache::instance();
+    const TextureTile* tile = nullptr;
+    long tileX = -1, tileY = -1;
+    Homogeneous4 colour(0.0f, 0.0f, 0.0f, 0.0f);
+    for (int i = 0; i < 4; i++) {
+        long texelX = xs[i & 1], texelY = ys[i >> 1];
+        if (texelX / TEXTURE_CACHE_TILE != tileX || texelY / TEXTURE_CACHE_TILE != tileY) {
+            tileX = texelX / TEXTURE_CACHE_TILE;
+            tileY = texelY / TEXTURE_CACHE_TILE;
+            tile = cache.tile(*this, level, tileX, tileY);
+        }
+        if (!tile)
+            continue;
+        const RGBAValue& texel = tile->texel(texelX % TEXTURE_CACHE_TILE, texelY % TEXTURE_CACHE_TILE);
+        colour.x += weights[i] * SRGB::decode(texel.red);
+        colour.y += weights[i] * SRGB::decode(texel.green);
+        colour.z += weights[i] * SRGB::decode(texel.blue);
+        colour.w += weights[i] * (1.0f / 255.0f) * float(texel.alpha);
+    }
+    return colour;
+}
+
+float Texture::lod(float footprint) const
+{
+    // The footprint in texels of the full size level, averaged over both sides
+    float texels = footprint * std::sqrt(float(width) * float(height));
+    return texels > 1.0f ? std::log2(texels) : 0.0f;
+}
+
+Homogeneous4 Texture::sample(float u, float v, float footprint) const
+{
+    float level = std::min(lod(footprint), float(levels.size() - 1));
+    int fine = int(level);
+    float blend = level - float(fine);
+    Homogeneous4 colour = bilinear(fine, u, v);
+    if (blend > 0.0f && fine + 1 < int(levels.size()))
+        colour = (1.0f - blend) * colour + blend * bilinear(fine + 1, u, v);
+    return colour;
+}
@@ -0,0 +1,81 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <atomic>
+#include <vector>
+#include <string>
+#include <memory>
+#include <iostream>
+#include "RGBAImage.h"
+#include "Homogeneous4.h"
+
+// Texels per side of a storage block, a 4x4 block of 8 bit RGBA fills one 64 byte cache line
+#define TEXTURE_TILE_SIZE 4
+// Texels per side of the tiles the texture cache loads and evicts
+#define TEXTURE_CACHE_TILE 64
+
+// A square of one mip level, the unit the TextureCache keeps resident.
+// Texels are stored in 4x4 blocks so the ones a bilinear lookup needs
+// nearly always share a cache line, whichever direction the surface is walked in.
+struct TextureTile
+{
+    struct alignas(64) Block {
+        RGBAValue texels[TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE];
+    };
+    static constexpr int blocksPerRow = TEXTURE_CACHE_TILE / TEXTURE_TILE_SIZE;
+    Block blocks[blocksPerRow * blocksPerRow];
+
+    // x and y relative to the tile's corner
+    const RGBAValue& texel(long x, long y) const {
+        const Block& block = blocks[(y / TEXTURE_TILE_SIZE) * blocksPerRow + x / TEXTURE_TILE_SIZE];
+        return block.texels[(y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE + x % TEXTURE_TILE_SIZE];
+    }
+    RGBAValue& texel(long x, long y) {
+        return const_cast<RGBAValue&>(static_cast<const TextureTile*>(this)->texel(x, y));
+    }
+};
+
+// An sRGB texture seen as a mip pyramid for filtered lookups. Only the
+// header is read up front, the TextureCache loads the tiles of each level
+// from the file when a lookup first needs them. Each level is the linear
+// space box filter of the full size image. Lookups return linear colour
+// through SRGB::decode.
+class Texture
+{
+public:
+    // Trilinear lookup at (u, v), clamped to [0, 1] like RGBAImage::GetTexel.
+    // footprint is the width in uv units the lookup should be averaged over.
+    Homogeneous4 sample(float u, float v, float footprint) const;
+
+    // Level of detail for a footprint in uv units, 0 is the full size image
+    float lod(float footprint) const;
+
+    long width, height;
+
+private:
+    friend class TextureCache;
+
+    // Textures are only made by the cache
+    Texture(int id, long width, long height);
+
+    struct Level {
+        long width, height;
+    };
+    std::vector<Level> levels;
+
+    // Index of the texture in the cache
+    int id;
+    // Binary files are read a region at a time, anything else stays resident in source
+    std::string path;
+    std::streamoff dataOffset;
+    std::unique_ptr<RGBAImage> source;
+    // Set once a tile failed to load and the failure was reported
+    mutable std::atomic<bool> unreadable;
+
+    // Bilinear lookup within one level, clamped to its edges
+    Homogeneous4 bilinear(int level, float u, float v) const;
+    // Fills tile (tileX, tileY) of a level from the file or the resident source
+    bool loadTile(int level, long tileX, long tileY, TextureTile& tile) const;
+};
+
+#endif // TEXTURE_H
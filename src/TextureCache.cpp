@@ -0,0 +1,208 @@
+#include "TextureCache.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+TextureCache::TextureCache():
+    budget(size_t(TEXTURE_CACHE_BUDGET_MB) << 20),
+    hits(0),
+    misses(0),
+    evictions(0),
+    residentBytes(0)
+{
+}
+
+TextureCache& TextureCache::instance()
+{
+    static TextureCache cache;
+    return cache;
+}
+
+Texture* TextureCache::load(const std::string& path)
+{
+    std::error_code error;
+    std::string canonical = std::filesystem::weakly_canonical(path, error).string();
+    if (error)
+        canonical = path;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // The same file reached by another path, or a hard link to it, is the same texture
+    for (const std::unique_ptr<Texture>& texture : textures)
+        if (!texture->source && (texture->path == canonical || std::filesystem::equivalent(texture->path, canonical, error)))
+            return texture.get();
+
+    std::ifstream file(canonical, std::ios::in | std::ios::binary);
+    bool binary;
+    long width, height;
+    if (!file.good() || !RGBAImage::ReadPPMHeader(file, binary, width, height))
+        return nullptr;
+
+    std::unique_ptr<Texture> texture(new Texture(int(textures.size()), width, height));
+    texture->path = canonical;
+    if (binary) {
+        texture->dataOffset = file.tellg();
+    }
+    else {
+        // ASCII files cannot be read from the middle, so they stay resident
+        file.seekg(0);
+        texture->source.reset(new RGBAImage());
+        if (!texture->source->ReadPPM(file))
+            return nullptr;
+    }
+    textures.push_back(std::move(texture));
+    return textures.back().get();
+}
+
+Texture* TextureCache::adopt(std::istream& stream)
+{
+    std::unique_ptr<RGBAImage> image(new RGBAImage());
+    if (!image->ReadPPM(stream))
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<Texture> texture(new Texture(int(textures.size()), image->width, image->height));
+    texture->source = std::move(image);
+    textures.push_back(std::move(texture));
+    return textures.back().get();
+}
+
+uint64_t TextureCache::key(const Texture& texture, int level, long tileX, long tileY)
+{
+    // Images are at most 65536 texels a side, so at most 1024 tiles
+    return (uint64_t(texture.id) << 32) | (uint64_t(level) << 24) | (uint64_t(tileY) << 12) | uint64_t(tileX);
+}
+
+TextureCache::Shard& TextureCache::shardOf(uint64_t key)
+{
+    // Neighbouring tiles differ in their low bits, mix them in with the texture and level
+    return shards[(key ^ (key >> 12) ^ (key >> 24) ^ (key >> 32)) % TEXTURE_CACHE_SHARDS];
+}
+
+// The tiles a render thread looked up last, replaced in turn
+struct ThreadTiles {
+    uint64_t keys[TEXTURE_THREAD_TILES];
+    std::shared_ptr<const TextureTile> tiles[TEXTURE_THREAD_TILES];
+    int next = 0;
+    // Hits not yet added to the cache's count, which every thread would otherwise write to
+    size_t hits = 0;
+
+    ThreadTiles() { std::fill(keys, keys + TEXTURE_THREAD_TILES, ~uint64_t(0)); }
+};
+static thread_local ThreadTiles threadTiles;
+
+const TextureTile* TextureCache::tile(const Texture& texture, int level, long tileX, long tileY)
+{
+    uint64_t k = key(texture, level, tileX, tileY);
+    ThreadTiles& local = threadTiles;
+    for (int i = 0; i < TEXTURE_THREAD_TILES; i++)
+        if (local.keys[i] == k) {
+            // Counted now and then, so the count is close without a shared write per lookup
+            if (++local.hits == 1024) {
+                hits += local.hits;
+                local.hits = 0;
+            }
+            return local.tiles[i].get();
+        }
+    hits += local.hits;
+    local.hits = 0;
+
+    std::shared_ptr<const TextureTile> found = shared(texture, level, tileX, tileY, k);
+    if (!found)
+        return nullptr;
+    int slot = local.next;
+    local.next = (local.next + 1) % TEXTURE_THREAD_TILES;
+    local.keys[slot] = k;
+    local.tiles[slot] = std::move(found);
+    return local.tiles[slot].get();
+}
+
+std::shared_ptr<const TextureTile> TextureCache::shared(const Texture& texture, int level, long tileX, long tileY, uint64_t k)
+{
+    Shard& shard = shardOf(k);
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto found = shard.tiles.find(k);
+        if (found != shard.tiles.end()) {
+            hits++;
+            found->second.referenced.store(true, std::memory_order_relaxed);
+            return found->second.tile;
+        }
+    }
+    misses++;
+
+    // Load without holding the lock, so other threads keep hitting while the file is read
+    std::shared_ptr<TextureTile> loaded = std::make_shared<TextureTile>();
+    if (!texture.loadTile(level, tileX, tileY, *loaded)) {
+        // Once per texture, a file that went missing would otherwise fill the log
+        if (!texture.unreadable.exchange(true))
+            std::cerr << "Could not read a tile of texture " << texture.path << std::endl;
+        return nullptr;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    // Another thread may have loaded the same tile meanwhile
+    auto [entry, inserted] = shard.tiles.try_emplace(k);
+    if (!inserted)
+        return entry->second.tile;
+    entry->second.tile = loaded;
+    entry->second.referenced.store(true, std::memory_order_relaxed);
+    shard.clock.push_back(k);
+    residentBytes += sizeof(TextureTile);
+    evict(shard, k);
+    return loaded;
+}
+
+void TextureCache::evict(Shard& shard, uint64_t keep)
+{
+    size_t limit = budget / TEXTURE_CACHE_SHARDS;
+    // A full turn of the hand clears every bit, so the loop ends within two turns
+    while (shard.clock.size() * sizeof(TextureTile) > limit && shard.clock.size() > 1) {
+        if (shard.hand >= shard.clock.size())
+            shard.hand = 0;
+        uint64_t k = shard.clock[shard.hand];
+        auto entry = shard.tiles.find(k);
+        if (k == keep || entry->second.referenced.exchange(false, std::memory_order_relaxed)) {
+            shard.hand++;
+            continue;
+        }
+        // The last key takes the evicted one's place, so the hand looks at it next
+        shard.tiles.erase(entry);
+        shard.clock[shard.hand] = shard.clock.back();
+        shard.clock.pop_back();
+        residentBytes -= sizeof(TextureTile);
+        evictions++;
+    }
+}
+
+void TextureCache::setBudget(size_t bytes)
+{
+    budget = bytes;
+    for (Shard& shard : shards) {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        evict(shard, ~uint64_t(0));
+    }
+}
+
+TextureCache::Stats TextureCache::stats() const
+{
+    Stats s;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        s.textures = textures.size();
+    }
+    s.hits = hits;
+    s.misses = misses;
+    s.evictions = evictions;
+    s.residentBytes = residentBytes;
+    return s;
+}
+
+void TextureCache::printStats() const
+{
+    Stats s = stats();
+    size_t limit = budget;
+    size_t lookups = s.hits + s.misses;
+    std::cout << "Texture cache: " << s.textures << " textures, " << s.hits << " hits, " << s.misses << " misses ("
+              << (lookups > 0 ? 100.0 * double(s.hits) / double(lookups) : 0.0) << "% hit rate), "
+              << s.evictions << " evictions, " << (s.residentBytes >> 20) << " of " << (limit >> 20) << " MB resident" << std::endl;
+}
@@ -0,0 +1,95 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Texture.h"
+
+// Default memory budget for resident texture tiles, in megabytes
+#define TEXTURE_CACHE_BUDGET_MB 256
+// Independently locked parts the tiles are spread over by key, each with its share of the budget
+#define TEXTURE_CACHE_SHARDS 16
+// Tiles each render thread keeps from its own latest lookups, so that most lookups take no lock
+#define TEXTURE_THREAD_TILES 4
+
+// Process wide store of every texture the scene references. Files are
+// opened once per path, however many materials name them, and only their
+// headers are read up front. Tiles of the mip levels are loaded the first time
+// a lookup touches them and evicted once the resident tiles outgrow the memory
+// budget, by the clock algorithm: a hit only sets the tile's reference bit, and
+// eviction passes over tiles whose bit is set once, clearing it, before taking
+// one. Safe to use from every render thread.
+//
+// Render threads mostly look up the few tiles they looked up last, so each
+// thread keeps those to itself and only goes to the shared tiles on a miss.
+// The shared tiles are sharded by key, so threads missing at once seldom wait
+// on the same lock.
+class TextureCache
+{
+public:
+    static TextureCache& instance();
+
+    // The texture for an image file, shared with every other material naming the same file.
+    // nullptr if it cannot be read.
+    Texture* load(const std::string& path);
+    // A texture read completely from a stream, it has no file to load tiles from later
+    Texture* adopt(std::istream& stream);
+
+    // The tile of a texture's level, loaded if it is not resident. The pointer
+    // stays valid until the calling thread has looked up TEXTURE_THREAD_TILES
+    // other tiles, even if the cache evicts the tile meanwhile. nullptr if the
+    // tile could not be read, which is not cached so the next lookup tries again.
+    const TextureTile* tile(const Texture& texture, int level, long tileX, long tileY);
+
+    // Bytes of tiles that may stay resident
+    void setBudget(size_t bytes);
+
+    struct Stats {
+        size_t textures;
+        size_t hits;
+        size_t misses;
+        size_t evictions;
+        size_t residentBytes;
+    };
+    Stats stats() const;
+    void printStats() const;
+
+private:
+    TextureCache();
+
+    struct Entry {
+        std::shared_ptr<const TextureTile> tile;
+        // Set by hits under the shard's shared lock, cleared by the clock hand
+        mutable std::atomic<bool> referenced;
+    };
+
+    struct Shard {
+        std::shared_mutex mutex;
+        std::unordered_map<uint64_t, Entry> tiles;
+        // Keys of the resident tiles in the order the clock hand visits them
+        std::vector<uint64_t> clock;
+        size_t hand = 0;
+    };
+
+    // Texture, level and tile packed into one key
+    static uint64_t key(const Texture& texture, int level, long tileX, long tileY);
+    Shard& shardOf(uint64_t key);
+    // Evicts tiles of shard, other than keep, until it is within its share of the budget
+    void evict(Shard& shard, uint64_t keep);
+    std::shared_ptr<const TextureTile> shared(const Texture& texture, int level, long tileX, long tileY, uint64_t key);
+
+    // Guards textures
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Texture>> textures;
+    Shard shards[TEXTURE_CACHE_SHARDS];
+    std::atomic<size_t> budget;
+    std::atomic<size_t> hits, misses, evictions, residentBytes;
+};
+
+#endif // TEXTURE_CACHE_H
@@ -0,0 +1,122 @@
+#include "Topology.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#define NODE_DIRECTORY "/sys/devices/system/node"
+
+// Set by Pin() for the thread it is called on
+static thread_local int pinnedNode = -1;
+
+Topology::Topology()
+{
+    // node0, node1... each list the CPUs they hold, nodes with memory but no CPUs are left out
+    std::vector<std::pair<int, std::vector<int>>> found;
+    std::error_code error;
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(NODE_DIRECTORY, error)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() <= 4 || name.compare(0, 4, "node") != 0 || name.find_first_not_of("0123456789", 4) != std::string::npos)
+            continue;
+        std::ifstream file(entry.path() / "cpulist");
+        std::string list;
+        std::getline(file, list);
+        std::vector<int> cpus = ParseCPUList(list);
+        if (!cpus.empty())
+            found.push_back({ std::stoi(name.substr(4)), cpus });
+    }
+    std::sort(found.begin(), found.end());
+    for (auto& node : found)
+        nodes.push_back(node.second);
+
+    if (nodes.empty()) {
+        nodes.push_back({});
+        int cpus = std::max(int(std::thread::hardware_concurrency()), 1);
+        for (int cpu = 0; cpu < cpus; cpu++)
+            nodes[0].push_back(cpu);
+    }
+}
+
+const Topology& Topology::System()
+{
+    static Topology topology;
+    return topology;
+}
+
+int Topology::nodesInUse(int requested) const
+{
+    return requested > 0 ? std::min(requested, int(nodes.size())) : int(nodes.size());
+}
+
+int Topology::threadCount(int requested, int nodeCount) const
+{
+    if (requested > 0)
+        return requested;
+    int cpus = 0;
+    for (int node = 0; node < nodeCount; node++)
+        cpus += int(nodes[node].size());
+    return cpus;
+}
+
+int Topology::nodeOf(int thread, int threads, int nodeCount) const
+{
+    return int((long long)thread * nodeCount / threads);
+}
+
+int Topology::cpuOf(int thread, int threads, int nodeCount) const
+{
+    int node = nodeOf(thread, threads, nodeCount);
+    // Threads from the node's first one on take its CPUs in turn
+    int first = int(((long long)node * threads + nodeCount - 1) / nodeCount);
+    const std::vector<int>& cpus = nodes[node];
+    return cpus[size_t(thread - first) % cpus.size()];
+}
+
+bool Topology::Pin(int cpu, int node)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        return false;
+    pinnedNode = node;
+    return true;
+#else
+    (void)cpu;
+    (void)node;
+    return false;
+#endif
+}
+
+int Topology::CurrentNode()
+{
+    return pinnedNode;
+}
+
+std::vector<int> Topology::ParseCPUList(const std::string& list)
+{
+    std::vector<int> cpus;
+    size_t position = 0;
+    while (position < list.size()) {
+        size_t end = list.find(',', position);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string range = list.substr(position, end - position);
+        int first, last;
+        int fields = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (fields == 1)
+            last = first;
+        if (fields >= 1)
+            for (int cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        position = end + 1;
+    }
+    return cpus;
+}
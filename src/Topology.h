@@ -0,0 +1,42 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <string>
+#include <vector>
+
+// The machine's NUMA nodes and the CPUs in each, and where render threads go
+// on them. Threads are handed out node by node, so on a machine with two
+// sockets the first half of a render's threads run on the first and the rest
+// on the second. Memory a pinned thread touches first is placed on its node.
+class Topology
+{
+public:
+    // CPUs of each node as the operating system reports them. Where it does not,
+    // one node holds every CPU.
+    std::vector<std::vector<int>> nodes;
+
+    static const Topology& System();
+
+    // Nodes a render uses when asked for requested, 0 meaning all of them
+    int nodesInUse(int requested) const;
+    // Threads a render runs when asked for requested over the nodes in use,
+    // 0 meaning one for each of their CPUs
+    int threadCount(int requested, int nodeCount) const;
+    // Node and CPU of thread of threads spread over nodeCount nodes
+    int nodeOf(int thread, int threads, int nodeCount) const;
+    int cpuOf(int thread, int threads, int nodeCount) const;
+
+    // Pins the calling thread to cpu and remembers node for CurrentNode().
+    // false where threads cannot be pinned, the thread then runs anywhere.
+    static bool Pin(int cpu, int node);
+    // Node the calling thread was pinned to, -1 if it was not
+    static int CurrentNode();
+
+    // Parses a list of CPUs such as "0-3,8-11"
+    static std::vector<int> ParseCPUList(const std::string& list);
+
+private:
+    Topology();
+};
+
+#endif // TOPOLOGY_H
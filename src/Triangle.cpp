@@ -5,7 +5,8 @@
 Triangle::Triangle()
 {
     triangle_id = -1;
-    shared_material= nullptr;
+    materialID = 0;
+    materialFlags = 0;
 }
 
 
@@ -17,7 +18,7 @@ bool Triangle::isValid(){
     return triangle_id != -1;
 }
 
-float Triangle::intersect(Ray ray) {
+float Triangle::intersect(const Ray& ray) const {
     // Extract the vertices of a triangle
     Cartesian3 A = verts[0].Point();
     Cartesian3 B = verts[1].Point();
@@ -54,6 +55,34 @@ float Triangle::intersect(Ray ray) {
     return -1.0f; // not within triangle
 }
 
+void Triangle::intersect(const RayPacket& packet, const int* lanes, float* t) const {
+    // Per triangle values are shared by every lane
+    Cartesian3 A = verts[0].Point();
+    Cartesian3 B = verts[1].Point();
+    Cartesian3 C = verts[2].Point();
+    PacketVec3 a(A), b(B), c(C);
+    PacketVec3 normal((B - A).cross(C - A));
+    PacketVec3 edge1(B - A);
+    PacketVec3 edge2(C - B);
+    PacketVec3 edge3(A - C);
+    PacketFloat zero(0.0f);
+
+    // Same half plane test as the single ray version, one ray per SIMD lane
+    for (int base = 0; base < PACKET_SIZE; base += PacketFloat::width) {
+        PacketVec3 origin = PacketVec3::load(packet.originX + base, packet.originY + base, packet.originZ + base);
+        PacketVec3 direction = PacketVec3::load(packet.directionX + base, packet.directionY + base, packet.directionZ + base);
+
+        PacketFloat tPlane = (a - origin).dot(normal) / direction.dot(normal);
+        PacketVec3 intersectionPoint = origin + direction * tPlane;
+
+        PacketFloat hit = PacketFloat::fromLanes(lanes + base) & (tPlane >= zero)
+                        & (edge1.cross(intersectionPoint - a).dot(normal) >= zero)
+                        & (edge2.cross(intersectionPoint - b).dot(normal) >= zero)
+                        & (edge3.cross(intersectionPoint - c).dot(normal) >= zero);
+        select(hit, tPlane, PacketFloat(-1.0f)).store(t + base);
+    }
+}
+
 Cartesian3 Triangle::barycentric(Cartesian3 o) {
     Cartesian3 bc;
 
@@ -77,10 +106,9 @@ Cartesian3 Triangle::barycentric(Cartesian3 o) {
     return bc;
 }
 
-Homogeneous4 Triangle::phong(Homogeneous4 lightPos, Homogeneous4 lightColour, Cartesian3 barycentric, bool inShadow) {
+Homogeneous4 Triangle::phong(const MaterialData& material, Homogeneous4 lightPos, Homogeneous4 lightColour, Cartesian3 barycentric, const Cartesian3& normal, bool inShadow, const Cartesian3& albedo) {
     if (inShadow) return Homogeneous4(0, 0, 0, 0);
 
-    Cartesian3 normal = (barycentric.x * normals[0].Vector() + barycentric.y * normals[1].Vector() + barycentric.z * normals[2].Vector()).unit();
     Cartesian3 hitPos = barycentric.x * verts[0].Vector() + barycentric.y * verts[1].Vector() + barycentric.z * verts[2].Vector();
     Cartesian3 l = (lightPos.Point() - hitPos).unit();
     Cartesian3 e = Cartesian3(-hitPos.x, -hitPos.y, -hitPos.z).unit();
@@ -88,24 +116,44 @@ Homogeneous4 Triangle::phong(Homogeneous4 lightPos, Homogeneous4 lightColour, Ca
     // Diffuse
     float cosTheta = std::clamp(normal.dot(l), 0.0f, 1.0f);
     Cartesian3 diffuse = Cartesian3(
-        shared_material->diffuse.x * lightColour.x,
-        shared_material->diffuse.y * lightColour.y,
-        shared_material->diffuse.z * lightColour.z) * cosTheta;
+        material.diffuse.x * albedo.x * lightColour.x,
+        material.diffuse.y * albedo.y * lightColour.y,
+        material.diffuse.z * albedo.z * lightColour.z) * cosTheta;
     //Cartesian3 ambient = Cartesian3(
-    //    shared_material->ambient.x * lightColour.x,
-    //    shared_material->ambient.y * lightColour.y,
-    //    shared_material->ambient.z * lightColour.z);
+    //    material.ambient.x * lightColour.x,
+    //    material.ambient.y * lightColour.y,
+    //    material.ambient.z * lightColour.z);
 
     // Specular
     Cartesian3 B = (l + e).unit();
     float cosB = std::clamp(normal.dot(B), 0.0f, 1.0f);
-    cosB = std::clamp(std::pow(cosB, shared_material->shininess), 0.0f, 1.0f);
-    cosB = cosB * cosTheta * (shared_material->shininess + 2.0f) / (2.0f * 3.14159265359f);
+    cosB = std::clamp(std::pow(cosB, material.shininess), 0.0f, 1.0f);
+    cosB = cosB * cosTheta * (material.shininess + 2.0f) / (2.0f * 3.14159265359f);
     Cartesian3 specular = Cartesian3(
-        shared_material->specular.x * lightColour.x,
-        shared_material->specular.y * lightColour.y,
-        shared_material->specular.z * lightColour.z) * cosB;
+        material.specular.x * lightColour.x,
+        material.specular.y * lightColour.y,
+        material.specular.z * lightColour.z) * cosB;
 
     //if (inShadow) return Homogeneous4(ambient);
     return Homogeneous4(diffuse + specular);
-}
\ No newline at end of file
+}
+Cartesian3 Triangle::albedo(const Cartesian3& bary, float coneWidth, const Cartesian3& direction, const Texture* texture, const float* us, const float* vs) const {
+    if (texture == nullptr)
+        return Cartesian3(1.0f, 1.0f, 1.0f);
+
+    // The cone's width on the surface grows as it meets it at a glancing angle,
+    // and uv space is scaled against world space by the ratio of the triangle's areas
+    Cartesian3 edge1 = verts[1].Point() - verts[0].Point();
+    Cartesian3 edge2 = verts[2].Point() - verts[0].Point();
+    Cartesian3 geometricNormal = edge1.cross(edge2);
+    float worldArea = geometricNormal.length();
+    float uvArea = std::abs((us[1] - us[0]) * (vs[2] - vs[0]) - (us[2] - us[0]) * (vs[1] - vs[0]));
+    float cosine = std::max(std::abs(direction.unit().dot(geometricNormal)) / worldArea, 0.05f);
+    float footprint = worldArea > 0.0f ? coneWidth / cosine * std::sqrt(uvArea / worldArea) : 0.0f;
+
+    // OBJ puts v = 0 at the bottom of the image, the texture's first row is its top
+    float u = bary.x * us[0] + bary.y * us[1] + bary.z * us[2];
+    float v = bary.x * vs[0] + bary.y * vs[1] + bary.z * vs[2];
+    Homogeneous4 texel = texture->sample(u, 1.0f - v, footprint);
+    return Cartesian3(texel.x, texel.y, texel.z);
+}
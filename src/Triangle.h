@@ -3,7 +3,8 @@
 
 #include "Homogeneous4.h"
 #include "Ray.h"
-#include "Material.h"
+#include "RayPacket.h"
+#include "MaterialTable.h"
 #include "RGBAImage.h"
 
 class Triangle
@@ -13,19 +14,29 @@ class Triangle
 public:
     int triangle_id;
     Homogeneous4 verts[3];
-    Homogeneous4 normals[3];
-    Homogeneous4 colors[3];
-    Cartesian3 uvs[3];
+    // Per vertex entries in the scene's ShadingAttributes
+    uint32_t normals[3];
+    uint32_t uvs[3];
 
-    Material *shared_material;
+    // Index into the scene's MaterialTable and that material's MATERIAL_ flags
+    uint16_t materialID;
+    uint16_t materialFlags;
 
     Triangle();
     void validate(int id);
     bool isValid();
 
-    float intersect(Ray ray);
+    float intersect(const Ray& ray) const;
+    // Same test for every lane flagged in lanes, t[lane] is -1 on a miss
+    void intersect(const RayPacket& packet, const int* lanes, float* t) const;
     Cartesian3 barycentric(Cartesian3 o);
-    Homogeneous4 phong(Homogeneous4 lightPos, Homogeneous4 lightColour, Cartesian3 intersection, bool inShadow);
+    // Shades the point at barycentric coordinates intersection, whose interpolated normal is normal.
+    // albedo scales the diffuse term, it is the texture colour on textured materials
+    Homogeneous4 phong(const MaterialData& material, Homogeneous4 lightPos, Homogeneous4 lightColour, Cartesian3 intersection, const Cartesian3& normal, bool inShadow, const Cartesian3& albedo = Cartesian3(1.0f, 1.0f, 1.0f));
+    // Linear colour of texture at barycentric coordinates bary, filtered over the
+    // footprint of a ray cone coneWidth wide arriving along direction. White when texture is null.
+    // us and vs are the texture coordinates of the three vertices.
+    Cartesian3 albedo(const Cartesian3& bary, float coneWidth, const Cartesian3& direction, const Texture* texture, const float* us, const float* vs) const;
 
 };
 
@@ -4,6 +4,12 @@
 #include <fstream>
 #include <sstream>
 #include <array>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
 
 // External libraries
 #include <GL/glew.h>
@@ -12,6 +18,13 @@
 // Our files
 #include "ThreeDModel.h"
 #include "Raytracer.h"
+#include "ImageWriter.h"
+#include "TextureCache.h"
+#include "PostProcess.h"
+#include "RenderJob.h"
+#include "RenderCoordinator.h"
+#include "RenderWorker.h"
+#include "Checkpoint.h"
 
 // Global variables
 GLFWwindow* window;
@@ -62,6 +75,42 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		renderParameters.orthoProjection = !renderParameters.orthoProjection;
 		
 	}
+	if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+		renderParameters.fastBVHBuild = !renderParameters.fastBVHBuild;
+		renderParameters.printSettings();
+	}
+	if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+		renderParameters.irradianceCaching = !renderParameters.irradianceCaching;
+		renderParameters.printSettings();
+	}
+	if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+		renderParameters.caustics = !renderParameters.caustics;
+		renderParameters.printSettings();
+	}
+	if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+		renderParameters.temporalReuse = !renderParameters.temporalReuse;
+		renderParameters.printSettings();
+	}
+	// Focus keys, they apply from the next render
+	if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+		renderParameters.focus = RenderParameters::Focus((renderParameters.focus + 1) % 3);
+		renderParameters.printSettings();
+	}
+	if ((key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET) && action == GLFW_PRESS) {
+		renderParameters.focusSize = std::clamp(key == GLFW_KEY_RIGHT_BRACKET ? renderParameters.focusSize * 2 : renderParameters.focusSize / 2, 16, 2048);
+		renderParameters.printSettings();
+	}
+	// Post-process keys, the last render is developed again straight away
+	if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+		renderParameters.toneMap = RenderParameters::ToneMap((renderParameters.toneMap + 1) % 3);
+		renderParameters.printSettings();
+		raytracer->Develop();
+	}
+	if ((key == GLFW_KEY_EQUAL || key == GLFW_KEY_MINUS) && action != GLFW_RELEASE) {
+		renderParameters.exposure += key == GLFW_KEY_EQUAL ? 0.5f : -0.5f;
+		renderParameters.printSettings();
+		raytracer->Develop();
+	}
 
 	if (key == GLFW_KEY_W){
 		if(action == GLFW_PRESS)
@@ -111,6 +160,12 @@ void mousePosCallback(GLFWwindow* window, double x, double y) {
 		renderParameters.CameraArcball.ContinueDrag(scaledX, scaledY);
 	if ((movementKeys & std::byte{ BIT_RIGHTMOUSE }) != std::byte{ 0 })
 		renderParameters.ModelArcball.ContinueDrag(scaledX, scaledY);
+
+	// Both halves show the same view, so the cursor over either picks the raytracer's focus.
+	// The raytraced image has its first row at the bottom.
+	int halfWidth = std::max(windowWidth / 2, 1);
+	if (raytracer)
+		raytracer->setFocus(int(x) % halfWidth, windowHeight - 1 - int(y));
 }
 
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
@@ -352,16 +407,214 @@ void loadScreenspaceTexture() {
 	glBindTexture(GL_TEXTURE_2D, -1);
 }
 
+// Options that say how a render uses this machine's processors, shared by batch renders and workers
+bool placementOption(const std::string& option, const std::string& value, RenderParameters& parameters) {
+	if (option == "-j")
+		parameters.threads = atoi(value.c_str());
+	else if (option == "-n")
+		parameters.numaNodes = atoi(value.c_str());
+	else if (option == "-a") {
+		parameters.pinThreads = value == "pin" || value == "replicate";
+		parameters.replicateScene = value == "replicate";
+	}
+	else
+		return false;
+	return true;
+}
+
+// Renders one frame without opening a window and streams it to a P6 or PFM file.
+// options holds the arguments after geometry and material.
+int renderBatch(std::vector<ThreeDModel>& objects, const char* geometryPath, const char* materialPath, int nOptions, char** options) {
+	std::string output, listenAddress, checkpoint;
+	int tileSeconds = DISTRIBUTED_TILE_SECONDS;
+	std::vector<std::string> merges;
+	long width = long(windowWidth / 2.0f), height = windowHeight;
+	for (int i = 0; i + 1 < nOptions; i += 2) {
+		std::string option = options[i], value = options[i + 1];
+		if (placementOption(option, value, renderParameters))
+			continue;
+		else if (option == "-o")
+			output = value;
+		else if (option == "-s")
+			sscanf(value.c_str(), "%ldx%ld", &width, &height);
+		else if (option == "-p")
+			renderParameters.monteCarloPasses = atoi(value.c_str());
+		else if (option == "-e")
+			renderParameters.exposure = float(atof(value.c_str()));
+		else if (option == "-l")
+			listenAddress = value;
+		else if (option == "-d")
+			tileSeconds = atoi(value.c_str());
+		else if (option == "-r")
+			renderParameters.seed = unsigned(strtoul(value.c_str(), nullptr, 10));
+		else if (option == "-k")
+			checkpoint = value;
+		else if (option == "-m")
+			merges.push_back(value);
+		else if (option == "-c")
+			TextureCache::instance().setBudget(size_t(atol(value.c_str())) << 20);
+		else if (option == "-t")
+			renderParameters.toneMap = value == "aces" ? RenderParameters::aces : value == "reinhard" ? RenderParameters::reinhard : RenderParameters::none;
+		else if (option == "-f") {
+			// The same characters as the keys that toggle each setting
+			for (char c : value) {
+				if (c == '1') renderParameters.interpolationRendering = true;
+				if (c == '2') renderParameters.phongEnabled = true;
+				if (c == '3') renderParameters.shadowsEnabled = true;
+				if (c == '4') renderParameters.reflectionEnabled = true;
+				if (c == '5') renderParameters.refractionEnabled = true;
+				if (c == '6') renderParameters.fresnelRendering = true;
+				if (c == '7') renderParameters.monteCarloEnabled = true;
+				if (c == 'P' || c == 'p') renderParameters.orthoProjection = true;
+				if (c == 'B' || c == 'b') renderParameters.fastBVHBuild = true;
+				if (c == 'I' || c == 'i') renderParameters.irradianceCaching = true;
+				if (c == 'C' || c == 'c') renderParameters.caustics = true;
+			}
+		}
+	}
+	if (output.empty() || width < 1 || height < 1) {
+		std::cout << "Batch rendering needs -o file.ppm or file.pfm and a valid -s WIDTHxHEIGHT" << std::endl;
+		return 1;
+	}
+	renderParameters.printSettings();
+
+	ImageWriter writer;
+	if (!writer.open(output, width, height)) {
+		std::cout << "Could not open " << output << " for writing" << std::endl;
+		return 1;
+	}
+	float exposureScale = std::exp2(renderParameters.exposure);
+	RenderJob job = RenderJob::For(geometryPath, materialPath, width, height);
+	uint64_t fingerprint = job.fingerprint(renderParameters);
+
+	if (!listenAddress.empty()) {
+		// Workers trace the tiles, the frame here only holds what they send back
+		RGBAImage frameBuffer;
+		RGBAFloatImage hdrBuffer;
+		if (!frameBuffer.Resize(width, height) || !hdrBuffer.Resize(width, height))
+			return 1;
+		if (!checkpoint.empty() || !merges.empty())
+			std::cout << "Checkpoints are not used by distributed renders" << std::endl;
+		// Each worker would cache the light of its own tiles only, records near a tile's
+		// edge would differ from its neighbour's and every pass would reuse them
+		if (renderParameters.irradianceCaching) {
+			std::cout << "Irradiance caching is not used by distributed renders" << std::endl;
+			renderParameters.irradianceCaching = false;
+		}
+		RenderCoordinator coordinator;
+		coordinator.tileSeconds = std::max(tileSeconds, 1);
+		coordinator.tileFinished = [&](int firstRow, int rows, const float* rgb) {
+			hdrBuffer.UnpackRGB(long(firstRow) * width, long(rows) * width, rgb);
+			PostProcess::develop(hdrBuffer, long(firstRow) * width, long(rows) * width, 1.0f, renderParameters.exposure, renderParameters.toneMap, frameBuffer);
+			writer.writeRows(firstRow, rows, frameBuffer, hdrBuffer, exposureScale);
+		};
+		if (!coordinator.run(listenAddress, job.serialize(renderParameters), width, height))
+			return 1;
+	}
+	else if (!merges.empty()) {
+		// Adds up the samples of independent runs of this frame, nothing is traced
+		RGBAImage frameBuffer;
+		RGBAFloatImage hdrBuffer;
+		SampleStatistics statistics;
+		if (!frameBuffer.Resize(width, height) || !hdrBuffer.Resize(width, height) || !statistics.Resize(width, height))
+			return 1;
+		Checkpoint::Header merged = { fingerprint, 0, renderParameters.seed, width, height };
+		std::vector<unsigned> seeds;
+		for (size_t m = 0; m < merges.size(); m++) {
+			Checkpoint::Header header;
+			if (!Checkpoint::Load(merges[m], header, hdrBuffer, statistics, m > 0) || header.fingerprint != fingerprint) {
+				std::cout << merges[m] << " is not a checkpoint of this frame" << std::endl;
+				return 1;
+			}
+			if (std::find(seeds.begin(), seeds.end(), header.seed) != seeds.end())
+				std::cout << "Warning: " << merges[m] << " was rendered with seed " << header.seed << " like an earlier checkpoint, their samples repeat" << std::endl;
+			seeds.push_back(header.seed);
+			merged.seed = m == 0 ? header.seed : merged.seed;
+			merged.passes += header.passes;
+		}
+		std::cout << "Merged " << merges.size() << " checkpoints, " << merged.passes << " passes, mean standard error "
+			<< statistics.meanStandardError(hdrBuffer) << std::endl;
+		if (!checkpoint.empty() && !Checkpoint::Save(checkpoint, merged, hdrBuffer, statistics)) {
+			std::cout << "Writing checkpoint " << checkpoint << " failed" << std::endl;
+			return 1;
+		}
+		// Runs of different lengths leave every pixel with its own sample count
+		statistics.average(hdrBuffer);
+		PostProcess::develop(hdrBuffer, 0, width * height, 1.0f, renderParameters.exposure, renderParameters.toneMap, frameBuffer);
+		writer.writeRows(0, height, frameBuffer, hdrBuffer, exposureScale);
+	}
+	else {
+		raytracer = new Raytracer(&objects, &renderParameters);
+		if (!raytracer->resize(int(width), int(height)))
+			return 1;
+		// Rows go to the file as soon as their last pass is developed
+		raytracer->bandFinished = [&](int firstRow, int rows, float scale) {
+			writer.writeRows(firstRow, rows, raytracer->frameBuffer, raytracer->hdrBuffer, scale * exposureScale);
+		};
+
+		// The accumulation is saved every few minutes, running the same command again picks it up
+		auto saveCheckpoint = [&](int passes) {
+			Checkpoint::Header header = { fingerprint, uint32_t(passes), renderParameters.seed, width, height };
+			if (Checkpoint::Save(checkpoint, header, raytracer->hdrBuffer, raytracer->statistics))
+				std::cout << "Checkpoint " << checkpoint << ": " << passes << " passes, mean standard error "
+					<< raytracer->statistics.meanStandardError(raytracer->hdrBuffer) << std::endl;
+			else
+				std::cout << "Writing checkpoint " << checkpoint << " failed" << std::endl;
+		};
+		auto lastSave = std::chrono::steady_clock::now();
+		if (!checkpoint.empty())
+			raytracer->passFinished = [&](int passes) {
+				if (std::chrono::steady_clock::now() - lastSave < std::chrono::seconds(CHECKPOINT_INTERVAL_SECONDS))
+					return;
+				saveCheckpoint(passes);
+				lastSave = std::chrono::steady_clock::now();
+			};
+
+		if (!checkpoint.empty() && std::filesystem::exists(checkpoint)) {
+			if (!raytracer->Resume(checkpoint, fingerprint)) {
+				std::cout << checkpoint << " is not a checkpoint of this frame, move it away to start over" << std::endl;
+				return 1;
+			}
+		}
+		else {
+			raytracer->Raytrace();
+		}
+		raytracer->waitForRaytracer();
+		if (!checkpoint.empty())
+			saveCheckpoint(raytracer->PassesDone());
+		if (TextureCache::instance().stats().textures > 0)
+			TextureCache::instance().printStats();
+	}
+
+	if (!writer.close()) {
+		std::cout << "Writing " << output << " failed" << std::endl;
+		return 1;
+	}
+	std::cout << "Wrote " << output << std::endl;
+	return 0;
+}
+
 int main(int argc, char**argv) {
-	if (argc != 3) { // bad arg count
+	// A worker gets its scene and settings from the coordinator
+	if (argc >= 3 && argc % 2 == 1 && std::string(argv[1]) == "-w") {
+		RenderParameters machine;
+		for (int i = 3; i + 1 < argc; i += 2)
+			placementOption(argv[i], argv[i + 1], machine);
+		return RenderWorker::run(argv[2], machine);
+	}
+
+	if (argc < 3 || (argc > 3 && argc % 2 == 0)) { // bad arg count
 		// print an error message
-		std::cout << "Usage: " << argv[0] << " geometry material" << std::endl;
+		std::cout << "Usage: " << argv[0] << " geometry material [-o image.ppm|image.pfm [-s WIDTHxHEIGHT] [-f settings] [-p passes] [-e exposure] [-t none|reinhard|aces] [-c texture cache MB] [-r seed] [-k checkpoint] [-m checkpoint]... [-l host:port|unix:path [-d seconds]] [-j threads] [-n NUMA nodes] [-a none|pin|replicate]]" << std::endl;
+		std::cout << "       " << argv[0] << " -w host:port|unix:path [-j threads] [-n NUMA nodes] [-a none|pin|replicate]" << std::endl;
 		// and leave
 		return 0;
 	}
+	// Any options after the files ask for a render straight to a file, without a window
+	bool batch = argc > 3;
 
 	// Try intialise GLFW and GLEW
-	if (!initializeGL()) return -1;
+	if (!batch && !initializeGL()) return -1;
 
 	std::vector<ThreeDModel> objects;
 	std::ifstream geometryFile(argv[1]);
@@ -387,6 +640,9 @@ int main(int argc, char**argv) {
 	renderParameters.findLights(objects);
 	std::cout << renderParameters.lights.size() << std::endl;
 
+	if (batch)
+		return renderBatch(objects, argv[1], argv[2], argc - 3, argv + 3);
+
 	std::vector<GLuint> vaoIDs;
 	std::vector<GLuint> vbIDs;
 	std::vector<GLuint> nbIDs;
@@ -421,6 +677,14 @@ int main(int argc, char**argv) {
 	double lastTime = glfwGetTime();
 	int nbFrames = 0;
 
+	// Once something has been rendered, moving the camera renders the new view
+	// starting from the samples of the last one that are still in sight, and
+	// every render shows a coarse preview of its first pass within milliseconds
+	renderParameters.temporalReuse = true;
+	renderParameters.progressivePreview = true;
+	bool rendered = false;
+	Matrix4 renderedModelview;
+
 	do {
 		double currentTime = glfwGetTime();
 		float deltaTime = float(currentTime - lastTime);
@@ -510,9 +774,16 @@ int main(int argc, char**argv) {
 		glBindVertexArray(raytracerVAO);
 		glDrawArrays(GL_TRIANGLES, 0, 3);
 
+		Matrix4 modelview = renderParameters.getViewMatrix() * renderParameters.getModelMatrix();
 		if (launchRaytracer) {
 			raytracer->Raytrace();
 			launchRaytracer = false;
+			rendered = true;
+			renderedModelview = modelview;
+		}
+		else if (rendered && renderParameters.temporalReuse && !(modelview == renderedModelview)) {
+			raytracer->Reproject();
+			renderedModelview = modelview;
 		}
 
 		// Swap buffers